@@ -10,6 +10,8 @@
 #include "Utils/error.hpp"
 #include "Utils/strlib.hpp"
 #include "Utils/tokenScanner.hpp"
+#include "cfg.hpp"
+#include "engine.hpp"
 #include "exp.hpp"
 #include "parser.hpp"
 #include "program.hpp"
@@ -19,13 +21,49 @@
 
 void processLine(std::string &line, Program &program, EvalState &state);
 void direct_execute(std::string &line, Program &program, EvalState &state);
+bool parseCount(const std::string &text, long long &count);
 
 /* Main program */
 
-int main()
+int main(int argc, char **argv)
 {
   EvalState state;
   Program program;
+  long long bytecode_threshold = TieredEngine::DEFAULT_BYTECODE_THRESHOLD;
+  long long native_threshold = TieredEngine::DEFAULT_NATIVE_THRESHOLD;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    bool ok;
+    if (arg == "--jit" || startsWith(arg, "--engine="))
+    {
+      Engine *engine = getEngine(arg == "--jit" ? "JIT" : toUpperCase(arg.substr(9)));
+      ok = engine != nullptr;
+      if (ok)
+        setDefaultEngine(*engine);
+    }
+    else if (startsWith(arg, "--tier-bytecode="))
+      ok = parseCount(arg.substr(16), bytecode_threshold);
+    else if (startsWith(arg, "--tier-native="))
+      ok = parseCount(arg.substr(14), native_threshold);
+    else if (startsWith(arg, "--gosub-depth="))
+    {
+      long long depth = 0;
+      ok = parseCount(arg.substr(14), depth) && depth >= 1 && depth <= Program::MAX_GOSUB_DEPTH;
+      if (ok)
+        program.setGosubDepth(static_cast<int>(depth));
+    }
+    else
+      ok = false;
+    if (!ok)
+    {
+      std::cerr << "usage: " << argv[0]
+                << " [--jit] [--engine=TREE|VM|REG|JIT|TIERED] [--tier-bytecode=N] [--tier-native=N]"
+                << " [--gosub-depth=N]" << std::endl;
+      return 1;
+    }
+  }
+  getTieredEngine().setThresholds(bytecode_threshold, native_threshold);
   // cout << "Stub implementation of BASIC" << endl;
   while (true)
   {
@@ -81,8 +119,7 @@ void processLine(std::string &line, Program &program, EvalState &state)
       std::string lineNumberStr = line.substr(0, split);
       split++;
       line = line.substr(split);
-      program.addSourceLine(lineNumber, line);
-      program.addLineNumberStr(lineNumber, lineNumberStr);
+      program.addSourceLine(lineNumber, line, lineNumberStr);
     }
   }
   else
@@ -96,11 +133,12 @@ void direct_execute(std::string &line, Program &program, EvalState &state)
   TokenScanner scanner;
   scanner.ignoreWhitespace();
   scanner.scanNumbers();
-  scanner.setInput(line);
+  scanner.setInputView(line);
   std::string cmd = scanner.nextToken();
+  Arena scratch;
   if (cmd == "LET")
   {
-    auto temp = LETStatement(line);
+    LETStatement temp(line, scratch);
     try
     {
       temp.dir_execute(state, program);
@@ -113,7 +151,7 @@ void direct_execute(std::string &line, Program &program, EvalState &state)
   }
   else if (cmd == "PRINT")
   {
-    auto temp = PRINTStatement(line);
+    PRINTStatement temp(line, scratch);
     try
     {
       temp.dir_execute(state, program);
@@ -126,7 +164,7 @@ void direct_execute(std::string &line, Program &program, EvalState &state)
   }
   else if (cmd == "INPUT")
   {
-    auto temp = INPUTStatement(line);
+    INPUTStatement temp(line);
     try
     {
       temp.dir_execute(state, program);
@@ -139,7 +177,17 @@ void direct_execute(std::string &line, Program &program, EvalState &state)
   }
   else if (cmd == "RUN")
   {
-    program.run(state);
+    if (!scanner.hasMoreTokens())
+    {
+      program.run(state);
+      return;
+    }
+    Engine *engine = getEngine(scanner.nextToken());
+    if (engine == nullptr || scanner.hasMoreTokens())
+    {
+      error("SYNTAX ERROR");
+    }
+    program.run(state, *engine);
     return;
   }
   else if (cmd == "LIST")
@@ -147,6 +195,18 @@ void direct_execute(std::string &line, Program &program, EvalState &state)
     program.list();
     return;
   }
+  else if (cmd == "TIERS")
+  {
+    program.listTiers();
+    return;
+  }
+  else if (cmd == "CFG")
+  {
+    CFG cfg;
+    cfg.build(program);
+    cfg.dump(program, std::cout);
+    return;
+  }
   else if (cmd == "CLEAR")
   {
     program.clear();
@@ -168,3 +228,28 @@ void direct_execute(std::string &line, Program &program, EvalState &state)
     error("SYNTAX ERROR");
   }
 }
+
+/*
+ * Function: parseCount
+ * Usage: if (parseCount(text, count)) . . .
+ * -----------------------------------------
+ * Reads a non-negative decimal count from the value of a command-line
+ * flag, such as a tiering threshold or the GOSUB depth; the caller
+ * checks any further bounds.  Returns false and leaves count unchanged
+ * if text is not one.
+ */
+
+bool parseCount(const std::string &text, long long &count)
+{
+  if (text.empty() || text.size() > 18)
+    return false;
+  long long value = 0;
+  for (char ch : text)
+  {
+    if (!isdigit(ch))
+      return false;
+    value = value * 10 + (ch - '0');
+  }
+  count = value;
+  return true;
+}
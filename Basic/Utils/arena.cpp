@@ -0,0 +1,110 @@
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+#include "arena.hpp"
+
+/*
+ * Every block starts with a header that links it into the arena's
+ * list.  Blocks of BLOCK_SIZE go back to the pool; a larger block,
+ * made for a single oversized request, is freed directly.
+ */
+
+struct Arena::Block {
+    Block *next;
+    std::size_t size;
+};
+
+static const std::size_t HEADER_SIZE =
+        (sizeof(void *) + sizeof(std::size_t) + alignof(std::max_align_t) - 1)
+        / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+ArenaPool::~ArenaPool() {
+    while (free != nullptr) {
+        void *next = *static_cast<void **>(free);
+        std::free(free);
+        free = next;
+    }
+}
+
+void *ArenaPool::takeBlock() {
+    if (free == nullptr) {
+        void *block = std::malloc(BLOCK_SIZE);
+        if (block == nullptr) throw std::bad_alloc();
+        return block;
+    }
+    void *block = free;
+    free = *static_cast<void **>(block);
+    return block;
+}
+
+void ArenaPool::giveBlock(void *block) {
+    *static_cast<void **>(block) = free;
+    free = block;
+}
+
+//----------------------------------------------------------------------------------------
+
+Arena::Arena(ArenaPool *pool) : pool(pool) {
+}
+
+Arena::~Arena() {
+    reset();
+}
+
+Arena::Arena(Arena &&other) noexcept
+        : pool(other.pool), blocks(other.blocks), cur(other.cur), end(other.end) {
+    other.blocks = nullptr;
+    other.cur = other.end = nullptr;
+}
+
+Arena &Arena::operator=(Arena &&other) noexcept {
+    if (this != &other) {
+        reset();
+        pool = other.pool;
+        blocks = std::exchange(other.blocks, nullptr);
+        cur = std::exchange(other.cur, nullptr);
+        end = std::exchange(other.end, nullptr);
+    }
+    return *this;
+}
+
+void *Arena::allocate(std::size_t size, std::size_t align) {
+    std::uintptr_t p = (reinterpret_cast<std::uintptr_t>(cur) + align - 1) & ~(align - 1);
+    if (cur == nullptr || p + size > reinterpret_cast<std::uintptr_t>(end)) {
+        grow(size, align);
+        p = (reinterpret_cast<std::uintptr_t>(cur) + align - 1) & ~(align - 1);
+    }
+    cur = reinterpret_cast<char *>(p + size);
+    return reinterpret_cast<void *>(p);
+}
+
+void Arena::reset() {
+    while (blocks != nullptr) {
+        Block *next = blocks->next;
+        if (pool != nullptr && blocks->size == ArenaPool::BLOCK_SIZE) {
+            pool->giveBlock(blocks);
+        } else {
+            std::free(blocks);
+        }
+        blocks = next;
+    }
+    cur = end = nullptr;
+}
+
+void Arena::grow(std::size_t size, std::size_t align) {
+    std::size_t needed = HEADER_SIZE + size + align;
+    std::size_t bytes = needed <= ArenaPool::BLOCK_SIZE ? ArenaPool::BLOCK_SIZE : needed;
+    void *memory;
+    if (pool != nullptr && bytes == ArenaPool::BLOCK_SIZE) {
+        memory = pool->takeBlock();
+    } else {
+        memory = std::malloc(bytes);
+        if (memory == nullptr) throw std::bad_alloc();
+    }
+    Block *block = static_cast<Block *>(memory);
+    block->next = blocks;
+    block->size = bytes;
+    blocks = block;
+    cur = static_cast<char *>(memory) + HEADER_SIZE;
+    end = static_cast<char *>(memory) + bytes;
+}
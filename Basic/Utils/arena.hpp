@@ -0,0 +1,109 @@
+#ifndef CODE_ARENA_HPP
+#define CODE_ARENA_HPP
+
+#include <cstddef>
+#include <new>
+
+/*
+ * Class: ArenaPool
+ * ----------------
+ * A free list of fixed-size memory blocks shared by a family of
+ * arenas.  Blocks an arena gives back are kept for the next arena
+ * that needs one, so building and dropping arenas does not reach
+ * the system allocator once the pool has warmed up.
+ */
+
+class ArenaPool {
+public:
+    static const std::size_t BLOCK_SIZE = 4096;
+
+    ArenaPool() = default;
+
+    ~ArenaPool();
+
+    ArenaPool(const ArenaPool &) = delete;
+
+    ArenaPool &operator=(const ArenaPool &) = delete;
+
+    void *takeBlock();
+
+    void giveBlock(void *block);
+
+private:
+    void *free = nullptr;
+};
+
+/*
+ * Class: Arena
+ * ------------
+ * A bump allocator.  Memory is handed out from the current block by
+ * advancing a pointer, and the whole arena is released at once when
+ * it is destroyed or reset; there is no way to free a single object.
+ * Destructors of the objects placed in an arena are never run, so
+ * only types that own nothing outside the arena belong there.
+ *
+ * An arena built with a pool takes its standard blocks from it and
+ * returns them there; without one it uses the system allocator.
+ */
+
+class Arena {
+public:
+    explicit Arena(ArenaPool *pool = nullptr);
+
+    ~Arena();
+
+    Arena(Arena &&other) noexcept;
+
+    Arena &operator=(Arena &&other) noexcept;
+
+    Arena(const Arena &) = delete;
+
+    Arena &operator=(const Arena &) = delete;
+
+/*
+ * Method: allocate
+ * Usage: void *memory = arena.allocate(size, align);
+ * --------------------------------------------------
+ * Returns size bytes aligned to align, which must be a power of two.
+ */
+
+    void *allocate(std::size_t size, std::size_t align);
+
+/*
+ * Method: reset
+ * Usage: arena.reset();
+ * ---------------------
+ * Releases every block the arena holds, invalidating every object
+ * allocated from it.
+ */
+
+    void reset();
+
+private:
+    struct Block;
+
+    ArenaPool *pool;
+    Block *blocks = nullptr;
+    char *cur = nullptr;
+    char *end = nullptr;
+
+    void grow(std::size_t size, std::size_t align);
+};
+
+/*
+ * Operator: new (arena)
+ * Usage: Expression *exp = new (arena) ConstantExp(value);
+ * --------------------------------------------------------
+ * Constructs an object in an arena.  The matching delete is only
+ * called by the compiler when the constructor throws, and does
+ * nothing: the memory is reclaimed with the rest of the arena.
+ */
+
+inline void *operator new(std::size_t size, Arena &arena) {
+    return arena.allocate(size, alignof(std::max_align_t));
+}
+
+inline void operator delete(void *, Arena &) {
+}
+
+#endif //CODE_ARENA_HPP
@@ -11,6 +11,27 @@ std::string ErrorException::getMessage() const {
 
 //----------------------------------------------------------------------------------------
 
+static const char *const ERROR_MESSAGES[] = {
+    "",
+    "DIVIDE BY ZERO",
+    "VARIABLE NOT DEFINED",
+    "LINE NUMBER ERROR",
+    "FOR STACK OVERFLOW",
+    "NEXT WITHOUT FOR",
+    "GOSUB STACK OVERFLOW",
+    "RETURN WITHOUT GOSUB",
+    "Illegal variable in assignment",
+    "SYNTAX ERROR"
+};
+
+const char *errorMessage(ErrorCode code) {
+    return ERROR_MESSAGES[code];
+}
+
 void error(std::string message) {
     throw ErrorException(message);
+}
+
+void error(ErrorCode code) {
+    throw ErrorException(errorMessage(code));
 }
\ No newline at end of file
@@ -35,6 +35,49 @@ private:
 
 //------------------------------------------------------------------------------------------------
 
-void error(std::string message);
+/*
+ * Type: ErrorCode
+ * ---------------
+ * The runtime errors of a BASIC program, for code that reports an
+ * error by returning it rather than by throwing.  ERR_NONE means that
+ * nothing went wrong; every other code stands for the message that
+ * errorMessage returns, and no string is built until the error is
+ * raised.
+ */
+
+enum ErrorCode {
+    ERR_NONE,
+    ERR_DIVIDE_BY_ZERO,
+    ERR_VARIABLE_NOT_DEFINED,
+    ERR_LINE_NUMBER,
+    ERR_FOR_OVERFLOW,
+    ERR_NEXT_WITHOUT_FOR,
+    ERR_GOSUB_OVERFLOW,
+    ERR_RETURN_WITHOUT_GOSUB,
+    ERR_ILLEGAL_ASSIGNMENT,
+    ERR_SYNTAX
+};
+
+/*
+ * Function: errorMessage
+ * Usage: const char *message = errorMessage(code);
+ * ------------------------------------------------
+ * Returns the message that is printed for code.
+ */
+
+const char *errorMessage(ErrorCode code);
+
+/*
+ * Function: error
+ * Usage: error(message);
+ *        error(code);
+ * ----------------------
+ * Throws an ErrorException with the given message, or with the
+ * message for code.  The second form must not be given ERR_NONE.
+ */
+
+[[noreturn]] void error(std::string message);
+
+[[noreturn]] void error(ErrorCode code);
 
 #endif //CODE_ERROR_HPP
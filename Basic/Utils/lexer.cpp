@@ -0,0 +1,380 @@
+/*
+ * File: lexer.cpp
+ * ---------------
+ * Implementation for the Lexer class.
+ */
+
+#include "lexer.hpp"
+#include <cctype>
+#include "error.hpp"
+
+#if !defined(BASIC_LEXER_SCALAR) && defined(__AVX2__)
+#define BASIC_LEXER_AVX2 1
+#include <immintrin.h>
+#elif !defined(BASIC_LEXER_SCALAR) && defined(__SSE2__)
+#define BASIC_LEXER_SSE2 1
+#include <emmintrin.h>
+#endif
+
+
+/*
+ * Implementation notes: Lexer
+ * ---------------------------
+ * The character classes are taken from <cctype> once, here, so that
+ * every later test is a single table lookup.  The trie starts as a
+ * lone root with no children.
+ */
+
+Lexer::Lexer()
+{
+  for (int ch = 0; ch < 256; ch++)
+  {
+    std::uint8_t bits = 0;
+    if (std::isspace(ch))
+      bits |= CHAR_SPACE;
+    if (std::isdigit(ch))
+      bits |= CHAR_DIGIT;
+    if (std::isalnum(ch))
+      bits |= CHAR_WORD;
+    charClass[ch] = bits;
+  }
+  buildOperatorTrie();
+}
+
+/*
+ * Implementation notes: blockRun
+ * ------------------------------
+ * Returns the position of the first character from pos on that is not
+ * certainly in the class given by bits, testing 32 characters at a
+ * time with AVX2 or 16 with SSE2.  Each block is compared against the
+ * fixed ranges of the class: the six whitespace characters, the
+ * digits, or the letters and digits.  These are exactly what the
+ * constructor puts in charClass, and a class can only grow, so every
+ * character skipped here is in the class; the caller decides about
+ * the character the run stops at with the table.  The last partial
+ * block, and everything on a build without SIMD, is left to the
+ * caller.
+ */
+
+#if defined(BASIC_LEXER_AVX2)
+
+static const std::size_t BLOCK_SIZE = 32;
+static const unsigned FULL_MASK = 0xFFFFFFFFu;
+
+static __m256i inRange(__m256i block, char low, char high)
+{
+  __m256i offset = _mm256_sub_epi8(block, _mm256_set1_epi8(low));
+  return _mm256_cmpeq_epi8(_mm256_min_epu8(offset, _mm256_set1_epi8(char(high - low))), offset);
+}
+
+static unsigned blockMask(const char *p, bool space, bool word)
+{
+  __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+  __m256i in = inRange(block, '0', '9');
+  if (space)
+    in = _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8(' ')), inRange(block, '\t', '\r'));
+  else if (word)
+    in = _mm256_or_si256(in, inRange(_mm256_or_si256(block, _mm256_set1_epi8(0x20)), 'a', 'z'));
+  return static_cast<unsigned>(_mm256_movemask_epi8(in));
+}
+
+#elif defined(BASIC_LEXER_SSE2)
+
+static const std::size_t BLOCK_SIZE = 16;
+static const unsigned FULL_MASK = 0xFFFFu;
+
+static __m128i inRange(__m128i block, char low, char high)
+{
+  __m128i offset = _mm_sub_epi8(block, _mm_set1_epi8(low));
+  return _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(char(high - low))), offset);
+}
+
+static unsigned blockMask(const char *p, bool space, bool word)
+{
+  __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+  __m128i in = inRange(block, '0', '9');
+  if (space)
+    in = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(' ')), inRange(block, '\t', '\r'));
+  else if (word)
+    in = _mm_or_si128(in, inRange(_mm_or_si128(block, _mm_set1_epi8(0x20)), 'a', 'z'));
+  return static_cast<unsigned>(_mm_movemask_epi8(in));
+}
+
+#endif
+
+#if defined(BASIC_LEXER_AVX2) || defined(BASIC_LEXER_SSE2)
+
+std::size_t Lexer::blockRun(std::string_view source, std::size_t pos, std::uint8_t bits)
+{
+  bool space = bits & CHAR_SPACE;
+  bool word = bits & CHAR_WORD;
+  while (pos + BLOCK_SIZE <= source.size())
+  {
+    unsigned mask = blockMask(source.data() + pos, space, word);
+    if (mask != FULL_MASK)
+      return pos + __builtin_ctz(~mask);
+    pos += BLOCK_SIZE;
+  }
+  return pos;
+}
+
+#else
+
+std::size_t Lexer::blockRun(std::string_view, std::size_t pos, std::uint8_t) { return pos; }
+
+#endif
+
+void Lexer::ignoreWhitespace() { ignoreWhitespaceFlag = true; }
+
+void Lexer::ignoreComments() { ignoreCommentsFlag = true; }
+
+void Lexer::scanNumbers() { scanNumbersFlag = true; }
+
+void Lexer::scanStrings() { scanStringsFlag = true; }
+
+void Lexer::addWordCharacters(std::string_view str)
+{
+  for (char ch : str)
+    charClass[static_cast<unsigned char>(ch)] |= CHAR_WORD;
+}
+
+void Lexer::addOperator(std::string_view op)
+{
+  operators.emplace_back(op);
+  buildOperatorTrie();
+}
+
+/*
+ * Implementation notes: scan
+ * --------------------------
+ * The rules are tried in the order TokenScanner::nextToken has always
+ * used: whitespace and comments are skipped first, then a quoted
+ * string, a number, a word and finally an operator are tried at the
+ * first remaining character.  Each rule only measures the token; the
+ * span is filled in here.
+ */
+
+bool Lexer::scan(std::string_view source, std::size_t &pos, Token &token) const
+{
+  std::size_t n = source.size();
+  while (true)
+  {
+    if (ignoreWhitespaceFlag)
+      pos = scanRun(source, pos, CHAR_SPACE);
+    if (pos >= n)
+    {
+      pos = n;
+      return false;
+    }
+    if (source[pos] != '/' || !ignoreCommentsFlag)
+      break;
+    std::size_t end = skipComment(source, pos);
+    if (end == pos)
+      break;
+    pos = end;
+  }
+  char ch = source[pos];
+  std::size_t end;
+  TokenType type;
+  if ((ch == '"' || ch == '\'') && scanStringsFlag)
+  {
+    end = scanString(source, pos);
+    type = STRING;
+  }
+  else if (hasClass(ch, CHAR_DIGIT) && scanNumbersFlag)
+  {
+    end = scanNumber(source, pos);
+    type = NUMBER;
+  }
+  else if (isWordCharacter(ch))
+  {
+    end = scanWord(source, pos);
+    type = WORD;
+  }
+  else
+  {
+    end = scanOperator(source, pos);
+    type = hasClass(ch, CHAR_SPACE) ? SEPARATOR : OPERATOR;
+  }
+  token.start = static_cast<std::uint32_t>(pos);
+  token.length = static_cast<std::uint32_t>(end - pos);
+  token.type = type;
+  pos = end;
+  return true;
+}
+
+void Lexer::tokenize(std::string_view source, std::vector<Token> &tokens) const
+{
+  tokens.clear();
+  std::size_t pos = 0;
+  Token token;
+  while (scan(source, pos, token))
+    tokens.push_back(token);
+}
+
+/*
+ * Implementation notes: skipComment
+ * ---------------------------------
+ * Returns the position just past the comment that starts at pos, or
+ * pos itself if the slash there does not start one.  A line comment
+ * takes its line break with it; a block comment that is never closed
+ * runs to the end of the source.
+ */
+
+std::size_t Lexer::skipComment(std::string_view source, std::size_t pos) const
+{
+  std::size_t n = source.size();
+  if (pos + 1 >= n)
+    return pos;
+  if (source[pos + 1] == '/')
+  {
+    std::size_t end = source.find_first_of("\n\r", pos + 2);
+    return end == std::string_view::npos ? n : end + 1;
+  }
+  if (source[pos + 1] == '*')
+  {
+    std::size_t end = source.find("*/", pos + 2);
+    return end == std::string_view::npos ? n : end + 2;
+  }
+  return pos;
+}
+
+/*
+ * Implementation notes: scanRun
+ * -----------------------------
+ * Returns the end of the run of characters in the class given by bits
+ * that starts at pos.  Most runs in a BASIC line are a short name or
+ * number, which a block test would only slow down, so the first
+ * SCALAR_RUN characters are looked up one at a time.  A longer run,
+ * like the indentation of a pasted program or a long name, goes on a
+ * block at a time through blockRun; the table decides the character it
+ * stops at, which lets a word go on past an added word character, and
+ * the characters of a final partial block.
+ */
+
+static const std::size_t SCALAR_RUN = 8;
+
+std::size_t Lexer::scanRun(std::string_view source, std::size_t pos, std::uint8_t bits) const
+{
+  std::size_t n = source.size();
+  std::size_t scalarEnd = pos + SCALAR_RUN < n ? pos + SCALAR_RUN : n;
+  while (pos < scalarEnd && hasClass(source[pos], bits))
+    pos++;
+  if (pos < scalarEnd)
+    return pos;
+  while (pos < n)
+  {
+    pos = blockRun(source, pos, bits);
+    if (pos == n || !hasClass(source[pos], bits))
+      break;
+    pos++;
+  }
+  return pos;
+}
+
+std::size_t Lexer::scanWord(std::string_view source, std::size_t pos) const { return scanRun(source, pos, CHAR_WORD); }
+
+/*
+ * Implementation notes: scanNumber
+ * --------------------------------
+ * Accepts the same numbers as the finite-state machine of the original
+ * TokenScanner: digits, optionally a decimal point and more digits,
+ * and optionally an exponent.  An E that is not followed by digits, or
+ * by a sign and digits, is not part of the number.
+ */
+
+std::size_t Lexer::scanNumber(std::string_view source, std::size_t pos) const
+{
+  std::size_t n = source.size();
+  pos = scanRun(source, pos, CHAR_DIGIT);
+  if (pos < n && source[pos] == '.')
+    pos = scanRun(source, pos + 1, CHAR_DIGIT);
+  if (pos < n && (source[pos] == 'E' || source[pos] == 'e'))
+  {
+    std::size_t exponent = pos + 1;
+    if (exponent < n && (source[exponent] == '+' || source[exponent] == '-'))
+      exponent++;
+    if (exponent < n && hasClass(source[exponent], CHAR_DIGIT))
+      pos = scanRun(source, exponent, CHAR_DIGIT);
+  }
+  return pos;
+}
+
+std::size_t Lexer::scanString(std::string_view source, std::size_t pos) const
+{
+  char delim = source[pos++];
+  bool escape = false;
+  while (true)
+  {
+    if (pos >= source.size())
+      error("TokenScanner found unterminated string");
+    char ch = source[pos++];
+    if (ch == delim && !escape)
+      return pos;
+    escape = (ch == '\\') && !escape;
+  }
+}
+
+/*
+ * Implementation notes: scanOperator, buildOperatorTrie
+ * -----------------------------------------------------
+ * The longest defined operator that the source continues with wins.
+ * Any other character, whitespace included, is a token on its own.
+ *
+ * Only the characters that occur in some operator get a column in the
+ * trie, numbered from 1 in operatorSymbol; 0 marks every other
+ * character.  Each node is a row of symbolCount child indices, with 0
+ * for a missing child since the root, node 0, is nobody's child.  The
+ * walk follows the source until it falls off the trie, remembering the
+ * last node that ends an operator.  Operators are defined once, when
+ * the scanner is set up, so the trie is simply rebuilt each time.
+ */
+
+std::size_t Lexer::scanOperator(std::string_view source, std::size_t pos) const
+{
+  std::size_t length = 1;
+  int node = 0;
+  for (std::size_t i = pos; i < source.size(); i++)
+  {
+    int symbol = operatorSymbol[static_cast<unsigned char>(source[i])];
+    if (symbol == 0)
+      break;
+    node = operatorTrie[node * symbolCount + symbol - 1];
+    if (node == 0)
+      break;
+    if (operatorEnds[node])
+      length = i - pos + 1;
+  }
+  return pos + length;
+}
+
+void Lexer::buildOperatorTrie()
+{
+  for (const std::string &op : operators)
+  {
+    for (char ch : op)
+    {
+      std::uint8_t &symbol = operatorSymbol[static_cast<unsigned char>(ch)];
+      if (symbol == 0)
+        symbol = static_cast<std::uint8_t>(++symbolCount);
+    }
+  }
+  operatorTrie.assign(symbolCount, 0);
+  operatorEnds.assign(1, false);
+  for (const std::string &op : operators)
+  {
+    int node = 0;
+    for (char ch : op)
+    {
+      std::size_t edge = node * symbolCount + operatorSymbol[static_cast<unsigned char>(ch)] - 1;
+      if (operatorTrie[edge] == 0)
+      {
+        operatorTrie[edge] = static_cast<int>(operatorEnds.size());
+        operatorEnds.push_back(false);
+        operatorTrie.resize(operatorEnds.size() * symbolCount, 0);
+      }
+      node = operatorTrie[edge];
+    }
+    operatorEnds[node] = true;
+  }
+}
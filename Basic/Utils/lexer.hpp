@@ -0,0 +1,207 @@
+#ifndef CODE_LEXER_HPP
+#define CODE_LEXER_HPP
+
+
+/*
+ * File: lexer.h
+ * -------------
+ * This file exports a <code>Lexer</code> class that splits text into
+ * tokens by the same rules as <code>TokenScanner</code>, but works
+ * directly on a <code>std::string_view</code> of the source.  A token
+ * is a span of the source rather than a copy of its characters, so
+ * lexing allocates nothing per token.
+ */
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * Type: TokenType
+ * ---------------
+ * This enumerated type defines the values of the
+ * <code>getTokenType</code> method.
+ */
+
+enum TokenType
+{
+  SEPARATOR,
+  WORD,
+  NUMBER,
+  STRING,
+  OPERATOR
+};
+
+/*
+ * Type: Token
+ * -----------
+ * A token as a span of the source it was read from: the characters
+ * from <code>start</code> up to <code>start + length</code>.  The type
+ * says which rule matched; whitespace that is not ignored comes back
+ * as a one-character SEPARATOR.
+ */
+
+struct Token
+{
+  std::uint32_t start;
+  std::uint32_t length;
+  TokenType type;
+};
+
+/*
+ * Class: Lexer
+ * ------------
+ * This class holds the lexical rules of a scanner and applies them to
+ * source text.  The rules are set with the methods that have the same
+ * names in <code>TokenScanner</code>; a lexer keeps no position of its
+ * own, so one lexer can serve any number of sources.  The typical use
+ * reads every token of a line into an array that is reused from line
+ * to line:
+ *
+ *<pre>
+ *    Lexer lexer;
+ *    lexer.ignoreWhitespace();
+ *    std::vector<Token> tokens;
+ *    lexer.tokenize(line, tokens);
+ *    for (const Token &token : tokens) {
+ *       std::string_view text = Lexer::text(line, token);
+ *       ... process the token ...
+ *    }
+ *</pre>
+ */
+
+class Lexer
+{
+
+public:
+  /*
+   * Constructor: Lexer
+   * Usage: Lexer lexer;
+   * -------------------
+   * Creates a lexer with the default rules: whitespace is returned as
+   * tokens, words are made of letters and digits, and there are no
+   * multicharacter operators.
+   */
+
+  Lexer();
+
+  /*
+   * Methods: ignoreWhitespace, ignoreComments, scanNumbers, scanStrings
+   * Usage: lexer.ignoreWhitespace();
+   * -------------------------------------------------------------------
+   * Turn on the optional rules, exactly as the TokenScanner methods of
+   * the same names describe.
+   */
+
+  void ignoreWhitespace();
+
+  void ignoreComments();
+
+  void scanNumbers();
+
+  void scanStrings();
+
+  /*
+   * Methods: addWordCharacters, isWordCharacter
+   * Usage: lexer.addWordCharacters(str);
+   *        if (lexer.isWordCharacter(ch)) ...
+   * ------------------------------------------
+   * Extend and test the set of characters legal in a WORD token, which
+   * always holds the letters and digits.  The test is a lookup in a
+   * table of character classes, however many characters were added.
+   */
+
+  void addWordCharacters(std::string_view str);
+
+  bool isWordCharacter(char ch) const { return hasClass(ch, CHAR_WORD); }
+
+  /*
+   * Method: addOperator
+   * Usage: lexer.addOperator(op);
+   * -----------------------------
+   * Defines a new multicharacter operator.  At a run of operator
+   * characters the lexer takes the longest operator that matches, or a
+   * single character if none does.  Operators are kept in a trie, so
+   * matching costs one step per character, however many are defined.
+   */
+
+  void addOperator(std::string_view op);
+
+  /*
+   * Method: scan
+   * Usage: if (lexer.scan(source, pos, token)) ...
+   * ----------------------------------------------
+   * Reads the token that starts at or after position pos of source,
+   * skipping whitespace and comments if they are ignored, and advances
+   * pos past it.  Returns <code>false</code>, with pos at the end of
+   * the source, if no token is left.  An unterminated string is
+   * reported with error().
+   */
+
+  bool scan(std::string_view source, std::size_t &pos, Token &token) const;
+
+  /*
+   * Method: tokenize
+   * Usage: lexer.tokenize(source, tokens);
+   * --------------------------------------
+   * Replaces the contents of tokens with every token of source, in
+   * order.  The array keeps its capacity, so a caller that reuses it
+   * stops allocating once it has seen its longest input.
+   */
+
+  void tokenize(std::string_view source, std::vector<Token> &tokens) const;
+
+  /*
+   * Method: text
+   * Usage: std::string_view text = Lexer::text(source, token);
+   * ----------------------------------------------------------
+   * Returns the characters of token, which must have been read from
+   * source.
+   */
+
+  static std::string_view text(std::string_view source, const Token &token)
+  {
+    return source.substr(token.start, token.length);
+  }
+
+private:
+  /*
+   * Character classes, as bits of the entries in charClass.
+   */
+
+  static const std::uint8_t CHAR_SPACE = 1;
+  static const std::uint8_t CHAR_DIGIT = 2;
+  static const std::uint8_t CHAR_WORD = 4;
+
+  bool ignoreWhitespaceFlag = false; /* Lexer skips whitespace        */
+  bool ignoreCommentsFlag = false; /* Lexer skips comments          */
+  bool scanNumbersFlag = false; /* Lexer reads numbers as tokens */
+  bool scanStringsFlag = false; /* Lexer reads quoted strings    */
+  std::uint8_t charClass[256]; /* Classes of every character    */
+  std::uint8_t operatorSymbol[256] = {}; /* Trie column of each character */
+  int symbolCount = 0; /* Characters used by operators  */
+  std::vector<int> operatorTrie; /* Child of each node and symbol */
+  std::vector<bool> operatorEnds; /* Nodes that end an operator    */
+  std::vector<std::string> operators; /* Multicharacter operators      */
+
+  bool hasClass(char ch, std::uint8_t bits) const { return charClass[static_cast<unsigned char>(ch)] & bits; }
+
+  void buildOperatorTrie();
+
+  std::size_t skipComment(std::string_view source, std::size_t pos) const;
+
+  static std::size_t blockRun(std::string_view source, std::size_t pos, std::uint8_t bits);
+
+  std::size_t scanRun(std::string_view source, std::size_t pos, std::uint8_t bits) const;
+
+  std::size_t scanWord(std::string_view source, std::size_t pos) const;
+
+  std::size_t scanNumber(std::string_view source, std::size_t pos) const;
+
+  std::size_t scanString(std::string_view source, std::size_t pos) const;
+
+  std::size_t scanOperator(std::string_view source, std::size_t pos) const;
+};
+
+#endif // CODE_LEXER_HPP
@@ -6,193 +6,128 @@
 
 #include "tokenScanner.hpp"
 #include <cctype>
+#include <utility>
 #include "error.hpp"
-#include "strlib.hpp"
 
 
-TokenScanner::TokenScanner()
-{
-  initScanner();
-  setInput("");
-}
+TokenScanner::TokenScanner() = default;
 
-TokenScanner::TokenScanner(std::string str)
-{
-  initScanner();
-  setInput(str);
-}
+TokenScanner::TokenScanner(std::string str) { setInput(std::move(str)); }
 
-TokenScanner::TokenScanner(std::istream &infile)
-{
-  initScanner();
-  setInput(infile);
-}
+TokenScanner::TokenScanner(std::istream &infile) { setInput(infile); }
 
-TokenScanner::~TokenScanner()
-{
-  delete isp;
-  // delete savedTokens chain
-  StringCell *pre = savedTokens;
-  while (savedTokens)
-  {
-    savedTokens = savedTokens->link;
-    delete pre;
-    pre = savedTokens;
-  }
-  // delete operators chain
-  StringCell *p = operators;
-  while (operators)
-  {
-    operators = operators->link;
-    delete p;
-    p = operators;
-  }
-}
+TokenScanner::~TokenScanner() = default;
 
 void TokenScanner::setInput(std::string str)
 {
-  buffer = str;
-  if (isp != nullptr)
-    delete isp;
-  isp = new std::istringstream(buffer);
-  delete savedTokens;
-  savedTokens = nullptr;
+  buffer = std::move(str);
+  setInputView(buffer);
 }
 
 void TokenScanner::setInput(std::istream &infile)
 {
-  if (isp != nullptr)
-    delete isp;
-  isp = &infile;
-  delete savedTokens;
-  savedTokens = nullptr;
+  buffer.clear();
+  setInputView(buffer);
+  stream = &infile;
+}
+
+void TokenScanner::setInputView(std::string_view str)
+{
+  source = str;
+  stream = nullptr;
+  tokens.clear();
+  savedTokens.clear();
+  cursor = 0;
+  pos = 0;
+  consumed = 0;
 }
 
 bool TokenScanner::hasMoreTokens()
 {
-  std::string token = nextToken();
-  saveToken(token);
-  return (token != "");
+  if (!savedTokens.empty())
+    return !savedTokens.back().empty();
+  return fetchToken();
 }
 
 std::string TokenScanner::nextToken()
 {
-  if (savedTokens != nullptr)
+  if (!savedTokens.empty())
   {
-    StringCell *cp = savedTokens;
-    std::string token = cp->str;
-    savedTokens = cp->link;
-    delete cp;
+    std::string token = std::move(savedTokens.back());
+    savedTokens.pop_back();
     return token;
   }
-  while (true)
-  {
-    if (ignoreWhitespaceFlag)
-      skipSpaces();
-    int ch = isp->get();
-    if (ch == '/' && ignoreCommentsFlag)
-    {
-      ch = isp->get();
-      if (ch == '/')
-      {
-        while (true)
-        {
-          ch = isp->get();
-          if (ch == '\n' || ch == '\r' || ch == EOF)
-            break;
-        }
-        continue;
-      }
-      else if (ch == '*')
-      {
-        int prev = EOF;
-        while (true)
-        {
-          ch = isp->get();
-          if (ch == EOF || (prev == '*' && ch == '/'))
-            break;
-          prev = ch;
-        }
-        continue;
-      }
-      if (ch != EOF)
-        isp->unget();
-      ch = '/';
-    }
-    if (ch == EOF)
-      return "";
-    if ((ch == '"' || ch == '\'') && scanStringsFlag)
-    {
-      isp->unget();
-      return scanString();
-    }
-    if (isdigit(ch) && scanNumbersFlag)
-    {
-      isp->unget();
-      return scanNumber();
-    }
-    if (isWordCharacter(ch))
-    {
-      isp->unget();
-      return scanWord();
-    }
-    std::string op = std::string(1, ch);
-    while (isOperatorPrefix(op))
-    {
-      ch = isp->get();
-      if (ch == EOF)
-        break;
-      op += ch;
-    }
-    while (op.length() > 1 && !isOperator(op))
-    {
-      isp->unget();
-      op.erase(op.length() - 1, 1);
-    }
-    return op;
-  }
+  if (!fetchToken())
+    return "";
+  const Token &token = tokens[cursor++];
+  consumed = token.start + token.length;
+  return std::string(Lexer::text(source, token));
 }
 
+/*
+ * Implementation notes: saveToken
+ * -------------------------------
+ * Nearly every token pushed back is the one just read, and then the
+ * cursor only steps back over it.  Any other token is kept as a string
+ * and returned before the scanner reads on.
+ */
+
 void TokenScanner::saveToken(std::string token)
 {
-  StringCell *cp = new StringCell;
-  cp->str = token;
-  cp->link = savedTokens;
-  savedTokens = cp;
+  if (savedTokens.empty() && cursor > 0 && Lexer::text(source, tokens[cursor - 1]) == token)
+  {
+    consumed = tokens[--cursor].start;
+    return;
+  }
+  savedTokens.push_back(std::move(token));
 }
 
-void TokenScanner::ignoreWhitespace() { ignoreWhitespaceFlag = true; }
+void TokenScanner::ignoreWhitespace()
+{
+  lexer.ignoreWhitespace();
+  dropLookahead();
+}
 
-void TokenScanner::ignoreComments() { ignoreCommentsFlag = true; }
+void TokenScanner::ignoreComments()
+{
+  lexer.ignoreComments();
+  dropLookahead();
+}
 
-void TokenScanner::scanNumbers() { scanNumbersFlag = true; }
+void TokenScanner::scanNumbers()
+{
+  lexer.scanNumbers();
+  dropLookahead();
+}
 
-void TokenScanner::scanStrings() { scanStringsFlag = true; }
+void TokenScanner::scanStrings()
+{
+  lexer.scanStrings();
+  dropLookahead();
+}
 
-void TokenScanner::addWordCharacters(std::string str) { wordChars += str; }
+void TokenScanner::addWordCharacters(std::string str)
+{
+  lexer.addWordCharacters(str);
+  dropLookahead();
+}
 
 void TokenScanner::addOperator(std::string op)
 {
-  StringCell *cp = new StringCell;
-  cp->str = op;
-  cp->link = operators;
-  operators = cp;
+  lexer.addOperator(op);
+  dropLookahead();
 }
 
 int TokenScanner::getPosition() const
 {
-  if (savedTokens == nullptr)
-  {
-    return int(isp->tellg());
-  }
-  else
+  if (savedTokens.empty())
   {
-    return int(isp->tellg()) - savedTokens->str.length();
+    return int(consumed);
   }
-  return -1;
+  return int(consumed) - int(savedTokens.back().length());
 }
 
-bool TokenScanner::isWordCharacter(char ch) const { return isalnum(ch) || wordChars.find(ch) != std::string::npos; };
+bool TokenScanner::isWordCharacter(char ch) const { return lexer.isWordCharacter(ch); };
 
 void TokenScanner::verifyToken(std::string expected)
 {
@@ -214,7 +149,7 @@ TokenType TokenScanner::getTokenType(std::string token) const
   if (ch == '"' || (ch == '\'' && token.length() > 1))
     return STRING;
   bool digit_flag = true;
-  for (int i = 0; i < token.length(); i++)
+  for (std::size_t i = 0; i < token.length(); i++)
   {
     if (!isdigit(token[i]))
       digit_flag = false;
@@ -317,228 +252,113 @@ std::string TokenScanner::getStringValue(std::string token) const
   return str;
 }
 
-int TokenScanner::getChar() { return isp->get(); }
-
-void TokenScanner::ungetChar(int ch) { isp->unget(); }
-
-/* Private methods */
-
-void TokenScanner::initScanner()
-{
-  ignoreWhitespaceFlag = false;
-  ignoreCommentsFlag = false;
-  scanNumbersFlag = false;
-  scanStringsFlag = false;
-  operators = nullptr;
-}
-
 /*
- * Implementation notes: skipSpaces
- * --------------------------------
- * Advances the position of the scanner until the current character is
- * not a whitespace character.
+ * Implementation notes: getChar, ungetChar
+ * ----------------------------------------
+ * Reading characters directly moves the client past the tokens read
+ * ahead, so those are dropped, and so is the array of tokens already
+ * read: the cursor can no longer step back over them.  Pushing back
+ * EOF, as returned at the end of the input, leaves the position alone.
  */
 
-void TokenScanner::skipSpaces()
+int TokenScanner::getChar()
 {
-  while (true)
+  dropLookahead();
+  tokens.clear();
+  cursor = 0;
+  while (consumed >= source.size())
   {
-    int ch = isp->get();
-    if (ch == EOF)
-      return;
-    if (!isspace(ch))
-    {
-      isp->unget();
-      return;
-    }
+    if (!readLine())
+      return EOF;
   }
+  pos = ++consumed;
+  return static_cast<unsigned char>(source[consumed - 1]);
 }
 
-/*
- * Implementation notes: scanWord
- * ------------------------------
- * Reads characters until the scanner reaches the end of a sequence
- * of word characters.
- */
-
-std::string TokenScanner::scanWord()
+void TokenScanner::ungetChar(int ch)
 {
-  std::string token = "";
-  while (true)
-  {
-    int ch = isp->get();
-    if (ch == EOF)
-      break;
-    if (!isWordCharacter(ch))
-    {
-      isp->unget();
-      break;
-    }
-    token += char(ch);
-  }
-  return token;
+  dropLookahead();
+  tokens.clear();
+  cursor = 0;
+  if (ch == EOF)
+    return;
+  if (consumed == 0 || static_cast<unsigned char>(source[consumed - 1]) != ch)
+    error("TokenScanner::ungetChar: character does not match the one read");
+  pos = --consumed;
 }
 
+/* Private methods */
+
 /*
- * Implementation notes: scanNumber
- * --------------------------------
- * Reads characters until the scanner reaches the end of a legal number.
- * The function operates by simulating what computer scientists
- * call a finite-state machine.  The program uses the variable
- * <code>state</code> to record the history of the process and
- * determine what characters would be legal at this point in time.
+ * Implementation notes: fetchToken, dropLookahead, readLine
+ * ---------------------------------------------------------
+ * Tokens at and after the cursor have been read ahead, by
+ * hasMoreTokens or by stepping back in saveToken.  fetchToken makes
+ * sure the token at the cursor exists, reading it if necessary.  A
+ * change to the rules can split the source differently, so
+ * dropLookahead forgets the tokens read ahead and lexes again from
+ * where the client stopped.
+ *
+ * A stream is read into the buffer a line at a time, and only when
+ * the lexer runs out of characters, so an interactive stream is not
+ * read past the line that holds the token asked for.  Every line but
+ * the last ends in its line break, which ends any word, number or
+ * operator; only a string or a comment can go on to the next line.
+ * So when the lexer finds no token, or an unterminated string, before
+ * the end of the buffer, fetchToken reads another line and lexes
+ * again from the same place.
  */
 
-std::string TokenScanner::scanNumber()
+bool TokenScanner::fetchToken()
 {
-  std::string token = "";
-  NumberScannerState state = INITIAL_STATE;
-  while (state != FINAL_STATE)
+  if (cursor < tokens.size())
+    return true;
+  Token token;
+  while (true)
   {
-    int ch = isp->get();
-    int xch = 'e';
-    switch (state)
+    std::size_t next = pos;
+    try
     {
-    case INITIAL_STATE:
-      if (!isdigit(ch))
-      {
-        error("Internal error: illegal call to scanNumber");
-      }
-      state = BEFORE_DECIMAL_POINT;
-      break;
-    case BEFORE_DECIMAL_POINT:
-      if (ch == '.')
-      {
-        state = AFTER_DECIMAL_POINT;
-      }
-      else if (ch == 'E' || ch == 'e')
-      {
-        state = STARTING_EXPONENT;
-        xch = ch;
-      }
-      else if (!isdigit(ch))
-      {
-        if (ch != EOF)
-          isp->unget();
-        state = FINAL_STATE;
-      }
-      break;
-    case AFTER_DECIMAL_POINT:
-      if (ch == 'E' || ch == 'e')
+      if (lexer.scan(source, next, token))
       {
-        state = STARTING_EXPONENT;
-        xch = ch;
+        tokens.push_back(token);
+        pos = next;
+        return true;
       }
-      else if (!isdigit(ch))
+      if (!readLine())
       {
-        if (ch != EOF)
-          isp->unget();
-        state = FINAL_STATE;
+        pos = next;
+        return false;
       }
-      break;
-    case STARTING_EXPONENT:
-      if (ch == '+' || ch == '-')
-      {
-        state = FOUND_EXPONENT_SIGN;
-      }
-      else if (isdigit(ch))
-      {
-        state = SCANNING_EXPONENT;
-      }
-      else
-      {
-        if (ch != EOF)
-          isp->unget();
-        isp->unget();
-        state = FINAL_STATE;
-      }
-      break;
-    case FOUND_EXPONENT_SIGN:
-      if (isdigit(ch))
-      {
-        state = SCANNING_EXPONENT;
-      }
-      else
-      {
-        if (ch != EOF)
-          isp->unget();
-        isp->unget();
-        isp->unget();
-        state = FINAL_STATE;
-      }
-      break;
-    case SCANNING_EXPONENT:
-      if (!isdigit(ch))
-      {
-        if (ch != EOF)
-          isp->unget();
-        state = FINAL_STATE;
-      }
-      break;
-    default:
-      state = FINAL_STATE;
-      break;
     }
-    if (state != FINAL_STATE)
+    catch (ErrorException &)
     {
-      token += char(ch);
+      if (!readLine())
+        throw;
     }
   }
-  return token;
 }
 
-/*
- * Implementation notes: scanString
- * --------------------------------
- * Reads and returns a quoted string from the scanner, continuing until
- * it scans the matching delimiter.  The scanner generates an error if
- * there is no closing quotation mark before the end of the input.
- */
-
-std::string TokenScanner::scanString()
-{
-  std::string token = "";
-  char delim = isp->get();
-  token += delim;
-  bool escape = false;
-  while (true)
-  {
-    int ch = isp->get();
-    if (ch == EOF)
-      error("TokenScanner found unterminated string");
-    if (ch == delim && !escape)
-      break;
-    escape = (ch == '\\') && !escape;
-    token += ch;
-  }
-  return token + delim;
-}
-
-/*
- * Implementation notes: isOperator, isOperatorPrefix
- * --------------------------------------------------
- * These methods search the list of operators and return true if the
- * specified operator is either in the list or a prefix of an operator
- * in the list, respectively.  This code could be made considerably more
- * efficient by implementing operators as a trie.
- */
-
-bool TokenScanner::isOperator(std::string op)
+void TokenScanner::dropLookahead()
 {
-  for (StringCell *cp = operators; cp != nullptr; cp = cp->link)
-  {
-    if (op == cp->str)
-      return true;
-  }
-  return false;
+  if (cursor < tokens.size())
+    tokens.resize(cursor);
+  pos = consumed;
 }
 
-bool TokenScanner::isOperatorPrefix(std::string op)
+bool TokenScanner::readLine()
 {
-  for (StringCell *cp = operators; cp != nullptr; cp = cp->link)
+  if (stream == nullptr)
+    return false;
+  std::string line;
+  if (!std::getline(*stream, line))
   {
-    if (startsWith(cp->str, op))
-      return true;
+    stream = nullptr;
+    return false;
   }
-  return false;
+  buffer += line;
+  if (!stream->eof())
+    buffer += '\n';
+  source = buffer;
+  return true;
 }
@@ -15,24 +15,10 @@
  */
 
 #include <iostream>
-#include <sstream>
 #include <string>
-
-/*
- * Type: TokenType
- * ---------------
- * This enumerated type defines the values of the
- * <code>getTokenType</code> method.
- */
-
-enum TokenType
-{
-  SEPARATOR,
-  WORD,
-  NUMBER,
-  STRING,
-  OPERATOR
-};
+#include <string_view>
+#include <vector>
+#include "lexer.hpp"
 
 /*
  * Class: TokenScanner
@@ -53,6 +39,11 @@ enum TokenType
  * The <code>TokenScanner</code> class exports several additional methods
  * that give clients more control over its behavior.  Those methods are
  * described individually in the documentation.
+ *
+ * The scanner is a thin cursor over a <code>Lexer</code>: tokens are
+ * read as spans of the input into an array that only grows, so reading
+ * a token allocates nothing beyond the string it is returned as, and
+ * pushing back the token just read only moves the cursor.
  */
 
 class TokenScanner
@@ -90,13 +81,27 @@ public:
    *        scanner.setInput(infile);
    * --------------------------------
    * Sets the token stream for this scanner to the specified string or
-   * input stream.  Any previous token stream is discarded.
+   * input stream.  Any previous token stream is discarded.  The scanner
+   * keeps its own copy of the string; a stream is read a line at a
+   * time, as the tokens are asked for, and must outlive the scanner's
+   * use of it.
    */
 
   void setInput(std::string str);
 
   void setInput(std::istream &infile);
 
+  /*
+   * Method: setInputView
+   * Usage: scanner.setInputView(str);
+   * ---------------------------------
+   * Sets the token stream like <code>setInput</code>, but scans the
+   * characters of <code>str</code> in place instead of copying them.
+   * They must stay unchanged for as long as the scanner reads them.
+   */
+
+  void setInputView(std::string_view str);
+
   /*
    * Method: hasMoreTokens
    * Usage: if (scanner.hasMoreTokens()) ...
@@ -286,7 +291,8 @@ public:
    * Usage: scanner.ungetChar(ch);
    * -----------------------------
    * Pushes the character <code>ch</code> back into the scanner stream.
-   * The character must match the one that was read.
+   * The character must match the one that was read; if it does not,
+   * <code>ungetChar</code> throws an error.
    */
 
   void ungetChar(int ch);
@@ -310,58 +316,23 @@ public:
   /**********************************************************************/
 
 private:
-  /*
-   * Private type: StringCell
-   * ------------------------
-   * This type is used to construct linked lists of cells, which are used
-   * to represent both the stack of saved tokens and the set of defined
-   * operators.  These types cannot use the Stack and Lexicon classes
-   * directly because tokenscanner.h is an extremely low-level interface,
-   * and doing so would create circular dependencies in the .h files.
-   */
-
-  struct StringCell
-  {
-    std::string str;
-    StringCell *link;
-  };
-
-  enum NumberScannerState
-  {
-    INITIAL_STATE,
-    BEFORE_DECIMAL_POINT,
-    AFTER_DECIMAL_POINT,
-    STARTING_EXPONENT,
-    FOUND_EXPONENT_SIGN,
-    SCANNING_EXPONENT,
-    FINAL_STATE
-  };
-
-  std::string buffer; /* The original argument string */
-  std::istream *isp = nullptr; /* The input stream for tokens  */
-  bool ignoreWhitespaceFlag; /* Scanner ignores whitespace   */
-  bool ignoreCommentsFlag; /* Scanner ignores comments     */
-  bool scanNumbersFlag; /* Scanner parses numbers       */
-  bool scanStringsFlag; /* Scanner parses strings       */
-  std::string wordChars; /* Additional word characters   */
-  StringCell *savedTokens = nullptr; /* Stack of saved tokens        */
-  StringCell *operators = nullptr; /* List of multichar operators  */
+  Lexer lexer; /* The rules tokens are read by   */
+  std::string buffer; /* Copy made by setInput         */
+  std::istream *stream = nullptr; /* Stream still being read, if any */
+  std::string_view source; /* The characters being scanned  */
+  std::vector<Token> tokens; /* Tokens read from source       */
+  std::size_t cursor = 0; /* Index of the next token       */
+  std::size_t pos = 0; /* Where the lexer reads next    */
+  std::size_t consumed = 0; /* End of what the client has read */
+  std::vector<std::string> savedTokens; /* Stack of pushed-back tokens   */
 
   /* Private method prototypes */
 
-  void initScanner();
-
-  void skipSpaces();
-
-  std::string scanWord();
-
-  std::string scanNumber();
-
-  std::string scanString();
+  bool fetchToken();
 
-  bool isOperator(std::string op);
+  void dropLookahead();
 
-  bool isOperatorPrefix(std::string op);
+  bool readLine();
 };
 
 #endif // CODE_TOKENSCANNER_HPP
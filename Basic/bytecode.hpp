@@ -0,0 +1,215 @@
+/*
+ * File: bytecode.h
+ * ----------------
+ * This interface defines the linear bytecode that a BASIC program is
+ * lowered to before it runs on the virtual machine.  A program is
+ * stored as a Chunk: a flat array of fixed-size instructions whose
+ * slot operands are the interned slots of the EvalState.
+ */
+
+#ifndef _bytecode_h
+#define _bytecode_h
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Type: OpCode
+ * ------------
+ * The instruction set of the stack machine.  Unless noted otherwise
+ * an instruction pops its inputs from the operand stack and pushes
+ * its result back onto it.
+ *
+ *   OP_CONST c        push the constant c
+ *   OP_LOAD s         push variable s (VARIABLE NOT DEFINED if unset)
+ *   OP_STORE s        pop into variable s
+ *   OP_ASSIGN s       copy the top of the stack into variable s
+ *   OP_ADD .. OP_DIV  binary arithmetic (OP_DIV checks for zero)
+ *   OP_ADD_CONST c    add the constant c to the top of the stack
+ *   OP_MUL_CONST c    multiply the top of the stack by the constant c
+ *   OP_DIV_CONST d    divide the top of the stack by divisors[d], which
+ *                     can neither be zero nor overflow
+ *   OP_PRINT          pop and print
+ *   OP_INPUT s        prompt for an integer and store it in s
+ *   OP_JUMP t         continue at instruction t
+ *   OP_JUMP_EQ t      pop rhs and lhs, jump to t if lhs == rhs
+ *   OP_JUMP_NE t      pop rhs and lhs, jump to t if lhs != rhs
+ *   OP_JUMP_LT t      pop rhs and lhs, jump to t if lhs < rhs
+ *   OP_JUMP_LE t      pop rhs and lhs, jump to t if lhs <= rhs
+ *   OP_JUMP_GT t      pop rhs and lhs, jump to t if lhs > rhs
+ *   OP_JUMP_GE t      pop rhs and lhs, jump to t if lhs >= rhs
+ *   OP_LINE_ERROR     stop with LINE NUMBER ERROR
+ *   OP_HALT           stop normally
+ *   OP_EXIT e         leave the chunk and continue at line exitLines[e],
+ *                     or at the line after the current one if e is
+ *                     EXIT_NEXT_LINE
+ *   OP_GOSUB t        push the index of the next instruction onto the
+ *                     return stack and continue at instruction t
+ *   OP_RETURN         pop an index from the return stack and continue
+ *                     there
+ *   OP_ON_GOTO f, n   pop k and continue at instruction targets[f+k-1]
+ *                     if 1 <= k <= n, or at the next instruction if not
+ *   OP_ON_GOSUB f, n  as OP_ON_GOTO, but a jump first pushes the index
+ *                     of the next instruction onto the return stack
+ *
+ * OP_EXIT only appears in the single-line chunks that the tiered
+ * engine compiles; the driver that ran the chunk follows the exit.
+ * Naming the line through exitLines lets the driver resolve each
+ * target to a position once, instead of on every exit.
+ * The return stack is separate from the operand stack, which is empty
+ * whenever a GOSUB or RETURN runs, and holds at most callDepth entries.
+ * The OP_ON_* instructions keep their count n in the a field.  A table
+ * entry of -1 stands for a missing line: choosing it stops with LINE
+ * NUMBER ERROR, before anything is pushed.
+ *
+ * The remaining opcodes are superinstructions, each doing the work of
+ * a whole statement of a common shape in one dispatch.  They take
+ * their extra operands from the a, b and c fields of the instruction:
+ *
+ *   OP_INC s, c               LET V = V + c: add c to variable s
+ *   OP_JUMP_EQ_CONST t, s, c  IF V = c: jump to t if variable s == c
+ *   OP_JUMP_LT_CONST t, s, c  IF V < c: jump to t if variable s < c
+ *   OP_JUMP_GT_CONST t, s, c  IF V > c: jump to t if variable s > c
+ *   OP_JUMP_EQ_VARS t, s, w   IF V = W: jump to t if variable s == w
+ *   OP_JUMP_LT_VARS t, s, w   IF V < W: jump to t if variable s < w
+ *   OP_JUMP_GT_VARS t, s, w   IF V > W: jump to t if variable s > w
+ *   OP_PRINT_VAR s            PRINT V: print variable s
+ *   OP_NEXT_UP t, s, c, l     NEXT V with a step c >= 0: add c to
+ *                             variable s and jump to t if it is <= l
+ *   OP_NEXT_DOWN t, s, c, l   NEXT V with a step c < 0: add c to
+ *                             variable s and jump to t if it is >= l
+ *
+ * Every variable they read must be defined, as for OP_LOAD, except
+ * that the OP_NEXT_* instructions do not check: the compiler only
+ * emits them in loops that are entered through a FOR, which defines
+ * both the loop variable s and the variable l that holds its limit.
+ * The set was chosen with bench_opcodes: on the Test corpus and the
+ * benchmark programs, LOAD ADD_CONST STORE and LOAD CONST JUMP_* are
+ * the most frequent sequences of three instructions, and the OP_NEXT_*
+ * instructions make each pass of a counted loop a single dispatch.
+ */
+
+enum OpCode : std::uint8_t
+{
+  OP_CONST,
+  OP_LOAD,
+  OP_STORE,
+  OP_ASSIGN,
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_ADD_CONST,
+  OP_MUL_CONST,
+  OP_DIV_CONST,
+  OP_PRINT,
+  OP_INPUT,
+  OP_JUMP,
+  OP_JUMP_EQ,
+  OP_JUMP_NE,
+  OP_JUMP_LT,
+  OP_JUMP_LE,
+  OP_JUMP_GT,
+  OP_JUMP_GE,
+  OP_LINE_ERROR,
+  OP_HALT,
+  OP_EXIT,
+  OP_GOSUB,
+  OP_RETURN,
+  OP_ON_GOTO,
+  OP_ON_GOSUB,
+  OP_INC,
+  OP_JUMP_EQ_CONST,
+  OP_JUMP_LT_CONST,
+  OP_JUMP_GT_CONST,
+  OP_JUMP_EQ_VARS,
+  OP_JUMP_LT_VARS,
+  OP_JUMP_GT_VARS,
+  OP_PRINT_VAR,
+  OP_NEXT_UP,
+  OP_NEXT_DOWN
+};
+
+/*
+ * Constant: EXIT_NEXT_LINE
+ * ------------------------
+ * The OP_EXIT operand that means "fall through to the next line".
+ */
+
+const int EXIT_NEXT_LINE = -1;
+
+/*
+ * Type: Instruction
+ * -----------------
+ * A single instruction.  The meaning of operand depends on the opcode:
+ * a constant, a variable slot or an instruction index.  Only the
+ * superinstructions and the OP_ON_* instructions use a, b and c.
+ */
+
+struct Instruction
+{
+  OpCode op;
+  int operand;
+  int a = 0;
+  int b = 0;
+  int c = 0;
+};
+
+/*
+ * Type: DivMagic
+ * --------------
+ * A constant divisor prepared for division without a divide
+ * instruction, by the method of Granlund and Montgomery as given in
+ * Hacker's Delight: the quotient is the high half of the dividend
+ * times multiplier, corrected by adding or subtracting the dividend
+ * (adjust), shifted right by shift, and rounded toward zero.  The
+ * divisor is at least 2 in absolute value.
+ */
+
+struct DivMagic
+{
+  int divisor;
+  int multiplier;
+  int adjust;
+  int shift;
+};
+
+/*
+ * Function: divideByMagic
+ * Usage: int quotient = divideByMagic(dividend, magic);
+ * -----------------------------------------------------
+ * Returns dividend / magic.divisor, truncated toward zero exactly as
+ * the / operator does.
+ */
+
+inline int divideByMagic(int dividend, const DivMagic &magic)
+{
+  auto high = static_cast<std::uint32_t>((static_cast<std::int64_t>(dividend) * magic.multiplier) >> 32);
+  high += static_cast<std::uint32_t>(magic.adjust) * static_cast<std::uint32_t>(dividend);
+  auto quotient = static_cast<std::int32_t>(high) >> magic.shift;
+  return quotient + static_cast<int>(static_cast<std::uint32_t>(quotient) >> 31);
+}
+
+/*
+ * Type: Chunk
+ * -----------
+ * The compiled form of a whole program.  Every slot operand is below
+ * numSlots; maxStack bounds the operand stack depth and callDepth the
+ * number of OP_GOSUB that can be active at once.  divisors holds the
+ * constants OP_DIV_CONST refers to, and targets the jump tables of the
+ * OP_ON_* instructions, one run of instruction indices per instruction.
+ */
+
+struct Chunk
+{
+  std::vector<Instruction> code;
+  std::vector<DivMagic> divisors;
+  std::vector<int> targets;
+  std::vector<int> exitLines;
+  int numSlots = 0;
+  int maxStack = 0;
+  int callDepth = 0;
+};
+
+#endif
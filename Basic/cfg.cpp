@@ -0,0 +1,381 @@
+/*
+ * File: cfg.cpp
+ * -------------
+ * This file implements the CFG class.
+ */
+
+#include "cfg.hpp"
+#include <algorithm>
+#include <map>
+
+
+void CFG::build(Program &program)
+{
+  blocks.clear();
+  blockOf.clear();
+  order.clear();
+  orderIndex.clear();
+  loops.clear();
+  program.link();
+  findBlocks(program);
+  computeOrder();
+  computeDominators();
+  findLoops();
+}
+
+int CFG::getBlockCount() const { return static_cast<int>(blocks.size()); }
+
+const BasicBlock &CFG::getBlock(int block) const { return blocks[block]; }
+
+int CFG::getBlockOf(int lineIndex) const { return blockOf[lineIndex]; }
+
+bool CFG::dominates(int a, int b) const
+{
+  if (!blocks[a].reachable || !blocks[b].reachable)
+    return false;
+  while (b != a)
+  {
+    if (b == 0)
+      return false;
+    b = blocks[b].idom;
+  }
+  return true;
+}
+
+bool CFG::isBackEdge(int from, int to) const
+{
+  const std::vector<int> &succs = blocks[from].succs;
+  return std::find(succs.begin(), succs.end(), to) != succs.end() && dominates(to, from);
+}
+
+const std::vector<Loop> &CFG::getLoops() const { return loops; }
+
+const std::vector<int> &CFG::getOrder() const { return order; }
+
+/*
+ * Implementation notes: findBlocks
+ * --------------------------------
+ * A line starts a block if it is the first line, the target of a jump
+ * or the line after a GOTO, IF, NEXT, END, GOSUB, RETURN or ON.  Only
+ * those statements transfer control, so every block ends with one of
+ * them or falls through into the next leader.  A NEXT branches like an
+ * IF, back to the first line of the body of the FOR it was paired with
+ * by link; one without a FOR stops the program like a jump to a
+ * missing line.  An ON may continue at any of its targets or fall
+ * through.  A GOSUB jumps like a GOTO, and since the return stack is
+ * not modelled, every RETURN may continue after any GOSUB or
+ * ON . . . GOSUB with a target that exists, or leave the program if
+ * that line is the last one.
+ * Runtime errors can stop a program at any line; they are not edges.
+ */
+
+static bool isJump(StatementType type)
+{
+  return type == GOTO || type == IF || type == NEXT || type == GOSUB || type == ON;
+}
+
+static bool isCall(Statement *stmt)
+{
+  return stmt->getType() == GOSUB || (stmt->getType() == ON && static_cast<ONStatement *>(stmt)->isGosub());
+}
+
+static void targetsOf(Statement *stmt, std::vector<int> &out)
+{
+  out.clear();
+  switch (stmt->getType())
+  {
+    case GOTO:
+      out.push_back(static_cast<GOTOStatement *>(stmt)->getTargetIndex());
+      break;
+    case IF:
+      out.push_back(static_cast<IFStatement *>(stmt)->getTargetIndex());
+      break;
+    case NEXT:
+      out.push_back(static_cast<NEXTStatement *>(stmt)->getTargetIndex());
+      break;
+    case GOSUB:
+      out.push_back(static_cast<GOSUBStatement *>(stmt)->getTargetIndex());
+      break;
+    case ON:
+      {
+        auto *on = static_cast<ONStatement *>(stmt);
+        for (int choice = 0; choice < on->getTargetCount(); choice++)
+          out.push_back(on->getTargetIndex(choice));
+        break;
+      }
+    default:
+      break;
+  }
+}
+
+void CFG::findBlocks(Program &program)
+{
+  int count = program.getLineCount();
+  std::vector<bool> leader(count, false);
+  std::vector<int> returnPoints;
+  std::vector<int> targets;
+  bool returnsPastEnd = false;
+  for (int i = 0; i < count; i++)
+  {
+    Statement *stmt = program.getStatementAt(i);
+    StatementType type = stmt->getType();
+    if (!isJump(type) && type != END && type != RETURN)
+      continue;
+    targetsOf(stmt, targets);
+    bool calls = false;
+    for (int target : targets)
+    {
+      if (target >= 0)
+      {
+        leader[target] = true;
+        calls = calls || isCall(stmt);
+      }
+    }
+    if (calls)
+    {
+      if (i + 1 < count)
+        returnPoints.push_back(i + 1);
+      else
+        returnsPastEnd = true;
+    }
+    if (i + 1 < count)
+      leader[i + 1] = true;
+  }
+
+  blockOf.resize(count);
+  for (int i = 0; i < count; i++)
+  {
+    if (i == 0 || leader[i])
+    {
+      blocks.emplace_back();
+      blocks.back().first = i;
+    }
+    blocks.back().last = i;
+    blockOf[i] = static_cast<int>(blocks.size()) - 1;
+  }
+
+  for (BasicBlock &block : blocks)
+  {
+    Statement *stmt = program.getStatementAt(block.last);
+    StatementType type = stmt->getType();
+    bool fallsThrough = type != GOTO && type != END && type != GOSUB && type != RETURN;
+    if (fallsThrough)
+    {
+      if (block.last + 1 < count)
+        block.succs.push_back(blockOf[block.last + 1]);
+      else
+        block.exits = true;
+    }
+    targetsOf(stmt, targets);
+    for (int target : targets)
+    {
+      if (target < 0)
+        block.exits = true;
+      else if (std::find(block.succs.begin(), block.succs.end(), blockOf[target]) == block.succs.end())
+        block.succs.push_back(blockOf[target]);
+    }
+    if (type == END)
+      block.exits = true;
+    if (type == RETURN)
+    {
+      for (int point : returnPoints)
+      {
+        if (std::find(block.succs.begin(), block.succs.end(), blockOf[point]) == block.succs.end())
+          block.succs.push_back(blockOf[point]);
+      }
+      block.exits = returnsPastEnd;
+    }
+  }
+  for (int b = 0; b < getBlockCount(); b++)
+  {
+    for (int succ : blocks[b].succs)
+      blocks[succ].preds.push_back(b);
+  }
+}
+
+/*
+ * Implementation notes: computeOrder
+ * ----------------------------------
+ * An explicit stack of (block, next successor) pairs replaces the
+ * recursion of a depth-first search, so a long chain of blocks cannot
+ * overflow the native stack.
+ */
+
+void CFG::computeOrder()
+{
+  orderIndex.assign(blocks.size(), -1);
+  if (blocks.empty())
+    return;
+  std::vector<std::pair<int, int>> stack;
+  blocks[0].reachable = true;
+  stack.emplace_back(0, 0);
+  while (!stack.empty())
+  {
+    auto &top = stack.back();
+    const BasicBlock &block = blocks[top.first];
+    if (top.second < static_cast<int>(block.succs.size()))
+    {
+      int succ = block.succs[top.second++];
+      if (!blocks[succ].reachable)
+      {
+        blocks[succ].reachable = true;
+        stack.emplace_back(succ, 0);
+      }
+      continue;
+    }
+    order.push_back(top.first);
+    stack.pop_back();
+  }
+  std::reverse(order.begin(), order.end());
+  for (int i = 0; i < static_cast<int>(order.size()); i++)
+    orderIndex[order[i]] = i;
+}
+
+/*
+ * Implementation notes: computeDominators
+ * ---------------------------------------
+ * This is the iterative algorithm of Cooper, Harvey and Kennedy: each
+ * pass over the blocks in reverse postorder intersects the dominator
+ * chains of the processed predecessors, walking up the tree by
+ * postorder position, until nothing changes.  The entry is its own
+ * immediate dominator while the passes run.
+ */
+
+void CFG::computeDominators()
+{
+  if (blocks.empty())
+    return;
+  blocks[0].idom = 0;
+  bool changed = true;
+  while (changed)
+  {
+    changed = false;
+    for (int b : order)
+    {
+      if (b == 0)
+        continue;
+      int idom = -1;
+      for (int pred : blocks[b].preds)
+      {
+        if (blocks[pred].idom < 0)
+          continue;
+        if (idom < 0)
+        {
+          idom = pred;
+          continue;
+        }
+        int other = pred;
+        while (idom != other)
+        {
+          while (orderIndex[idom] > orderIndex[other])
+            idom = blocks[idom].idom;
+          while (orderIndex[other] > orderIndex[idom])
+            other = blocks[other].idom;
+        }
+      }
+      if (blocks[b].idom != idom)
+      {
+        blocks[b].idom = idom;
+        changed = true;
+      }
+    }
+  }
+}
+
+/*
+ * Implementation notes: findLoops
+ * -------------------------------
+ * The body of a natural loop is its header plus every block that can
+ * reach a latch without passing through the header, found by walking
+ * predecessors back from the latches.  Sorting by size puts each inner
+ * loop before any loop containing it, since a containing loop always
+ * has more blocks.
+ */
+
+void CFG::findLoops()
+{
+  std::map<int, Loop> byHeader;
+  for (int b : order)
+  {
+    for (int succ : blocks[b].succs)
+    {
+      if (dominates(succ, b))
+      {
+        byHeader[succ].header = succ;
+        byHeader[succ].latches.push_back(b);
+      }
+    }
+  }
+  for (auto &entry : byHeader)
+  {
+    Loop &loop = entry.second;
+    std::vector<bool> inLoop(blocks.size(), false);
+    inLoop[loop.header] = true;
+    std::vector<int> work(loop.latches);
+    while (!work.empty())
+    {
+      int b = work.back();
+      work.pop_back();
+      if (inLoop[b])
+        continue;
+      inLoop[b] = true;
+      for (int pred : blocks[b].preds)
+      {
+        if (blocks[pred].reachable && !inLoop[pred])
+          work.push_back(pred);
+      }
+    }
+    for (int b = 0; b < getBlockCount(); b++)
+    {
+      if (inLoop[b])
+      {
+        loop.blocks.push_back(b);
+        blocks[b].loopDepth++;
+      }
+    }
+    std::sort(loop.latches.begin(), loop.latches.end());
+    loops.push_back(std::move(loop));
+  }
+  std::stable_sort(loops.begin(), loops.end(),
+                   [](const Loop &a, const Loop &b) { return a.blocks.size() < b.blocks.size(); });
+}
+
+/*
+ * Implementation notes: dump
+ * --------------------------
+ * Run counts come from the line profiles, which only the tiered engine
+ * keeps up to date; after a run on another engine they read 0.
+ */
+
+void CFG::dump(Program &program, std::ostream &out) const
+{
+  for (int b = 0; b < getBlockCount(); b++)
+  {
+    const BasicBlock &block = blocks[b];
+    out << "B" << b << " " << program.getLineNumberAt(block.first);
+    if (block.last != block.first)
+      out << "-" << program.getLineNumberAt(block.last);
+    out << " ->";
+    for (int succ : block.succs)
+      out << " B" << succ;
+    if (block.exits)
+      out << " EXIT";
+    if (!block.reachable)
+      out << " (unreachable)";
+    else if (block.loopDepth > 0)
+      out << " (loop depth " << block.loopDepth << ", runs " << program.getProfileAt(block.first).executions << ")";
+    else
+      out << " (runs " << program.getProfileAt(block.first).executions << ")";
+    out << "\n";
+  }
+  for (const Loop &loop : loops)
+  {
+    out << "LOOP B" << loop.header << ":";
+    for (int b : loop.blocks)
+      out << " B" << b;
+    out << " (back edge from";
+    for (int latch : loop.latches)
+      out << " B" << latch;
+    out << ")\n";
+  }
+}
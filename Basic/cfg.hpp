@@ -0,0 +1,166 @@
+/*
+ * File: cfg.h
+ * -----------
+ * This interface exports the CFG class, which splits a linked program
+ * into basic blocks and records the control-flow edges between them,
+ * the dominator tree and the natural loops.  The optimizers and the
+ * profiler share it: a block is a run of consecutive lines that always
+ * execute together, so it is both the unit an optimizer may rearrange
+ * and the unit in which execution counts are meaningful.
+ */
+
+#ifndef _cfg_h
+#define _cfg_h
+
+#include <ostream>
+#include <vector>
+#include "program.hpp"
+
+/*
+ * Type: BasicBlock
+ * ----------------
+ * A maximal run of lines, given as positions in the linked program,
+ * that is only entered at first and only left after last.  succs lists
+ * the blocks control can continue in: the target of a GOTO, IF, NEXT
+ * or GOSUB, every target of an ON, the block after every GOSUB for a
+ * RETURN, and the block of the next line when control may fall
+ * through.  exits is set when control may also leave the program at
+ * the end of the block, through END, by running off the last line or
+ * by jumping to a missing line.  idom is the immediate dominator,
+ * which is the block itself for the entry and -1 for a block that
+ * cannot be reached from it.  loopDepth counts the natural loops the
+ * block belongs to.
+ */
+
+struct BasicBlock
+{
+  int first = 0;
+  int last = 0;
+  std::vector<int> succs;
+  std::vector<int> preds;
+  bool exits = false;
+  bool reachable = false;
+  int idom = -1;
+  int loopDepth = 0;
+};
+
+/*
+ * Type: Loop
+ * ----------
+ * A natural loop: the header block, which dominates every block of the
+ * loop, the latches whose back edges return to the header, and every
+ * block of the body in ascending order.  Loops that share a header are
+ * merged into one.
+ */
+
+struct Loop
+{
+  int header = 0;
+  std::vector<int> latches;
+  std::vector<int> blocks;
+};
+
+/*
+ * Class: CFG
+ * ----------
+ * The control-flow graph of a program as it was when build was called.
+ * Any edit to the program invalidates it.  Block 0, if there is one,
+ * holds the first line and is the entry.
+ */
+
+class CFG
+{
+public:
+  /*
+   * Method: build
+   * Usage: cfg.build(program);
+   * --------------------------
+   * Links program and computes its blocks, edges, dominators and loops,
+   * replacing whatever the CFG held before.
+   */
+
+  void build(Program &program);
+
+  /*
+   * Methods: getBlockCount, getBlock, getBlockOf
+   * Usage: const BasicBlock &block = cfg.getBlock(cfg.getBlockOf(index));
+   * ---------------------------------------------------------------------
+   * Return the number of blocks, a block by number, and the block that
+   * holds the line at the given position.
+   */
+
+  int getBlockCount() const;
+
+  const BasicBlock &getBlock(int block) const;
+
+  int getBlockOf(int lineIndex) const;
+
+  /*
+   * Method: dominates
+   * Usage: if (cfg.dominates(a, b)) . . .
+   * -------------------------------------
+   * Returns true if every path from the entry to block b passes through
+   * block a.  A block dominates itself; an unreachable block dominates
+   * nothing and is dominated by nothing.
+   */
+
+  bool dominates(int a, int b) const;
+
+  /*
+   * Method: isBackEdge
+   * Usage: if (cfg.isBackEdge(from, to)) . . .
+   * ------------------------------------------
+   * Returns true if from -> to is an edge whose target dominates its
+   * source, which is what closes a natural loop.
+   */
+
+  bool isBackEdge(int from, int to) const;
+
+  /*
+   * Method: getLoops
+   * Usage: for (const Loop &loop : cfg.getLoops()) . . .
+   * ----------------------------------------------------
+   * Returns the natural loops, inner loops before the loops that
+   * contain them.
+   */
+
+  const std::vector<Loop> &getLoops() const;
+
+  /*
+   * Method: getOrder
+   * Usage: for (int block : cfg.getOrder()) . . .
+   * ---------------------------------------------
+   * Returns the reachable blocks in reverse postorder, in which every
+   * block comes before its successors except along back edges.
+   */
+
+  const std::vector<int> &getOrder() const;
+
+  /*
+   * Method: dump
+   * Usage: cfg.dump(program, std::cout);
+   * ------------------------------------
+   * Prints one line per block with its line range, successors and how
+   * often its first line has run, followed by one line per loop.  The
+   * program must be the one the CFG was built from.
+   */
+
+  void dump(Program &program, std::ostream &out) const;
+
+private:
+  std::vector<BasicBlock> blocks;
+  std::vector<int> blockOf;
+  std::vector<int> order;
+  std::vector<int> orderIndex;
+  std::vector<Loop> loops;
+
+  void findBlocks(Program &program);
+
+  void computeOrder();
+
+  void computeDominators();
+
+  void findLoops();
+};
+
+#endif
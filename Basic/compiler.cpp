@@ -0,0 +1,679 @@
+/*
+ * File: compiler.cpp
+ * ------------------
+ * This file implements the Compiler class.
+ */
+
+#include "compiler.hpp"
+#include <algorithm>
+#include <climits>
+#include "dataflow.hpp"
+#include "optimizer.hpp"
+
+
+/*
+ * Implementation notes: compile
+ * -----------------------------
+ * The program is first run through Dataflow.  Lines that no path can
+ * reach and dead stores emit no code, so a jump to one of them lands
+ * on the code of the line after it, and the other lines are compiled
+ * from their rewritten expressions.  A loop preheader is emitted in
+ * front of its header line: linePc points at the preheader, where
+ * jumps from outside the loop land, and bodyPc at the line itself,
+ * where the loop's own jumps land.  The stores a line has in after
+ * follow its own code; such a line is always a LET, which falls
+ * through into them.  An OP_GOSUB or OP_ON_GOSUB is the last
+ * instruction of its line, so the position it saves is where the code
+ * of the next line starts.
+ * When lines are compiled one at a time the return stack lives in the
+ * Program, so compileLine leaves GOSUB and RETURN to the tree walker.
+ */
+
+bool Compiler::compile(Program &program, Chunk &chunk)
+{
+  this->chunk = &chunk;
+  source = &program;
+  chunk = Chunk();
+  if (!program.hasStructuredLoops())
+    return false;
+  chunk.callDepth = program.getGosubDepth();
+  linePc.clear();
+  pending.clear();
+  depth = 0;
+  bodyPc.clear();
+  flow.analyze(program);
+  optimizing = true;
+  for (int i = 0; i < program.getLineCount(); i++)
+  {
+    int number = program.getLineNumberAt(i);
+    linePc[number] = static_cast<int>(chunk.code.size());
+    const LineFacts &facts = flow.getFacts(i);
+    for (const Hoist &hoisted : facts.preheader)
+    {
+      if (!compileExp(hoisted.exp))
+        return false;
+      emit(OP_STORE, slotFor(hoisted.slot));
+      push(-1);
+    }
+    bodyPc[number] = static_cast<int>(chunk.code.size());
+    currentLine = i;
+    if (!facts.reachable || facts.deadStore)
+      continue;
+    if (!compileStatement(program.getStatementAt(i), &facts))
+    {
+      return false;
+    }
+    for (const Hoist &hoisted : facts.after)
+    {
+      if (!compileExp(hoisted.exp))
+        return false;
+      emit(OP_STORE, slotFor(hoisted.slot));
+      push(-1);
+    }
+  }
+  emit(OP_HALT);
+
+  /*
+   * Conditional jumps to a missing line are sent to a shared stub at
+   * the end of the chunk, which raises the error only when taken.
+   */
+  int error_stub = -1;
+  for (const PendingJump &jump : pending)
+  {
+    const std::unordered_map<int, int> &pcs = jump.inLoop ? bodyPc : linePc;
+    auto it = pcs.find(jump.lineNumber);
+    if (jump.entry >= 0)
+    {
+      chunk.targets[jump.entry] = it != pcs.end() ? it->second : -1;
+    }
+    else if (it != pcs.end())
+    {
+      chunk.code[jump.pc].operand = it->second;
+    }
+    else if (chunk.code[jump.pc].op == OP_JUMP || chunk.code[jump.pc].op == OP_GOSUB)
+    {
+      chunk.code[jump.pc].op = OP_LINE_ERROR;
+    }
+    else
+    {
+      if (error_stub == -1)
+      {
+        error_stub = emit(OP_LINE_ERROR);
+      }
+      chunk.code[jump.pc].operand = error_stub;
+    }
+  }
+  return true;
+}
+
+bool Compiler::compileLine(Statement *stmt, Chunk &chunk)
+{
+  this->chunk = &chunk;
+  optimizing = false;
+  chunk = Chunk();
+  linePc.clear();
+  pending.clear();
+  depth = 0;
+  if (!compileStatement(stmt))
+  {
+    return false;
+  }
+  emit(OP_EXIT, EXIT_NEXT_LINE);
+  for (const PendingJump &jump : pending)
+  {
+    auto line = std::find(chunk.exitLines.begin(), chunk.exitLines.end(), jump.lineNumber);
+    int exit_entry = static_cast<int>(line - chunk.exitLines.begin());
+    if (line == chunk.exitLines.end())
+      chunk.exitLines.push_back(jump.lineNumber);
+    Instruction &ins = chunk.code[jump.pc];
+    if (jump.entry >= 0)
+    {
+      int stub = emit(OP_EXIT, exit_entry);
+      chunk.targets[jump.entry] = stub;
+    }
+    else if (ins.op == OP_JUMP)
+    {
+      ins = {OP_EXIT, exit_entry};
+    }
+    else
+    {
+      int stub = emit(OP_EXIT, exit_entry);
+      chunk.code[jump.pc].operand = stub;
+    }
+  }
+  return true;
+}
+
+bool Compiler::compileStatement(Statement *stmt, const LineFacts *facts)
+{
+  switch (stmt->getType())
+  {
+    case REM:
+      return true;
+    case LET:
+      {
+        auto *let = static_cast<LETStatement *>(stmt);
+        Expression *exp = facts ? facts->exp : let->getExp();
+        int step;
+        if (fusing && isStep(exp, let->getSlot(), step))
+        {
+          emitFused(OP_INC, slotFor(let->getSlot()), step, 0);
+          return true;
+        }
+        if (!compileExp(exp))
+          return false;
+        emit(OP_STORE, slotFor(let->getSlot()));
+        push(-1);
+        return true;
+      }
+    case PRINT:
+      {
+        Expression *exp = facts ? facts->exp : static_cast<PRINTStatement *>(stmt)->getExp();
+        if (fusing && exp->getType() == IDENTIFIER)
+        {
+          emit(OP_PRINT_VAR, slotFor(static_cast<IdentifierExp *>(exp)->getSlot()));
+          return true;
+        }
+        if (!compileExp(exp))
+          return false;
+        emit(OP_PRINT);
+        push(-1);
+        return true;
+      }
+    case INPUT:
+      emit(OP_INPUT, slotFor(static_cast<INPUTStatement *>(stmt)->getSlot()));
+      return true;
+    case END:
+      emit(OP_HALT);
+      return true;
+    case GOTO:
+      {
+        auto *jump = static_cast<GOTOStatement *>(stmt);
+        addJump(emit(OP_JUMP), jump->getTarget(), jump->getTargetIndex());
+        return true;
+      }
+    case IF:
+      {
+        auto *branch = static_cast<IFStatement *>(stmt);
+        if (facts && facts->branch == BRANCH_NEVER)
+          return true;
+        if (facts && facts->branch == BRANCH_ALWAYS)
+        {
+          addJump(emit(OP_JUMP), branch->getTarget(), branch->getTargetIndex());
+          return true;
+        }
+        std::vector<int> jumps;
+        if (!compileCondition(facts ? facts->cond : branch->getCondition(), true, jumps))
+          return false;
+        for (int pc : jumps)
+          addJump(pc, branch->getTarget(), branch->getTargetIndex());
+        return true;
+      }
+    case FOR:
+      {
+        auto *loop = static_cast<FORStatement *>(stmt);
+        if (facts == nullptr || !compileExp(facts->exp) || !compileExp(facts->lhs))
+          return false;
+        emit(OP_STORE, slotFor(loop->getLimitSlot()));
+        push(-1);
+        if (!compileExp(facts->rhs))
+          return false;
+        emit(OP_STORE, slotFor(loop->getStepSlot()));
+        emit(OP_STORE, slotFor(loop->getSlot()));
+        push(-2);
+        return true;
+      }
+    case NEXT:
+      return facts != nullptr && compileNext(static_cast<NEXTStatement *>(stmt), *facts);
+    case GOSUB:
+      {
+        auto *call = static_cast<GOSUBStatement *>(stmt);
+        if (facts == nullptr)
+          return false;
+        addJump(emit(OP_GOSUB), call->getTarget(), call->getTargetIndex());
+        return true;
+      }
+    case RETURN:
+      if (facts == nullptr)
+        return false;
+      emit(OP_RETURN);
+      return true;
+    case ON:
+      return compileOn(static_cast<ONStatement *>(stmt), facts);
+  }
+  return false;
+}
+
+/*
+ * Implementation notes: compileNext
+ * ---------------------------------
+ * Only whole programs are compiled with loops, since a single line
+ * cannot see the FOR it belongs to, so compileLine leaves FOR and NEXT
+ * to the tree walker.  The limit and step live in the hidden variables
+ * the FOR set.  A constant step fixes the direction of the loop, which
+ * makes the whole NEXT one OP_NEXT_UP or OP_NEXT_DOWN.  Otherwise the
+ * variable is stepped and compared with the generic instructions, and
+ * a step whose sign is only known at run time tests it first to pick
+ * the comparison.
+ */
+
+bool Compiler::compileNext(NEXTStatement *next, const LineFacts &facts)
+{
+  auto *loop = static_cast<FORStatement *>(source->getStatementAt(next->getForIndex()));
+  int slot = slotFor(loop->getSlot());
+  int body = source->getLineNumberAt(next->getTargetIndex());
+  Expression *step = facts.exp;
+  bool constant = step->getType() == CONSTANT;
+  int by = constant ? static_cast<ConstantExp *>(step)->getValue() : 0;
+  if (fusing && constant)
+  {
+    OpCode fused = by >= 0 ? OP_NEXT_UP : OP_NEXT_DOWN;
+    addJump(emitFused(fused, 0, slot, by, slotFor(loop->getLimitSlot())), body, next->getTargetIndex());
+    return true;
+  }
+  emit(OP_LOAD, slot);
+  push(1);
+  if (!compileExp(step))
+    return false;
+  emit(OP_ADD);
+  emit(OP_STORE, slot);
+  push(-2);
+  std::vector<int> exits;
+  if (constant)
+  {
+    exits.push_back(compileRepeat(slot, facts.rhs, by >= 0 ? OP_JUMP_GT : OP_JUMP_LT, body, next->getTargetIndex()));
+  }
+  else
+  {
+    if (!compileExp(step))
+      return false;
+    emit(OP_CONST, 0);
+    push(1);
+    int negative = emit(OP_JUMP_LT);
+    push(-2);
+    exits.push_back(compileRepeat(slot, facts.rhs, OP_JUMP_GT, body, next->getTargetIndex()));
+    chunk->code[negative].operand = static_cast<int>(chunk->code.size());
+    exits.push_back(compileRepeat(slot, facts.rhs, OP_JUMP_LT, body, next->getTargetIndex()));
+  }
+  for (int exit : exits)
+  {
+    if (exit < 0)
+      return false;
+    chunk->code[exit].operand = static_cast<int>(chunk->code.size());
+  }
+  return true;
+}
+
+/*
+ * Implementation notes: compileOn
+ * -------------------------------
+ * The selector is left on the stack and one OP_ON_GOTO or OP_ON_GOSUB
+ * indexes the run of chunk.targets that follows from its operand, so
+ * the cost of choosing a target does not grow with their number.  Each
+ * entry is a pending jump of its own and is patched with the others.
+ * A selector that Dataflow folded to a constant picks its target, if
+ * any, at compile time.  ON . . . GOSUB is only compiled with the
+ * whole program, like GOSUB.
+ */
+
+bool Compiler::compileOn(ONStatement *on, const LineFacts *facts)
+{
+  if (on->isGosub() && facts == nullptr)
+    return false;
+  Expression *exp = facts ? facts->exp : on->getExp();
+  int count = on->getTargetCount();
+  if (exp->getType() == CONSTANT)
+  {
+    unsigned choice = static_cast<unsigned>(static_cast<ConstantExp *>(exp)->getValue()) - 1u;
+    if (choice < static_cast<unsigned>(count))
+    {
+      int pc = emit(on->isGosub() ? OP_GOSUB : OP_JUMP);
+      addJump(pc, on->getTarget(static_cast<int>(choice)), on->getTargetIndex(static_cast<int>(choice)));
+    }
+    return true;
+  }
+  if (!compileExp(exp))
+    return false;
+  int first = static_cast<int>(chunk->targets.size());
+  int pc = emitFused(on->isGosub() ? OP_ON_GOSUB : OP_ON_GOTO, first, count, 0);
+  push(-1);
+  for (int choice = 0; choice < count; choice++)
+  {
+    chunk->targets.push_back(-1);
+    addJump(pc, on->getTarget(choice), on->getTargetIndex(choice), first + choice);
+  }
+  return true;
+}
+
+/*
+ * Emits the test at the end of a NEXT: jump back to the body unless
+ * variable slot has passed limit, as detected by the comparison passed.
+ * Returns the position of that comparison, whose target the caller
+ * sets to the code after the NEXT, or -1 if limit cannot be compiled.
+ */
+
+int Compiler::compileRepeat(int slot, Expression *limit, OpCode passed, int lineNumber, int lineIndex)
+{
+  emit(OP_LOAD, slot);
+  push(1);
+  if (!compileExp(limit))
+    return -1;
+  int exit = emit(passed);
+  push(-2);
+  addJump(emit(OP_JUMP), lineNumber, lineIndex);
+  return exit;
+}
+
+/*
+ * Implementation notes: compileCondition
+ * --------------------------------------
+ * A condition becomes a chain of conditional jumps that evaluates it
+ * in the order Condition::test does: the code jumps when cond is equal
+ * to when, with every such jump added to jumps for the caller to
+ * patch, and falls through otherwise.  An AND that should jump when
+ * true and an OR that should jump when false leave through their
+ * second half, once the first half has not skipped over it; in the
+ * other two cases either half may jump.  A simple IF is therefore a
+ * single compare-and-jump, and no condition ever builds a truth value.
+ */
+
+static const OpCode RELATION_JUMPS[] = {OP_JUMP_EQ, OP_JUMP_NE, OP_JUMP_LT, OP_JUMP_LE, OP_JUMP_GT, OP_JUMP_GE};
+
+bool Compiler::compileCondition(Condition *cond, bool when, std::vector<int> &jumps)
+{
+  if (cond->getType() == RELATION)
+    return compileRelation(cond, when, jumps);
+  if ((cond->getType() == CONJUNCTION) != when)
+    return compileCondition(cond->getFirst(), when, jumps) && compileCondition(cond->getSecond(), when, jumps);
+  std::vector<int> skips;
+  if (!compileCondition(cond->getFirst(), !when, skips) || !compileCondition(cond->getSecond(), when, jumps))
+    return false;
+  for (int pc : skips)
+    chunk->code[pc].operand = static_cast<int>(chunk->code.size());
+  return true;
+}
+
+/*
+ * A relation between two constants, which Dataflow leaves behind when
+ * it cannot settle the whole condition, is decided here and becomes an
+ * OP_JUMP or no code at all.
+ */
+
+bool Compiler::compileRelation(Condition *cond, bool when, std::vector<int> &jumps)
+{
+  Relation relation = when ? cond->getRelation() : negateRelation(cond->getRelation());
+  Expression *lhs = cond->getLHS();
+  Expression *rhs = cond->getRHS();
+  if (lhs->getType() == CONSTANT && rhs->getType() == CONSTANT)
+  {
+    if (compare(relation, static_cast<ConstantExp *>(lhs)->getValue(), static_cast<ConstantExp *>(rhs)->getValue()))
+      jumps.push_back(emit(OP_JUMP));
+    return true;
+  }
+  if (fusing && compileFusedRelation(relation, lhs, rhs, jumps))
+    return true;
+  if (!compileExp(lhs) || !compileExp(rhs))
+    return false;
+  jumps.push_back(emit(RELATION_JUMPS[relation]));
+  push(-2);
+  return true;
+}
+
+/*
+ * Implementation notes: compileFusedRelation
+ * ------------------------------------------
+ * A relation between a variable and a constant or another variable
+ * becomes a single superinstruction.  A constant on the left is moved
+ * to the right by mirroring the relation; both operands are plain
+ * loads that can only fail with the same error, so the order in which
+ * they are checked does not matter.  V <= c and V >= c are V < c + 1
+ * and V > c - 1 unless the constant is at the end of the range, and
+ * the other relations go through the generic instructions.
+ */
+
+bool Compiler::compileFusedRelation(Relation relation, Expression *lhs, Expression *rhs, std::vector<int> &jumps)
+{
+  if (lhs->getType() == CONSTANT && rhs->getType() == IDENTIFIER)
+  {
+    std::swap(lhs, rhs);
+    relation = mirrorRelation(relation);
+  }
+  if (lhs->getType() != IDENTIFIER)
+    return false;
+  bool constant = rhs->getType() == CONSTANT;
+  if (!constant && rhs->getType() != IDENTIFIER)
+    return false;
+  int value = constant ? static_cast<ConstantExp *>(rhs)->getValue() : 0;
+  if (constant && relation == REL_LE && value != INT_MAX)
+  {
+    relation = REL_LT;
+    value++;
+  }
+  else if (constant && relation == REL_GE && value != INT_MIN)
+  {
+    relation = REL_GT;
+    value--;
+  }
+  OpCode fused;
+  if (relation == REL_EQ)
+    fused = constant ? OP_JUMP_EQ_CONST : OP_JUMP_EQ_VARS;
+  else if (relation == REL_LT)
+    fused = constant ? OP_JUMP_LT_CONST : OP_JUMP_LT_VARS;
+  else if (relation == REL_GT)
+    fused = constant ? OP_JUMP_GT_CONST : OP_JUMP_GT_VARS;
+  else
+    return false;
+  int slot = slotFor(static_cast<IdentifierExp *>(lhs)->getSlot());
+  if (!constant)
+    value = slotFor(static_cast<IdentifierExp *>(rhs)->getSlot());
+  jumps.push_back(emitFused(fused, 0, slot, value));
+  return true;
+}
+
+/*
+ * Implementation notes: compileExp
+ * --------------------------------
+ * Expressions are emitted in postfix order, which evaluates the
+ * operands in the same order as CompoundExp::eval.  A negation is
+ * emitted as 0 - operand.  Assignments whose
+ * left side is not a plain variable raise errors only when evaluated,
+ * so they are left to the tree walker.  An operator with a constant
+ * operand goes through compileConstantOperand first; a constant has no
+ * effects, so evaluating the other operand alone keeps the order of
+ * everything that does.
+ */
+
+bool Compiler::compileExp(Expression *exp)
+{
+  switch (exp->getType())
+  {
+    case CONSTANT:
+      emit(OP_CONST, static_cast<ConstantExp *>(exp)->getValue());
+      push(1);
+      return true;
+    case IDENTIFIER:
+      emit(OP_LOAD, slotFor(static_cast<IdentifierExp *>(exp)->getSlot()));
+      push(1);
+      return true;
+    case NEGATE:
+      emit(OP_CONST, 0);
+      push(1);
+      if (!compileExp(static_cast<NegateExp *>(exp)->getOperand()))
+        return false;
+      emit(OP_SUB);
+      push(-1);
+      return true;
+    case FLAT:
+      return false;
+    case COMPOUND:
+      break;
+  }
+  auto *compound = static_cast<CompoundExp *>(exp);
+  std::string op = compound->getOp();
+  if (op == "=")
+  {
+    Expression *lhs = compound->getLHS();
+    if (lhs->getType() != IDENTIFIER || lhs->toString() == "LET")
+      return false;
+    if (!compileExp(compound->getRHS()))
+      return false;
+    emit(OP_ASSIGN, slotFor(static_cast<IdentifierExp *>(lhs)->getSlot()));
+    return true;
+  }
+  Expression *lhs = compound->getLHS();
+  Expression *rhs = compound->getRHS();
+  if (reducing && rhs->getType() == CONSTANT && compileConstantOperand(op, lhs, static_cast<ConstantExp *>(rhs)->getValue()))
+    return true;
+  if (reducing && lhs->getType() == CONSTANT && (op == "+" || op == "*") &&
+      compileConstantOperand(op, rhs, static_cast<ConstantExp *>(lhs)->getValue()))
+  {
+    return true;
+  }
+  if (!compileExp(lhs) || !compileExp(rhs))
+    return false;
+  if (op == "+")
+    emit(OP_ADD);
+  else if (op == "-")
+    emit(OP_SUB);
+  else if (op == "*")
+    emit(OP_MUL);
+  else if (op == "/")
+    emit(OP_DIV);
+  else
+    return false;
+  push(-1);
+  return true;
+}
+
+/*
+ * Implementation notes: compileConstantOperand
+ * --------------------------------------------
+ * Adding, subtracting or multiplying by a constant folds the constant
+ * into the instruction, which saves the push and one dispatch.  X - c
+ * becomes X + (-c), which wraps the same way.  Division by a constant
+ * other than 0, 1 and -1 can neither fault nor overflow, so it becomes
+ * OP_DIV_CONST with the magic numbers computed here; equal divisors
+ * share one table entry.  Anything else returns false without emitting
+ * code and is compiled the generic way.
+ */
+
+bool Compiler::compileConstantOperand(const std::string &op, Expression *operand, int value)
+{
+  OpCode reduced;
+  if (op == "+")
+    reduced = OP_ADD_CONST;
+  else if (op == "-")
+  {
+    reduced = OP_ADD_CONST;
+    value = static_cast<int>(0u - static_cast<unsigned>(value));
+  }
+  else if (op == "*")
+    reduced = OP_MUL_CONST;
+  else if (op == "/" && value != 0 && value != 1 && value != -1)
+    reduced = OP_DIV_CONST;
+  else
+    return false;
+  if (!compileExp(operand))
+    return false;
+  if (reduced == OP_DIV_CONST)
+  {
+    int index = 0;
+    while (index < static_cast<int>(chunk->divisors.size()) && chunk->divisors[index].divisor != value)
+      index++;
+    if (index == static_cast<int>(chunk->divisors.size()))
+      chunk->divisors.push_back(makeDivMagic(value));
+    value = index;
+  }
+  emit(reduced, value);
+  return true;
+}
+
+void Compiler::setStrengthReduction(bool enabled) { reducing = enabled; }
+
+void Compiler::setSuperinstructions(bool enabled) { fusing = enabled; }
+
+void Compiler::addJump(int pc, int lineNumber, int lineIndex, int entry)
+{
+  pending.push_back({pc, lineNumber, optimizing && flow.skipsPreheader(currentLine, lineIndex), entry});
+}
+
+int Compiler::slotFor(int slot)
+{
+  if (slot >= chunk->numSlots)
+    chunk->numSlots = slot + 1;
+  return slot;
+}
+
+int Compiler::emit(OpCode op, int operand)
+{
+  chunk->code.push_back({op, operand});
+  return static_cast<int>(chunk->code.size()) - 1;
+}
+
+int Compiler::emitFused(OpCode op, int operand, int a, int b, int c)
+{
+  chunk->code.push_back({op, operand, a, b, c});
+  return static_cast<int>(chunk->code.size()) - 1;
+}
+
+void Compiler::push(int count)
+{
+  depth += count;
+  if (depth > chunk->maxStack)
+    chunk->maxStack = depth;
+}
+
+/*
+ * Implementation notes: makeDivMagic
+ * ----------------------------------
+ * This is the algorithm of Hacker's Delight, section 10-4.  It looks
+ * for the smallest shift p >= 32 for which 2^p / |d|, rounded up, is a
+ * multiplier exact for every 32-bit dividend, stepping the quotients
+ * and remainders of 2^p by the divisor and by the largest multiple-less-
+ * one of it (anc) in unsigned arithmetic.  A multiplier above INT_MAX
+ * wraps negative, which the adjustment by the dividend compensates.
+ */
+
+DivMagic makeDivMagic(int divisor)
+{
+  const unsigned two31 = 0x80000000u;
+  unsigned ad = divisor < 0 ? 0u - static_cast<unsigned>(divisor) : static_cast<unsigned>(divisor);
+  unsigned t = two31 + (static_cast<unsigned>(divisor) >> 31);
+  unsigned anc = t - 1 - t % ad;
+  int p = 31;
+  unsigned q1 = two31 / anc;
+  unsigned r1 = two31 - q1 * anc;
+  unsigned q2 = two31 / ad;
+  unsigned r2 = two31 - q2 * ad;
+  unsigned delta;
+  do
+  {
+    p++;
+    q1 *= 2;
+    r1 *= 2;
+    if (r1 >= anc)
+    {
+      q1++;
+      r1 -= anc;
+    }
+    q2 *= 2;
+    r2 *= 2;
+    if (r2 >= ad)
+    {
+      q2++;
+      r2 -= ad;
+    }
+    delta = ad - r2;
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+
+  DivMagic magic;
+  magic.divisor = divisor;
+  magic.multiplier = static_cast<int>(divisor < 0 ? 0u - (q2 + 1) : q2 + 1);
+  magic.adjust = 0;
+  if (divisor > 0 && magic.multiplier < 0)
+    magic.adjust = 1;
+  else if (divisor < 0 && magic.multiplier > 0)
+    magic.adjust = -1;
+  magic.shift = p - 32;
+  return magic;
+}
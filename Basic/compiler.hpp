@@ -0,0 +1,138 @@
+/*
+ * File: compiler.h
+ * ----------------
+ * This interface exports the Compiler class, which lowers the parsed
+ * statements of a Program into the bytecode defined in bytecode.h.
+ */
+
+#ifndef _compiler_h
+#define _compiler_h
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "bytecode.hpp"
+#include "dataflow.hpp"
+#include "exp.hpp"
+#include "program.hpp"
+#include "statement.hpp"
+
+/*
+ * Class: Compiler
+ * ---------------
+ * Translates a whole program in one pass, using the facts found by
+ * Dataflow to leave out lines that cannot run.  Every jump target is
+ * resolved to an instruction index at compile time; a jump to a line
+ * that does not exist becomes OP_LINE_ERROR, so the error is still
+ * reported at the point where the jump is taken.
+ */
+
+class Compiler
+{
+public:
+  /*
+   * Method: compile
+   * Usage: if (compiler.compile(program, chunk)) . . .
+   * --------------------------------------------------
+   * Fills chunk with the bytecode for program.  Returns false if the
+   * program uses a construct the bytecode cannot express, which
+   * includes FOR loops that Program::hasStructuredLoops rejects, in
+   * which case the caller should fall back to the tree walker.
+   */
+
+  bool compile(Program &program, Chunk &chunk);
+
+  /*
+   * Method: compileLine
+   * Usage: if (compiler.compileLine(stmt, chunk)) . . .
+   * ---------------------------------------------------
+   * Compiles a single statement into a chunk of its own.  Control that
+   * leaves the statement ends in OP_EXIT, naming the target line
+   * through the exitLines of the chunk, or EXIT_NEXT_LINE, so the chunk
+   * stays valid however the lines around it are edited.
+   */
+
+  bool compileLine(Statement *stmt, Chunk &chunk);
+
+  /*
+   * Method: setStrengthReduction
+   * Usage: compiler.setStrengthReduction(false);
+   * --------------------------------------------
+   * Turns the constant-operand instructions on or off.  They are on by
+   * default; turning them off makes every operator use the generic
+   * two-operand instruction, which the benchmarks compare against.
+   */
+
+  void setStrengthReduction(bool enabled);
+
+  /*
+   * Method: setSuperinstructions
+   * Usage: compiler.setSuperinstructions(false);
+   * --------------------------------------------
+   * Turns the fused instructions for common statement shapes on or
+   * off.  They are on by default; the profiler turns them off to see
+   * the sequences they replace.
+   */
+
+  void setSuperinstructions(bool enabled);
+
+private:
+  struct PendingJump
+  {
+    int pc;
+    int lineNumber;
+    bool inLoop;
+    int entry;
+  };
+
+  Chunk *chunk = nullptr;
+  Program *source = nullptr;
+  Dataflow flow;
+  bool optimizing = false;
+  bool reducing = true;
+  bool fusing = true;
+  std::unordered_map<int, int> linePc;
+  std::unordered_map<int, int> bodyPc;
+  std::vector<PendingJump> pending;
+  int currentLine = 0;
+  int depth = 0;
+
+  bool compileStatement(Statement *stmt, const LineFacts *facts = nullptr);
+
+  bool compileCondition(Condition *cond, bool when, std::vector<int> &jumps);
+
+  bool compileRelation(Condition *cond, bool when, std::vector<int> &jumps);
+
+  bool compileFusedRelation(Relation relation, Expression *lhs, Expression *rhs, std::vector<int> &jumps);
+
+  bool compileNext(NEXTStatement *next, const LineFacts &facts);
+
+  bool compileOn(ONStatement *on, const LineFacts *facts);
+
+  int compileRepeat(int slot, Expression *limit, OpCode passed, int lineNumber, int lineIndex);
+
+  bool compileExp(Expression *exp);
+
+  bool compileConstantOperand(const std::string &op, Expression *operand, int value);
+
+  void addJump(int pc, int lineNumber, int lineIndex, int entry = -1);
+
+  int slotFor(int slot);
+
+  int emit(OpCode op, int operand = 0);
+
+  int emitFused(OpCode op, int operand, int a, int b, int c = 0);
+
+  void push(int count);
+};
+
+/*
+ * Function: makeDivMagic
+ * Usage: DivMagic magic = makeDivMagic(divisor);
+ * ----------------------------------------------
+ * Computes the magic numbers for divisor, which must not be -1, 0 or 1.
+ */
+
+DivMagic makeDivMagic(int divisor);
+
+#endif
@@ -0,0 +1,1016 @@
+/*
+ * File: dataflow.cpp
+ * ------------------
+ * This file implements the Dataflow class.
+ */
+
+#include "dataflow.hpp"
+#include <algorithm>
+#include <climits>
+#include <map>
+#include <unordered_map>
+#include "optimizer.hpp"
+#include "statement.hpp"
+
+
+Dataflow::Dataflow() = default;
+
+void Dataflow::analyze(Program &program)
+{
+  cfg.build(program);
+  arena.reset();
+  numSlots = getSymbolCount();
+  int count = program.getLineCount();
+  facts.assign(count, LineFacts());
+  observed.assign(count, false);
+  executable.assign(cfg.getBlockCount(), false);
+  taken.assign(cfg.getBlockCount(), std::vector<int>());
+  outs.assign(cfg.getBlockCount(), Env());
+  headerLoop.assign(cfg.getBlockCount(), -1);
+  if (count == 0)
+    return;
+  propagate(program);
+  eliminateStores(program);
+  hoistInvariants(program);
+}
+
+const LineFacts &Dataflow::getFacts(int lineIndex) const { return facts[lineIndex]; }
+
+const CFG &Dataflow::getCFG() const { return cfg; }
+
+bool Dataflow::skipsPreheader(int fromLine, int toLine) const
+{
+  if (toLine < 0 || facts[toLine].preheader.empty())
+    return false;
+  const std::vector<int> &body = cfg.getLoops()[headerLoop[cfg.getBlockOf(toLine)]].blocks;
+  return std::binary_search(body.begin(), body.end(), cfg.getBlockOf(fromLine));
+}
+
+/*
+ * Implementation notes: meet
+ * --------------------------
+ * Combines the values flowing into a block along another edge.  Two
+ * different constants only agree that the variable is defined, and a
+ * variable undefined on either side may be undefined.
+ */
+
+bool Dataflow::meet(Env &into, const Env &from)
+{
+  bool changed = false;
+  for (std::size_t slot = 0; slot < into.size(); slot++)
+  {
+    Value &a = into[slot];
+    const Value &b = from[slot];
+    Value result = a;
+    if (a.kind == VALUE_NONE || b.kind == VALUE_UNKNOWN)
+      result = b;
+    else if (b.kind == VALUE_NONE || a.kind == VALUE_UNKNOWN)
+      result = a;
+    else if (a.kind == VALUE_DEFINED || b.kind == VALUE_DEFINED || a.value != b.value)
+      result = {VALUE_DEFINED, 0};
+    if (result.kind != a.kind || result.value != a.value)
+    {
+      a = result;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+/*
+ * Implementation notes: evaluate
+ * ------------------------------
+ * Evaluates exp over the abstract values in env, in the order that
+ * CompoundExp::eval visits the nodes, applying any assignments to env
+ * as it goes.  Reading a variable that may be undefined sets faults;
+ * once the read has succeeded the variable is known to be defined.
+ * A division sets faults unless its divisor is a constant that cannot
+ * fail.  When out is not null, it receives a copy of exp in which
+ * every read of a constant variable has been replaced by the constant.
+ */
+
+Dataflow::Value Dataflow::evaluate(Expression *exp, Env &env, Expression **out, bool &faults)
+{
+  const Value defined = {VALUE_DEFINED, 0};
+  switch (exp->getType())
+  {
+    case CONSTANT:
+      if (out)
+        *out = exp;
+      return {VALUE_CONST, static_cast<ConstantExp *>(exp)->getValue()};
+    case IDENTIFIER:
+      {
+        Value &value = env[static_cast<IdentifierExp *>(exp)->getSlot()];
+        if (value.kind != VALUE_CONST && value.kind != VALUE_DEFINED)
+        {
+          faults = true;
+          value = defined;
+        }
+        if (out)
+          *out = value.kind == VALUE_CONST ? new (arena) ConstantExp(value.value) : exp;
+        return value;
+      }
+    case NEGATE:
+      {
+        Value value = evaluate(static_cast<NegateExp *>(exp)->getOperand(), env, out, faults);
+        if (out)
+          *out = new (arena) NegateExp(*out);
+        if (value.kind == VALUE_CONST)
+          foldOperator("-", 0, value.value, value.value);
+        return value;
+      }
+    case COMPOUND:
+      break;
+    default:
+      faults = true;
+      if (out)
+        *out = exp;
+      return defined;
+  }
+
+  auto *compound = static_cast<CompoundExp *>(exp);
+  std::string op = compound->getOp();
+  Expression *lhs = compound->getLHS();
+  if (op == "=")
+  {
+    if (lhs->getType() != IDENTIFIER || lhs->toString() == "LET")
+    {
+      faults = true;
+      if (out)
+        *out = exp;
+      return defined;
+    }
+    Value value = evaluate(compound->getRHS(), env, out, faults);
+    env[static_cast<IdentifierExp *>(lhs)->getSlot()] = value;
+    if (out)
+      *out = new (arena) CompoundExp(op, lhs, *out);
+    return value;
+  }
+
+  Expression *left = nullptr;
+  Value a = evaluate(lhs, env, out ? &left : nullptr, faults);
+  Value b = evaluate(compound->getRHS(), env, out, faults);
+  if (out)
+    *out = new (arena) CompoundExp(op, left, *out);
+  if (op == "/" && (b.kind != VALUE_CONST || b.value == 0 || (b.value == -1 && (a.kind != VALUE_CONST || a.value == INT_MIN))))
+    faults = true;
+  Value result = defined;
+  if (a.kind == VALUE_CONST && b.kind == VALUE_CONST && foldOperator(op, a.value, b.value, result.value))
+    result.kind = VALUE_CONST;
+  return result;
+}
+
+/*
+ * Implementation notes: test
+ * --------------------------
+ * Evaluates cond over the abstract values in env the way evaluate does
+ * an expression, returning the constant 1 or 0 when the outcome is
+ * known.  The second half of an AND or OR only runs when the first
+ * does not decide the outcome, so unless the first is known, env ends
+ * up as the meet of the states with and without the second half, and
+ * that half may fault.  When out is not null, it receives a copy of
+ * cond whose operands have been rewritten and simplified.
+ */
+
+Dataflow::Value Dataflow::test(Condition *cond, Env &env, Condition **out, bool &faults)
+{
+  const Value defined = {VALUE_DEFINED, 0};
+  if (cond->getType() == RELATION)
+  {
+    Expression *lhs = nullptr;
+    Expression *rhs = nullptr;
+    Value a = evaluate(cond->getLHS(), env, out ? &lhs : nullptr, faults);
+    Value b = evaluate(cond->getRHS(), env, out ? &rhs : nullptr, faults);
+    if (out)
+      *out = new (arena) Condition(cond->getRelation(), simplifyExp(lhs, arena), simplifyExp(rhs, arena));
+    if (a.kind != VALUE_CONST || b.kind != VALUE_CONST)
+      return defined;
+    return {VALUE_CONST, compare(cond->getRelation(), a.value, b.value) ? 1 : 0};
+  }
+
+  int decisive = cond->getType() == DISJUNCTION ? 1 : 0;
+  Condition *first = nullptr;
+  Condition *second = nullptr;
+  Value a = test(cond->getFirst(), env, out ? &first : nullptr, faults);
+  Env skipped = env;
+  bool secondFaults = false;
+  Value b = test(cond->getSecond(), env, out ? &second : nullptr, secondFaults);
+  if (out)
+    *out = new (arena) Condition(cond->getType(), first, second);
+  if (a.kind == VALUE_CONST && a.value == decisive)
+  {
+    env = std::move(skipped);
+    return a;
+  }
+  faults = faults || secondFaults;
+  if (a.kind == VALUE_CONST)
+    return b;
+  meet(env, skipped);
+  return b.kind == VALUE_CONST && b.value == decisive ? b : defined;
+}
+
+/*
+ * Implementation notes: runLine
+ * -----------------------------
+ * Applies one statement to env and returns what is known about its
+ * branch.  When out is not null, the rewritten and simplified
+ * expressions are stored there.  A settled IF emits no code for its
+ * condition, so its fate is only reported when testing the condition
+ * can neither fail nor assign a variable.
+ *
+ * A FOR stores its start, limit and step in exp, lhs and rhs and sets
+ * the loop variable and the two hidden variables of the loop.  A NEXT
+ * stores the step in exp and the limit in rhs, each as the constant
+ * the hidden variable is known to hold or as a read of it.  Whether a
+ * NEXT repeats the loop is never settled, and neither is which target
+ * an ON takes.  The return stack is not modelled, so a GOSUB or
+ * ON . . . GOSUB may overflow it and a RETURN find it empty.
+ */
+
+static bool assigns(Expression *exp)
+{
+  if (exp->getType() == NEGATE)
+    return assigns(static_cast<NegateExp *>(exp)->getOperand());
+  if (exp->getType() != COMPOUND)
+    return false;
+  auto *compound = static_cast<CompoundExp *>(exp);
+  return compound->getOp() == "=" || assigns(compound->getLHS()) || assigns(compound->getRHS());
+}
+
+static bool assigns(Condition *cond)
+{
+  if (cond->getType() == RELATION)
+    return assigns(cond->getLHS()) || assigns(cond->getRHS());
+  return assigns(cond->getFirst()) || assigns(cond->getSecond());
+}
+
+BranchFate Dataflow::runLine(Program &program, Statement *stmt, Env &env, LineFacts *out, bool &faults)
+{
+  Expression *rewritten = nullptr;
+  Expression **target = out ? &rewritten : nullptr;
+  switch (stmt->getType())
+  {
+    case LET:
+      {
+        auto *let = static_cast<LETStatement *>(stmt);
+        env[let->getSlot()] = evaluate(let->getExp(), env, target, faults);
+        if (out)
+          out->exp = simplifyExp(rewritten, arena);
+        return BRANCH_UNKNOWN;
+      }
+    case PRINT:
+      evaluate(static_cast<PRINTStatement *>(stmt)->getExp(), env, target, faults);
+      if (out)
+        out->exp = simplifyExp(rewritten, arena);
+      return BRANCH_UNKNOWN;
+    case INPUT:
+      env[static_cast<INPUTStatement *>(stmt)->getSlot()] = {VALUE_DEFINED, 0};
+      faults = true;
+      return BRANCH_UNKNOWN;
+    case IF:
+      {
+        Condition *cond = static_cast<IFStatement *>(stmt)->getCondition();
+        Value holds = test(cond, env, out ? &out->cond : nullptr, faults);
+        if (holds.kind != VALUE_CONST || faults || assigns(cond))
+          return BRANCH_UNKNOWN;
+        return holds.value ? BRANCH_ALWAYS : BRANCH_NEVER;
+      }
+    case FOR:
+      {
+        auto *loop = static_cast<FORStatement *>(stmt);
+        Value first = evaluate(loop->getStart(), env, target, faults);
+        if (out)
+          out->exp = simplifyExp(rewritten, arena);
+        Value last = evaluate(loop->getLimit(), env, target, faults);
+        if (out)
+          out->lhs = simplifyExp(rewritten, arena);
+        Value by = evaluate(loop->getStep(), env, target, faults);
+        if (out)
+          out->rhs = simplifyExp(rewritten, arena);
+        env[loop->getLimitSlot()] = last;
+        env[loop->getStepSlot()] = by;
+        env[loop->getSlot()] = first;
+        return BRANCH_UNKNOWN;
+      }
+    case NEXT:
+      {
+        int index = static_cast<NEXTStatement *>(stmt)->getForIndex();
+        if (index < 0)
+        {
+          faults = true;
+          return BRANCH_UNKNOWN;
+        }
+        auto *loop = static_cast<FORStatement *>(program.getStatementAt(index));
+        Value &value = env[loop->getSlot()];
+        Value by = env[loop->getStepSlot()];
+        Value last = env[loop->getLimitSlot()];
+        for (const Value &read : {value, by, last})
+        {
+          if (read.kind != VALUE_CONST && read.kind != VALUE_DEFINED)
+            faults = true;
+        }
+        if (out)
+        {
+          out->exp = new (arena) IdentifierExp(getSymbolName(loop->getStepSlot()));
+          out->rhs = new (arena) IdentifierExp(getSymbolName(loop->getLimitSlot()));
+          if (by.kind == VALUE_CONST)
+            out->exp = new (arena) ConstantExp(by.value);
+          if (last.kind == VALUE_CONST)
+            out->rhs = new (arena) ConstantExp(last.value);
+        }
+        Value result = {VALUE_DEFINED, 0};
+        if (value.kind == VALUE_CONST && by.kind == VALUE_CONST)
+        {
+          result.kind = VALUE_CONST;
+          foldOperator("+", value.value, by.value, result.value);
+        }
+        value = result;
+        return BRANCH_UNKNOWN;
+      }
+    case GOSUB:
+    case RETURN:
+      faults = true;
+      return BRANCH_UNKNOWN;
+    case ON:
+      {
+        auto *on = static_cast<ONStatement *>(stmt);
+        evaluate(on->getExp(), env, target, faults);
+        if (out)
+          out->exp = simplifyExp(rewritten, arena);
+        if (on->isGosub())
+          faults = true;
+        return BRANCH_UNKNOWN;
+      }
+    default:
+      return BRANCH_UNKNOWN;
+  }
+}
+
+/*
+ * Implementation notes: successors
+ * --------------------------------
+ * An IF whose condition is settled only continues along one of its
+ * edges; every other block continues along all of them.
+ */
+
+void Dataflow::successors(Program &program, int block, BranchFate fate, std::vector<int> &out) const
+{
+  const BasicBlock &info = cfg.getBlock(block);
+  out.clear();
+  if (fate == BRANCH_UNKNOWN)
+  {
+    out = info.succs;
+    return;
+  }
+  int next = info.last + 1 < program.getLineCount() ? cfg.getBlockOf(info.last + 1) : -1;
+  int target = static_cast<IFStatement *>(program.getStatementAt(info.last))->getTargetIndex();
+  int chosen = fate == BRANCH_NEVER ? next : target < 0 ? -1 : cfg.getBlockOf(target);
+  if (chosen >= 0)
+    out.push_back(chosen);
+}
+
+/*
+ * Implementation notes: propagate
+ * -------------------------------
+ * Blocks are only marked executable when an edge that can be taken
+ * leads to them, which is what lets a settled IF cut off the lines
+ * behind its dead edge.  Nothing is known about the variables when
+ * the program starts, since RUN keeps the values set before it.  The
+ * passes repeat in reverse postorder until no entry state changes,
+ * and a last pass records the rewritten expressions.
+ */
+
+void Dataflow::propagate(Program &program)
+{
+  int blockCount = cfg.getBlockCount();
+  std::vector<Env> in(blockCount, Env(numSlots, {VALUE_NONE, 0}));
+  in[0].assign(numSlots, {VALUE_UNKNOWN, 0});
+  executable[0] = true;
+  std::vector<int> succs;
+  bool changed = true;
+  while (changed)
+  {
+    changed = false;
+    for (int b : cfg.getOrder())
+    {
+      if (!executable[b])
+        continue;
+      const BasicBlock &block = cfg.getBlock(b);
+      Env env = in[b];
+      BranchFate fate = BRANCH_UNKNOWN;
+      for (int i = block.first; i <= block.last; i++)
+      {
+        bool faults = false;
+        fate = runLine(program, program.getStatementAt(i), env, nullptr, faults);
+      }
+      successors(program, b, fate, succs);
+      for (int succ : succs)
+      {
+        if (!executable[succ])
+        {
+          executable[succ] = true;
+          changed = true;
+        }
+        if (meet(in[succ], env))
+          changed = true;
+      }
+    }
+  }
+
+  for (int b : cfg.getOrder())
+  {
+    if (!executable[b])
+      continue;
+    const BasicBlock &block = cfg.getBlock(b);
+    Env env = in[b];
+    BranchFate fate = BRANCH_UNKNOWN;
+    for (int i = block.first; i <= block.last; i++)
+    {
+      bool faults = false;
+      LineFacts &line = facts[i];
+      line.reachable = true;
+      fate = runLine(program, program.getStatementAt(i), env, &line, faults);
+      line.branch = fate;
+      observed[i] = faults;
+    }
+    successors(program, b, fate, taken[b]);
+    outs[b] = std::move(env);
+  }
+}
+
+/*
+ * Implementation notes: eliminateStores
+ * -------------------------------------
+ * This is a backward liveness analysis.  Every variable counts as read
+ * wherever the program can stop, since its value stays visible after
+ * the run: at END, at the last line, and at any line that may raise an
+ * error or waits for INPUT.  A LET whose variable is not live after it
+ * is a dead store if its rewritten expression is pure, which also
+ * means it reads no variables, so skipping the line changes nothing
+ * that comes before it.
+ */
+
+/*
+ * Calls visit on each operand of the relations in cond.
+ */
+
+template <typename Visit> static void visitOperands(Condition *cond, Visit visit)
+{
+  if (cond->getType() == RELATION)
+  {
+    visit(cond->getLHS());
+    visit(cond->getRHS());
+    return;
+  }
+  visitOperands(cond->getFirst(), visit);
+  visitOperands(cond->getSecond(), visit);
+}
+
+/*
+ * Calls visit on every rewritten expression of a line, including the
+ * operands of its condition.
+ */
+
+template <typename Visit> static void visitExpressions(const LineFacts &line, Visit visit)
+{
+  for (Expression *exp : {line.exp, line.lhs, line.rhs})
+  {
+    if (exp)
+      visit(exp);
+  }
+  if (line.cond)
+    visitOperands(line.cond, visit);
+}
+
+/*
+ * Returns cond with each operand replaced by rewrite(operand), sharing
+ * the nodes whose operands are unchanged.
+ */
+
+template <typename Rewrite> static Condition *rewriteOperands(Condition *cond, Rewrite rewrite, Arena &arena)
+{
+  if (cond->getType() == RELATION)
+  {
+    Expression *lhs = rewrite(cond->getLHS());
+    Expression *rhs = rewrite(cond->getRHS());
+    if (lhs == cond->getLHS() && rhs == cond->getRHS())
+      return cond;
+    return new (arena) Condition(cond->getRelation(), lhs, rhs);
+  }
+  Condition *first = rewriteOperands(cond->getFirst(), rewrite, arena);
+  Condition *second = rewriteOperands(cond->getSecond(), rewrite, arena);
+  if (first == cond->getFirst() && second == cond->getSecond())
+    return cond;
+  return new (arena) Condition(cond->getType(), first, second);
+}
+
+/*
+ * Replaces every rewritten expression of a line, including the
+ * operands of its condition, by rewrite(exp).
+ */
+
+template <typename Rewrite> static void rewriteExpressions(LineFacts &line, Rewrite rewrite, Arena &arena)
+{
+  for (Expression **exp : {&line.exp, &line.lhs, &line.rhs})
+  {
+    if (*exp)
+      *exp = rewrite(*exp);
+  }
+  if (line.cond)
+    line.cond = rewriteOperands(line.cond, rewrite, arena);
+}
+
+static void addReads(Expression *exp, std::vector<bool> &live)
+{
+  switch (exp->getType())
+  {
+    case IDENTIFIER:
+      live[static_cast<IdentifierExp *>(exp)->getSlot()] = true;
+      return;
+    case NEGATE:
+      addReads(static_cast<NegateExp *>(exp)->getOperand(), live);
+      return;
+    case COMPOUND:
+      {
+        auto *compound = static_cast<CompoundExp *>(exp);
+        if (compound->getOp() != "=")
+          addReads(compound->getLHS(), live);
+        addReads(compound->getRHS(), live);
+        return;
+      }
+    default:
+      return;
+  }
+}
+
+void Dataflow::eliminateStores(Program &program)
+{
+  std::vector<std::vector<bool>> liveIn(cfg.getBlockCount(), std::vector<bool>(numSlots, false));
+  bool changed = true;
+  while (changed)
+  {
+    changed = false;
+    for (auto it = cfg.getOrder().rbegin(); it != cfg.getOrder().rend(); ++it)
+      runLiveness(program, *it, liveIn, false, changed);
+  }
+  for (int b : cfg.getOrder())
+    runLiveness(program, b, liveIn, true, changed);
+}
+
+void Dataflow::runLiveness(Program &program, int block, std::vector<std::vector<bool>> &liveIn, bool mark,
+                           bool &changed)
+{
+  if (!executable[block])
+    return;
+  const BasicBlock &info = cfg.getBlock(block);
+  std::vector<bool> live(numSlots, info.exits);
+  for (int succ : taken[block])
+  {
+    for (int slot = 0; slot < numSlots; slot++)
+    {
+      if (liveIn[succ][slot])
+        live[slot] = true;
+    }
+  }
+  for (int i = info.last; i >= info.first; i--)
+  {
+    Statement *stmt = program.getStatementAt(i);
+    LineFacts &line = facts[i];
+    if (observed[i] || stmt->getType() == END)
+    {
+      live.assign(numSlots, true);
+      continue;
+    }
+    if (stmt->getType() == LET)
+    {
+      int slot = static_cast<LETStatement *>(stmt)->getSlot();
+      bool dead = !live[slot] && isPure(line.exp);
+      if (mark)
+        line.deadStore = dead;
+      if (dead)
+        continue;
+      live[slot] = false;
+      addReads(line.exp, live);
+    }
+    else if (stmt->getType() == PRINT || stmt->getType() == ON)
+    {
+      addReads(line.exp, live);
+    }
+    else if (stmt->getType() == IF)
+    {
+      visitOperands(line.cond, [&](Expression *exp) { addReads(exp, live); });
+    }
+    else if (stmt->getType() == FOR)
+    {
+      auto *loop = static_cast<FORStatement *>(stmt);
+      live[loop->getSlot()] = false;
+      live[loop->getLimitSlot()] = false;
+      live[loop->getStepSlot()] = false;
+      addReads(line.exp, live);
+      addReads(line.lhs, live);
+      addReads(line.rhs, live);
+    }
+    else if (stmt->getType() == NEXT)
+    {
+      auto *loop = static_cast<FORStatement *>(program.getStatementAt(static_cast<NEXTStatement *>(stmt)->getForIndex()));
+      live[loop->getSlot()] = true;
+      live[loop->getLimitSlot()] = true;
+      addReads(line.exp, live);
+    }
+  }
+  if (live != liveIn[block])
+  {
+    liveIn[block] = live;
+    changed = true;
+  }
+}
+
+/*
+ * Implementation notes: hoistInvariants
+ * -------------------------------------
+ * A subexpression of a loop line is invariant if it assigns nothing
+ * and every variable it reads is defined whenever the loop is entered
+ * and never written inside the loop.  Such a subexpression is computed
+ * once into a temporary before the header runs, and every copy of it
+ * in the loop reads the temporary instead.
+ *
+ * The preheader runs even when the line the subexpression came from
+ * would not have, so only subexpressions that cannot fail are moved:
+ * a division is hoisted only when its divisor is a constant other than
+ * 0 and -1, which can never raise DIVIDE BY ZERO or overflow.
+ *
+ * The preheader is laid out just before the header, where control
+ * falls into the loop from the line above; jumps into the loop from
+ * outside land on it and the loop's own jumps skip it.  A loop whose
+ * header is fallen into from a line inside the loop has no such place
+ * and is left alone.  A RETURN lands right after its GOSUB or
+ * ON . . . GOSUB, so if that is the header, each RETURN that leads
+ * there counts as falling into it, as does the ON itself.  Inner loops
+ * are handled first; the temporaries they set count as written in any
+ * loop that contains them.
+ *
+ * Temporaries are named $0, $1, . . ., which no BASIC variable can be,
+ * and are shared by successive analyses.  They are interned as they
+ * are made, so the slot vectors of each loop are sized by the symbol
+ * count at that point rather than by numSlots.
+ */
+
+static bool isHoistable(Expression *exp, const std::vector<bool> &usable)
+{
+  switch (exp->getType())
+  {
+    case CONSTANT:
+      return true;
+    case IDENTIFIER:
+      return usable[static_cast<IdentifierExp *>(exp)->getSlot()];
+    case NEGATE:
+      return isHoistable(static_cast<NegateExp *>(exp)->getOperand(), usable);
+    case COMPOUND:
+      break;
+    default:
+      return false;
+  }
+  auto *compound = static_cast<CompoundExp *>(exp);
+  std::string op = compound->getOp();
+  if (op == "=")
+    return false;
+  if (op == "/")
+  {
+    Expression *rhs = compound->getRHS();
+    if (rhs->getType() != CONSTANT)
+      return false;
+    int divisor = static_cast<ConstantExp *>(rhs)->getValue();
+    if (divisor == 0 || divisor == -1)
+      return false;
+  }
+  return isHoistable(compound->getLHS(), usable) && isHoistable(compound->getRHS(), usable);
+}
+
+static void addWrites(Expression *exp, std::vector<bool> &written)
+{
+  if (exp->getType() == NEGATE)
+  {
+    addWrites(static_cast<NegateExp *>(exp)->getOperand(), written);
+  }
+  else if (exp->getType() == COMPOUND)
+  {
+    auto *compound = static_cast<CompoundExp *>(exp);
+    if (compound->getOp() == "=" && compound->getLHS()->getType() == IDENTIFIER)
+      written[static_cast<IdentifierExp *>(compound->getLHS())->getSlot()] = true;
+    addWrites(compound->getLHS(), written);
+    addWrites(compound->getRHS(), written);
+  }
+}
+
+/*
+ * Returns the variables a FOR or NEXT line sets besides those assigned
+ * inside its expressions: the loop variable, and for a FOR the two
+ * hidden variables of the loop.
+ */
+
+static std::vector<int> loopWrites(Program &program, Statement *stmt)
+{
+  if (stmt->getType() == FOR)
+  {
+    auto *loop = static_cast<FORStatement *>(stmt);
+    return {loop->getSlot(), loop->getLimitSlot(), loop->getStepSlot()};
+  }
+  if (stmt->getType() == NEXT && static_cast<NEXTStatement *>(stmt)->getForIndex() >= 0)
+  {
+    int index = static_cast<NEXTStatement *>(stmt)->getForIndex();
+    return {static_cast<FORStatement *>(program.getStatementAt(index))->getSlot()};
+  }
+  return {};
+}
+
+Expression *Dataflow::hoist(Expression *exp, const std::vector<bool> &usable, std::vector<Hoist> &preheader)
+{
+  if (exp->getType() == CONSTANT || exp->getType() == IDENTIFIER)
+    return exp;
+  if (isHoistable(exp, usable))
+  {
+    std::string text = exp->toString();
+    for (const Hoist &hoisted : preheader)
+    {
+      if (hoisted.exp->toString() == text)
+        return new (arena) IdentifierExp(getSymbolName(hoisted.slot));
+    }
+    std::string name = "$" + integerToString(tempCount++);
+    preheader.push_back({internSymbol(name), exp});
+    return new (arena) IdentifierExp(name);
+  }
+  if (exp->getType() == NEGATE)
+  {
+    Expression *operand = static_cast<NegateExp *>(exp)->getOperand();
+    Expression *hoisted = hoist(operand, usable, preheader);
+    return hoisted == operand ? exp : new (arena) NegateExp(hoisted);
+  }
+  if (exp->getType() != COMPOUND)
+    return exp;
+  auto *compound = static_cast<CompoundExp *>(exp);
+  Expression *lhs = compound->getLHS();
+  if (compound->getOp() != "=")
+    lhs = hoist(lhs, usable, preheader);
+  Expression *rhs = hoist(compound->getRHS(), usable, preheader);
+  if (lhs == compound->getLHS() && rhs == compound->getRHS())
+    return exp;
+  return new (arena) CompoundExp(compound->getOp(), lhs, rhs);
+}
+
+void Dataflow::hoistInvariants(Program &program)
+{
+  tempCount = 0;
+  const std::vector<Loop> &loops = cfg.getLoops();
+  for (int l = 0; l < static_cast<int>(loops.size()); l++)
+  {
+    const Loop &loop = loops[l];
+    const BasicBlock &header = cfg.getBlock(loop.header);
+    if (!executable[loop.header])
+      continue;
+    if (header.first > 0)
+    {
+      Statement *above = program.getStatementAt(header.first - 1);
+      bool inside = above->getType() != GOSUB &&
+                    std::binary_search(loop.blocks.begin(), loop.blocks.end(), cfg.getBlockOf(header.first - 1));
+      if (above->getType() == GOSUB || (above->getType() == ON && static_cast<ONStatement *>(above)->isGosub()))
+      {
+        for (int pred : header.preds)
+        {
+          if (program.getStatementAt(cfg.getBlock(pred).last)->getType() == RETURN &&
+              std::binary_search(loop.blocks.begin(), loop.blocks.end(), pred))
+            inside = true;
+        }
+      }
+      if (inside)
+        continue;
+    }
+
+    Env entry(numSlots, {VALUE_NONE, 0});
+    for (int pred : header.preds)
+    {
+      if (executable[pred] && !std::binary_search(loop.blocks.begin(), loop.blocks.end(), pred) &&
+          std::find(taken[pred].begin(), taken[pred].end(), loop.header) != taken[pred].end())
+        meet(entry, outs[pred]);
+    }
+    if (loop.header == 0)
+      meet(entry, Env(numSlots, {VALUE_UNKNOWN, 0}));
+
+    int slots = getSymbolCount();
+    std::vector<bool> written(slots, false);
+    for (int b : loop.blocks)
+    {
+      const BasicBlock &block = cfg.getBlock(b);
+      for (int i = block.first; i <= block.last; i++)
+      {
+        Statement *stmt = program.getStatementAt(i);
+        const LineFacts &line = facts[i];
+        if (stmt->getType() == LET)
+          written[static_cast<LETStatement *>(stmt)->getSlot()] = true;
+        else if (stmt->getType() == INPUT)
+          written[static_cast<INPUTStatement *>(stmt)->getSlot()] = true;
+        for (int slot : loopWrites(program, stmt))
+          written[slot] = true;
+        visitExpressions(line, [&](Expression *exp) { addWrites(exp, written); });
+        for (const Hoist &hoisted : line.preheader)
+          written[hoisted.slot] = true;
+        for (const Hoist &hoisted : line.after)
+          written[hoisted.slot] = true;
+      }
+    }
+    std::vector<bool> usable(slots, false);
+    for (int slot = 0; slot < numSlots; slot++)
+      usable[slot] = !written[slot] && (entry[slot].kind == VALUE_CONST || entry[slot].kind == VALUE_DEFINED);
+
+    std::vector<Hoist> preheader;
+    for (int b : loop.blocks)
+    {
+      const BasicBlock &block = cfg.getBlock(b);
+      for (int i = block.first; i <= block.last; i++)
+      {
+        LineFacts &line = facts[i];
+        if (line.deadStore || line.branch != BRANCH_UNKNOWN)
+          continue;
+        rewriteExpressions(line, [&](Expression *exp) { return hoist(exp, usable, preheader); }, arena);
+      }
+    }
+    reduceInductions(program, loop, entry, preheader);
+    if (preheader.empty())
+      continue;
+    facts[header.first].preheader = std::move(preheader);
+    headerLoop[loop.header] = l;
+  }
+}
+
+/*
+ * Implementation notes: reduceInductions
+ * --------------------------------------
+ * A basic induction variable of a loop is one whose only write inside
+ * the loop is a line LET v = v + c or LET v = v - c and which is
+ * defined whenever the loop is entered.  Every product v * k with a
+ * constant k then changes by exactly c * k when v does, so it can be
+ * kept in a temporary t instead: the preheader sets t = v * k, the
+ * update line is followed by t = t + c * k, and the products in the
+ * loop read t.  Wrapping arithmetic keeps t equal to v * k even when
+ * either overflows.
+ *
+ * Each use saves a multiplication but the update adds an addition and
+ * a store on every pass through the update line, so a product is only
+ * reduced when it occurs at least MIN_INDUCTION_USES times in the loop.
+ * Lines outside the loop still compute v * k themselves.
+ */
+
+static const int MIN_INDUCTION_USES = 3;
+
+typedef std::map<std::pair<int, int>, int> ProductMap;
+
+static bool isProduct(Expression *exp, const std::vector<bool> &induction, std::pair<int, int> &key)
+{
+  if (exp->getType() != COMPOUND || static_cast<CompoundExp *>(exp)->getOp() != "*")
+    return false;
+  Expression *lhs = static_cast<CompoundExp *>(exp)->getLHS();
+  Expression *rhs = static_cast<CompoundExp *>(exp)->getRHS();
+  if (lhs->getType() == CONSTANT)
+    std::swap(lhs, rhs);
+  if (lhs->getType() != IDENTIFIER || rhs->getType() != CONSTANT)
+    return false;
+  int slot = static_cast<IdentifierExp *>(lhs)->getSlot();
+  if (slot >= static_cast<int>(induction.size()) || !induction[slot])
+    return false;
+  key = {slot, static_cast<ConstantExp *>(rhs)->getValue()};
+  return true;
+}
+
+static void countProducts(Expression *exp, const std::vector<bool> &induction, ProductMap &uses)
+{
+  std::pair<int, int> key;
+  if (isProduct(exp, induction, key))
+  {
+    uses[key]++;
+  }
+  else if (exp->getType() == NEGATE)
+  {
+    countProducts(static_cast<NegateExp *>(exp)->getOperand(), induction, uses);
+  }
+  else if (exp->getType() == COMPOUND)
+  {
+    countProducts(static_cast<CompoundExp *>(exp)->getLHS(), induction, uses);
+    countProducts(static_cast<CompoundExp *>(exp)->getRHS(), induction, uses);
+  }
+}
+
+static Expression *replaceProducts(Expression *exp, const std::vector<bool> &induction, const ProductMap &temps,
+                                   Arena &arena)
+{
+  std::pair<int, int> key;
+  if (isProduct(exp, induction, key))
+  {
+    auto it = temps.find(key);
+    return it == temps.end() ? exp : new (arena) IdentifierExp(getSymbolName(it->second));
+  }
+  if (exp->getType() == NEGATE)
+  {
+    Expression *operand = static_cast<NegateExp *>(exp)->getOperand();
+    Expression *replaced = replaceProducts(operand, induction, temps, arena);
+    return replaced == operand ? exp : new (arena) NegateExp(replaced);
+  }
+  if (exp->getType() != COMPOUND)
+    return exp;
+  auto *compound = static_cast<CompoundExp *>(exp);
+  Expression *lhs = replaceProducts(compound->getLHS(), induction, temps, arena);
+  Expression *rhs = replaceProducts(compound->getRHS(), induction, temps, arena);
+  if (lhs == compound->getLHS() && rhs == compound->getRHS())
+    return exp;
+  return new (arena) CompoundExp(compound->getOp(), lhs, rhs);
+}
+
+void Dataflow::reduceInductions(Program &program, const Loop &loop, const Env &entry, std::vector<Hoist> &preheader)
+{
+  int slots = getSymbolCount();
+  std::vector<int> writes(slots, 0);
+  std::vector<int> updateLine(slots, -1);
+  for (int b : loop.blocks)
+  {
+    const BasicBlock &block = cfg.getBlock(b);
+    for (int i = block.first; i <= block.last; i++)
+    {
+      Statement *stmt = program.getStatementAt(i);
+      const LineFacts &line = facts[i];
+      std::vector<bool> assigned(slots, false);
+      visitExpressions(line, [&](Expression *exp) { addWrites(exp, assigned); });
+      for (const Hoist &hoisted : line.preheader)
+        assigned[hoisted.slot] = true;
+      for (const Hoist &hoisted : line.after)
+        assigned[hoisted.slot] = true;
+      for (int slot = 0; slot < slots; slot++)
+      {
+        if (assigned[slot])
+          writes[slot] += 2;
+      }
+      if (stmt->getType() == LET)
+      {
+        int slot = static_cast<LETStatement *>(stmt)->getSlot();
+        writes[slot]++;
+        updateLine[slot] = i;
+      }
+      else if (stmt->getType() == INPUT)
+      {
+        writes[static_cast<INPUTStatement *>(stmt)->getSlot()] += 2;
+      }
+      for (int slot : loopWrites(program, stmt))
+        writes[slot] += 2;
+    }
+  }
+
+  std::vector<bool> induction(slots, false);
+  std::vector<int> steps(slots, 0);
+  for (int slot = 0; slot < numSlots; slot++)
+  {
+    int i = updateLine[slot];
+    induction[slot] = writes[slot] == 1 && facts[i].reachable && !facts[i].deadStore &&
+                      (entry[slot].kind == VALUE_CONST || entry[slot].kind == VALUE_DEFINED) &&
+                      isStep(facts[i].exp, slot, steps[slot]);
+  }
+
+  ProductMap uses;
+  for (int b : loop.blocks)
+  {
+    const BasicBlock &block = cfg.getBlock(b);
+    for (int i = block.first; i <= block.last; i++)
+    {
+      const LineFacts &line = facts[i];
+      if (line.deadStore || line.branch != BRANCH_UNKNOWN)
+        continue;
+      visitExpressions(line, [&](Expression *exp) { countProducts(exp, induction, uses); });
+    }
+  }
+  ProductMap temps;
+  for (const auto &entry : uses)
+  {
+    if (entry.second < MIN_INDUCTION_USES)
+      continue;
+    int slot = entry.first.first;
+    int factor = entry.first.second;
+    std::string name = "$" + integerToString(tempCount++);
+    int temp = internSymbol(name);
+    temps[entry.first] = temp;
+    preheader.push_back(
+      {temp, new (arena) CompoundExp("*", new (arena) IdentifierExp(getSymbolName(slot)), new (arena) ConstantExp(factor))});
+    int increment;
+    foldOperator("*", steps[slot], factor, increment);
+    facts[updateLine[slot]].after.push_back(
+      {temp, new (arena) CompoundExp("+", new (arena) IdentifierExp(name), new (arena) ConstantExp(increment))});
+  }
+  if (temps.empty())
+    return;
+  for (int b : loop.blocks)
+  {
+    const BasicBlock &block = cfg.getBlock(b);
+    for (int i = block.first; i <= block.last; i++)
+    {
+      LineFacts &line = facts[i];
+      if (line.deadStore || line.branch != BRANCH_UNKNOWN)
+        continue;
+      rewriteExpressions(line, [&](Expression *exp) { return replaceProducts(exp, induction, temps, arena); }, arena);
+    }
+  }
+}
@@ -0,0 +1,187 @@
+/*
+ * File: dataflow.h
+ * ----------------
+ * This interface exports the Dataflow class, which runs global
+ * constant propagation, unreachable-line detection, dead-store
+ * elimination, loop-invariant code motion and induction-variable
+ * strength reduction over the CFG of a program.  The compilers use the
+ * results to emit code only for lines that can run, with variables
+ * that always hold a known constant replaced by that constant,
+ * invariant work moved out of loops and multiplications of a loop
+ * counter replaced by a running sum.
+ */
+
+#ifndef _dataflow_h
+#define _dataflow_h
+
+#include <vector>
+#include "cfg.hpp"
+#include "exp.hpp"
+#include "program.hpp"
+#include "Utils/arena.hpp"
+
+/*
+ * Type: BranchFate
+ * ----------------
+ * What is known about the condition of an IF line: nothing, or that it
+ * is always false or always true whenever the line runs.
+ */
+
+enum BranchFate
+{
+  BRANCH_UNKNOWN,
+  BRANCH_NEVER,
+  BRANCH_ALWAYS
+};
+
+/*
+ * Type: Hoist
+ * -----------
+ * One store into the temporary variable slot that the optimizer adds
+ * to the program: exp is evaluated and stored in slot.
+ */
+
+struct Hoist
+{
+  int slot;
+  Expression *exp;
+};
+
+/*
+ * Type: LineFacts
+ * ---------------
+ * The results for one line.  exp, lhs and rhs are the expressions of a
+ * LET, PRINT, FOR, NEXT or ON line rewritten with the known constants
+ * and simplified, as described for Dataflow::runLine, and cond is the
+ * condition of an IF line with its operands rewritten the same way;
+ * lines of other kinds leave them null.  A dead store is a LET whose value is
+ * overwritten before it can be read or observed and whose expression
+ * has no effect, so the whole line can be skipped.  preheader is only
+ * filled in on the first line of a loop header: the stores to run each
+ * time the loop is entered from outside, before the line itself.
+ * after holds the stores to run right after the line, which keep a
+ * strength-reduced temporary in step with the variable the line
+ * updates.
+ */
+
+struct LineFacts
+{
+  bool reachable = false;
+  bool deadStore = false;
+  BranchFate branch = BRANCH_UNKNOWN;
+  Expression *exp = nullptr;
+  Expression *lhs = nullptr;
+  Expression *rhs = nullptr;
+  Condition *cond = nullptr;
+  std::vector<Hoist> preheader;
+  std::vector<Hoist> after;
+};
+
+/*
+ * Class: Dataflow
+ * ---------------
+ * The analysis of a program as it was when analyze was called.  The
+ * rewritten expressions live in the Dataflow object's own arena and
+ * share nodes with the program's trees, so both must outlive any use
+ * of them.
+ */
+
+class Dataflow
+{
+public:
+  Dataflow();
+
+  Dataflow(const Dataflow &) = delete;
+
+  Dataflow &operator=(const Dataflow &) = delete;
+
+  /*
+   * Method: analyze
+   * Usage: flow.analyze(program);
+   * -----------------------------
+   * Builds the CFG of program and computes the facts for every line,
+   * replacing the results of any earlier analysis.
+   */
+
+  void analyze(Program &program);
+
+  /*
+   * Method: getFacts
+   * Usage: const LineFacts &facts = flow.getFacts(index);
+   * -----------------------------------------------------
+   * Returns the facts for the line at a position in the program.
+   */
+
+  const LineFacts &getFacts(int lineIndex) const;
+
+  const CFG &getCFG() const;
+
+  /*
+   * Method: skipsPreheader
+   * Usage: if (flow.skipsPreheader(from, to)) . . .
+   * -----------------------------------------------
+   * Returns true if a jump from the line at position from to the line
+   * at position to stays inside a loop whose preheader sits in front of
+   * to, so the jump must land after the preheader rather than on it.
+   */
+
+  bool skipsPreheader(int fromLine, int toLine) const;
+
+private:
+  /*
+   * The value of one variable at a point of the program, ordered from
+   * most to least precise: no path reaches the point yet, the variable
+   * always holds value, it is always defined, or it may be undefined.
+   */
+
+  enum ValueKind
+  {
+    VALUE_NONE,
+    VALUE_CONST,
+    VALUE_DEFINED,
+    VALUE_UNKNOWN
+  };
+
+  struct Value
+  {
+    ValueKind kind;
+    int value;
+  };
+
+  typedef std::vector<Value> Env;
+
+  CFG cfg;
+  Arena arena;
+  std::vector<LineFacts> facts;
+  std::vector<bool> observed;
+  std::vector<bool> executable;
+  std::vector<std::vector<int>> taken;
+  std::vector<Env> outs;
+  std::vector<int> headerLoop;
+  int numSlots = 0;
+  int tempCount = 0;
+
+  void propagate(Program &program);
+
+  void eliminateStores(Program &program);
+
+  void hoistInvariants(Program &program);
+
+  Expression *hoist(Expression *exp, const std::vector<bool> &usable, std::vector<Hoist> &preheader);
+
+  void reduceInductions(Program &program, const Loop &loop, const Env &entry, std::vector<Hoist> &preheader);
+
+  void runLiveness(Program &program, int block, std::vector<std::vector<bool>> &liveIn, bool mark, bool &changed);
+
+  BranchFate runLine(Program &program, Statement *stmt, Env &env, LineFacts *out, bool &faults);
+
+  Value evaluate(Expression *exp, Env &env, Expression **out, bool &faults);
+
+  Value test(Condition *cond, Env &env, Condition **out, bool &faults);
+
+  void successors(Program &program, int block, BranchFate fate, std::vector<int> &out) const;
+
+  static bool meet(Env &into, const Env &from);
+};
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ * File: engine.cpp
+ * ----------------
+ * This file implements the built-in execution engines.
+ */
+
+#include "engine.hpp"
+#include <memory>
+#include "Utils/error.hpp"
+#include "program.hpp"
+
+
+static TreeEngine tree_engine;
+static VMEngine vm_engine;
+static RegisterEngine register_engine;
+static JITEngine jit_engine;
+static TieredEngine tiered_engine;
+static Engine *default_engine = &vm_engine;
+
+Engine::~Engine() = default;
+
+/*
+ * Implementation notes: TreeEngine::run
+ * -------------------------------------
+ * Statements return their runtime errors, so the loop only has to
+ * test a code after each one; the exception that reports an error to
+ * the caller is thrown here, once, when the program stops.
+ */
+
+void TreeEngine::run(Program &program, EvalState &state)
+{
+  program.initCurLineNumber();
+  while (program.getCurLineNumber() != -1)
+  {
+    ErrorCode code = program.getCurStatement()->execute(state, program);
+    if (code != ERR_NONE)
+      error(code);
+  }
+}
+
+void VMEngine::run(Program &program, EvalState &state)
+{
+  if (!compiler.compile(program, chunk))
+  {
+    fallback.run(program, state);
+    return;
+  }
+  vm.run(chunk, state);
+}
+
+void RegisterEngine::run(Program &program, EvalState &state)
+{
+  if (!compiler.compile(program, chunk))
+  {
+    fallback.run(program, state);
+    return;
+  }
+  vm.run(chunk, state);
+}
+
+void JITEngine::run(Program &program, EvalState &state)
+{
+  if (!compiler.compile(program, chunk))
+  {
+    fallback.run(program, state);
+    return;
+  }
+  if (!jit.compile(chunk))
+  {
+    vm.run(chunk, state);
+    return;
+  }
+  jit.run(chunk, state);
+}
+
+/*
+ * Implementation notes: TieredEngine::run
+ * ---------------------------------------
+ * The program counter stays in the Program, as for the tree walker.
+ * A compiled line leaves through OP_EXIT with the entry of its exit
+ * table to continue at, which promote resolved to a position when it
+ * compiled the line, so following it is an index.  A missing line is
+ * only reported here, when the jump is actually taken, so that LINE
+ * NUMBER ERROR is raised exactly where the tree walker would.  The bytecode tier uses the switch loop because the other
+ * dispatch modes prepare the whole chunk on every call.
+ */
+
+void TieredEngine::run(Program &program, EvalState &state)
+{
+  program.initCurLineNumber();
+  while (program.getCurLineNumber() != -1)
+  {
+    Statement *stmt = program.getCurStatement();
+    LineProfile &profile = program.getCurProfile();
+    profile.executions++;
+    promote(program, stmt, profile);
+    if (profile.tier == TIER_TREE)
+    {
+      ErrorCode code = stmt->execute(state, program);
+      if (code != ERR_NONE)
+        error(code);
+      continue;
+    }
+    VMStatus status;
+    int exit_entry;
+    if (profile.tier == TIER_NATIVE)
+    {
+      status = profile.native->run(profile.chunk, state);
+      exit_entry = profile.native->getExit();
+    }
+    else
+    {
+      status = vm.run(profile.chunk, state, DISPATCH_SWITCH);
+      exit_entry = vm.getExit();
+    }
+    if (status == VM_HALT)
+      program.end();
+    else if (exit_entry == EXIT_NEXT_LINE)
+      program.gotoNextLine();
+    else if (program.jumpTo(profile.exitIndices[exit_entry]) != ERR_NONE)
+      error(ERR_LINE_NUMBER);
+  }
+}
+
+void TieredEngine::setThresholds(long long bytecode, long long native)
+{
+  bytecodeThreshold = bytecode;
+  nativeThreshold = native;
+}
+
+void TieredEngine::promote(Program &program, Statement *stmt, LineProfile &profile)
+{
+  if (profile.stuck)
+    return;
+  if (profile.tier == TIER_TREE && profile.executions > bytecodeThreshold)
+  {
+    if (!compiler.compileLine(stmt, profile.chunk))
+    {
+      profile.stuck = true;
+      return;
+    }
+    program.linkExits(profile);
+    profile.tier = TIER_BYTECODE;
+  }
+  if (profile.tier == TIER_BYTECODE && profile.executions > nativeThreshold)
+  {
+    std::unique_ptr<JIT> native(new JIT());
+    if (!JIT::isSupported() || !native->compile(profile.chunk))
+    {
+      profile.stuck = true;
+      return;
+    }
+    profile.native = std::move(native);
+    profile.tier = TIER_NATIVE;
+  }
+}
+
+Engine *getEngine(const std::string &name)
+{
+  if (name == "TREE")
+    return &tree_engine;
+  if (name == "VM")
+    return &vm_engine;
+  if (name == "REG")
+    return &register_engine;
+  if (name == "JIT")
+    return &jit_engine;
+  if (name == "TIERED")
+    return &tiered_engine;
+  return nullptr;
+}
+
+TieredEngine &getTieredEngine() { return tiered_engine; }
+
+Engine &getDefaultEngine() { return *default_engine; }
+
+void setDefaultEngine(Engine &engine) { default_engine = &engine; }
@@ -0,0 +1,187 @@
+/*
+ * File: engine.h
+ * --------------
+ * This interface exports the Engine abstraction, which executes a
+ * stored Program, together with the engines built into the
+ * interpreter.  RUN uses the default engine; RUN followed by an engine
+ * name selects one explicitly.
+ */
+
+#ifndef _engine_h
+#define _engine_h
+
+#include <string>
+#include "bytecode.hpp"
+#include "compiler.hpp"
+#include "evalstate.hpp"
+#include "jit.hpp"
+#include "program.hpp"
+#include "regvm.hpp"
+#include "vm.hpp"
+
+/*
+ * Class: Engine
+ * -------------
+ * An execution strategy for a whole program.  Engines must produce
+ * exactly the same output and errors; they differ only in speed.
+ */
+
+class Engine
+{
+public:
+  virtual ~Engine();
+
+  /*
+   * Method: run
+   * Usage: engine.run(program, state);
+   * ----------------------------------
+   * Runs program from its first line.  Runtime errors are raised with
+   * error() and stop the program.
+   */
+
+  virtual void run(Program &program, EvalState &state) = 0;
+};
+
+/*
+ * Class: TreeEngine
+ * -----------------
+ * Walks the program line by line, calling Statement::execute.
+ */
+
+class TreeEngine : public Engine
+{
+public:
+  void run(Program &program, EvalState &state) override;
+};
+
+/*
+ * Class: VMEngine
+ * ---------------
+ * Compiles the program to bytecode and runs it on the stack VM.
+ * Programs the compiler rejects are handed to the tree walker.
+ */
+
+class VMEngine : public Engine
+{
+public:
+  void run(Program &program, EvalState &state) override;
+
+private:
+  Compiler compiler;
+  Chunk chunk;
+  VM vm;
+  TreeEngine fallback;
+};
+
+/*
+ * Class: RegisterEngine
+ * ---------------------
+ * Compiles the program to three-address register code and runs it on
+ * the RegVM, falling back to the tree walker like VMEngine.
+ */
+
+class RegisterEngine : public Engine
+{
+public:
+  void run(Program &program, EvalState &state) override;
+
+private:
+  RegCompiler compiler;
+  RegChunk chunk;
+  RegVM vm;
+  TreeEngine fallback;
+};
+
+/*
+ * Class: JITEngine
+ * ----------------
+ * Compiles the program to bytecode and then to native code with the
+ * JIT.  Where the JIT is unavailable it runs the bytecode on the VM,
+ * and programs the bytecode compiler rejects go to the tree walker.
+ */
+
+class JITEngine : public Engine
+{
+public:
+  void run(Program &program, EvalState &state) override;
+
+private:
+  Compiler compiler;
+  Chunk chunk;
+  JIT jit;
+  VM vm;
+  TreeEngine fallback;
+};
+
+/*
+ * Class: TieredEngine
+ * -------------------
+ * Runs the program line by line and promotes each line on its own as
+ * it gets hot: every line starts in the tree walker, moves to a
+ * bytecode chunk on the VM after bytecodeThreshold executions and to
+ * native code after nativeThreshold executions.  Execution counts and
+ * tiers are kept in the line's LineProfile and survive between runs
+ * until the line is edited.
+ */
+
+class TieredEngine : public Engine
+{
+public:
+  static const long long DEFAULT_BYTECODE_THRESHOLD = 16;
+  static const long long DEFAULT_NATIVE_THRESHOLD = 1024;
+
+  void run(Program &program, EvalState &state) override;
+
+  /*
+   * Method: setThresholds
+   * Usage: engine.setThresholds(bytecode, native);
+   * ----------------------------------------------
+   * Sets the number of executions after which a line is promoted to
+   * bytecode and to native code.  Zero promotes on the first run.
+   */
+
+  void setThresholds(long long bytecode, long long native);
+
+private:
+  long long bytecodeThreshold = DEFAULT_BYTECODE_THRESHOLD;
+  long long nativeThreshold = DEFAULT_NATIVE_THRESHOLD;
+  Compiler compiler;
+  VM vm;
+
+  void promote(Program &program, Statement *stmt, LineProfile &profile);
+};
+
+/*
+ * Function: getEngine
+ * Usage: Engine *engine = getEngine(name);
+ * ----------------------------------------
+ * Returns the built-in engine called name ("TREE", "VM", "REG", "JIT" or
+ * "TIERED"), or nullptr if there is no such engine.
+ */
+
+Engine *getEngine(const std::string &name);
+
+/*
+ * Function: getTieredEngine
+ * Usage: getTieredEngine().setThresholds(bytecode, native);
+ * ---------------------------------------------------------
+ * Returns the built-in tiered engine, so that its thresholds can be
+ * configured.
+ */
+
+TieredEngine &getTieredEngine();
+
+/*
+ * Functions: getDefaultEngine, setDefaultEngine
+ * Usage: Engine &engine = getDefaultEngine();
+ *        setDefaultEngine(engine);
+ * ---------------------------------------------
+ * Read or change the engine used by a plain RUN command.  The VM is
+ * the default.
+ */
+
+Engine &getDefaultEngine();
+
+void setDefaultEngine(Engine &engine);
+
+#endif
@@ -8,6 +8,9 @@
 
 
 #include "evalstate.hpp"
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
 
 
 //using namespace std;
@@ -22,20 +25,67 @@ EvalState::~EvalState() {
     /* Empty */
 }
 
-void EvalState::setValue(std::string var, int value) {
-    if(isDefined(var)) symbolTable[var] = value;
-    else symbolTable.emplace(var,value);
+void EvalState::setValue(const std::string &var, int value) {
+    setValue(internSymbol(var), value);
 }
 
-int EvalState::getValue(std::string var) {
-    if(isDefined(var)) return symbolTable[var];
-    else return 0;
+int EvalState::getValue(const std::string &var) {
+    return getValue(internSymbol(var));
 }
 
-bool EvalState::isDefined(std::string var) {
-    return symbolTable.find(var)!=symbolTable.end();
+bool EvalState::isDefined(const std::string &var) {
+    return isDefined(internSymbol(var));
 }
 
 void EvalState::Clear() {
-    symbolTable.clear();
-}
\ No newline at end of file
+    std::fill(bits.begin(), bits.end(), 0);
+}
+
+/*
+ * Implementation notes: reserveSlots
+ * ----------------------------------
+ * The value array grows geometrically and the bitset keeps one word
+ * for every 64 values, so capacity is always a multiple of 64.
+ */
+
+void EvalState::reserveSlots(int count) {
+    if (count <= capacity) return;
+    int size = capacity == 0 ? 64 : capacity;
+    while (size < count) size *= 2;
+    values.resize(size, 0);
+    bits.resize(size / 64, 0);
+    capacity = size;
+}
+
+/*
+ * Implementation notes: the symbol interner
+ * -----------------------------------------
+ * The interner is shared by every program and state in the process.
+ * Names are never removed, so a slot number stays valid for as long
+ * as any parsed expression that holds it, and the names are kept in a
+ * deque so that references returned by getSymbolName stay valid too.
+ */
+
+static std::unordered_map<std::string, int> &symbolSlots() {
+    static std::unordered_map<std::string, int> slots;
+    return slots;
+}
+
+static std::deque<std::string> &symbolNames() {
+    static std::deque<std::string> names;
+    return names;
+}
+
+int internSymbol(const std::string &name) {
+    auto inserted = symbolSlots().emplace(name, static_cast<int>(symbolNames().size()));
+    if (inserted.second) symbolNames().push_back(name);
+    return inserted.first->second;
+}
+
+const std::string &getSymbolName(int slot) {
+    return symbolNames()[slot];
+}
+
+int getSymbolCount() {
+    return static_cast<int>(symbolNames().size());
+}
@@ -9,8 +9,40 @@
 #ifndef _evalstate_h
 #define _evalstate_h
 
+#include <cstdint>
 #include <string>
-#include <map>
+#include <vector>
+
+/*
+ * Functions: internSymbol, getSymbolName, getSymbolCount
+ * Usage: int slot = internSymbol(name);
+ * -------------------------------------
+ * Every variable name is interned once, when the expression or
+ * statement that mentions it is parsed, and is known from then on by
+ * a dense integer slot.  The same name always gets the same slot, and
+ * slots are numbered from 0 up to getSymbolCount() - 1.
+ */
+
+int internSymbol(const std::string &name);
+
+const std::string &getSymbolName(int slot);
+
+int getSymbolCount();
+
+/*
+ * Functions: testSlot, markSlot
+ * Usage: if (testSlot(bits, slot)) . . .
+ * --------------------------------------
+ * Read and set the bit for slot in a defined-bitset.
+ */
+
+inline bool testSlot(const std::uint64_t *bits, int slot) {
+    return (bits[slot >> 6] >> (slot & 63)) & 1;
+}
+
+inline void markSlot(std::uint64_t *bits, int slot) {
+    bits[slot >> 6] |= std::uint64_t(1) << (slot & 63);
+}
 
 /*
  * Class: EvalState
@@ -19,7 +51,8 @@
  * of the evaluator and contains information from the evaluation
  * environment that the evaluator may need to know.  In this
  * version, the only information maintained by the EvalState class
- * is a symbol table that maps variable names into their values.
+ * is a flat array of variable values indexed by interned slot, plus
+ * a bitset recording which slots are defined.
  * In your implementation, you may include additional information
  * in the EvalState class.
  */
@@ -53,7 +86,13 @@ public:
  * Sets the value associated with the specified var.
  */
 
-    void setValue(std::string var, int value);
+    void setValue(const std::string &var, int value);
+
+    void setValue(int slot, int value) {
+        if (slot >= capacity) reserveSlots(slot + 1);
+        values[slot] = value;
+        markSlot(bits.data(), slot);
+    }
 
 /*
  * Method: getValue
@@ -62,7 +101,11 @@ public:
  * Returns the value associated with the specified variable.
  */
 
-    int getValue(std::string var);
+    int getValue(const std::string &var);
+
+    int getValue(int slot) const {
+        return slot < capacity ? values[slot] : 0;
+    }
 
 /*
  * Method: isDefined
@@ -71,13 +114,46 @@ public:
  * Returns true if the specified variable is defined.
  */
 
-    bool isDefined(std::string var);
+    bool isDefined(const std::string &var);
+
+    bool isDefined(int slot) const {
+        return slot < capacity && testSlot(bits.data(), slot);
+    }
+
+/*
+ * Method: Clear
+ * Usage: state.Clear();
+ * ---------------------
+ * Makes every variable undefined again.  Only the defined-bitset is
+ * reset, so this costs one word per 64 interned names.
+ */
 
     void Clear();
 
+/*
+ * Method: reserveSlots
+ * Usage: state.reserveSlots(getSymbolCount());
+ * --------------------------------------------
+ * Makes room for slots 0 to count - 1.  The arrays returned by
+ * getValues and getDefinedBits stay valid until the state grows
+ * again, so compiled code reserves every slot before it starts.
+ */
+
+    void reserveSlots(int count);
+
+    int *getValues() {
+        return values.data();
+    }
+
+    std::uint64_t *getDefinedBits() {
+        return bits.data();
+    }
+
 private:
 
-    std::map<std::string, int> symbolTable;
+    std::vector<int> values;
+    std::vector<std::uint64_t> bits;
+    int capacity = 0;
 
 };
 
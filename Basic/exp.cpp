@@ -5,32 +5,43 @@
  */
 
 #include "exp.hpp"
+#include <unordered_set>
+#include <vector>
+#include "Utils/arena.hpp"
 
 
 /*
  * Implementation notes: the Expression class
  * ------------------------------------------
- * The Expression class declares no instance variables and needs no code.
+ * The Expression class declares no instance variables.  Its only code
+ * is eval, which turns an error returned by evaluate into an exception
+ * for the callers that want one.
  */
 
 Expression::Expression() = default;
 
 Expression::~Expression() = default;
 
+int Expression::eval(EvalState &state) {
+    EvalResult result = evaluate(state);
+    if (result.error != ERR_NONE) error(result.error);
+    return result.value;
+}
+
 /*
  * Implementation notes: the ConstantExp subclass
  * ----------------------------------------------
  * The ConstantExp subclass declares a single instance variable that
- * stores the value of the constant.  The eval method doesn't use the
- * value of state but needs it to match the general prototype for eval.
+ * stores the value of the constant.  The evaluate method doesn't use
+ * the value of state but needs it to match the general prototype.
  */
 
 ConstantExp::ConstantExp(int value) {
     this->value = value;
 }
 
-int ConstantExp::eval(EvalState &state) {
-    return value;
+EvalResult ConstantExp::evaluate(EvalState &state) {
+    return {value, ERR_NONE};
 }
 
 std::string ConstantExp::toString() {
@@ -49,21 +60,22 @@ int ConstantExp::getValue() {
  * Implementation notes: the IdentifierExp subclass
  * ------------------------------------------------
  * The IdentifierExp subclass declares a single instance variable that
- * stores the name of the variable.  The implementation of eval must
- * look this variable up in the evaluation state.
+ * stores the slot the variable name is interned to; the name itself
+ * lives in the interner.  The implementation of evaluate looks the slot up
+ * in the evaluation state, which is a plain array access.
  */
 
 IdentifierExp::IdentifierExp(std::string name) {
-    this->name = name;
+    this->slot = internSymbol(name);
 }
 
-int IdentifierExp::eval(EvalState &state) {
-    if (!state.isDefined(name)) error("VARIABLE NOT DEFINED");
-    return state.getValue(name);
+EvalResult IdentifierExp::evaluate(EvalState &state) {
+    if (!state.isDefined(slot)) return {0, ERR_VARIABLE_NOT_DEFINED};
+    return {state.getValue(slot), ERR_NONE};
 }
 
 std::string IdentifierExp::toString() {
-    return name;
+    return getSymbolName(slot);
 }
 
 ExpressionType IdentifierExp::getType() {
@@ -71,61 +83,67 @@ ExpressionType IdentifierExp::getType() {
 }
 
 std::string IdentifierExp::getName() {
-    return name;
+    return getSymbolName(slot);
+}
+
+int IdentifierExp::getSlot() {
+    return slot;
 }
 
 /*
  * Implementation notes: the CompoundExp subclass
  * ----------------------------------------------
  * The CompoundExp subclass declares instance variables for the operator
- * and the left and right subexpressions.  The implementation of eval 
+ * and the left and right subexpressions.  The implementation of evaluate
  * evaluates the subexpressions recursively and then applies the operator.
+ * Operator strings are shared between nodes through a small interning
+ * set, so a node holds only a pointer and owns no memory.
  */
 
+static const std::string *internOperator(const std::string &op) {
+    static std::unordered_set<std::string> operators;
+    return &*operators.insert(op).first;
+}
+
 CompoundExp::CompoundExp(std::string op, Expression *lhs, Expression *rhs) {
-    this->op = op;
+    this->op = internOperator(op);
     this->lhs = lhs;
     this->rhs = rhs;
 }
 
-CompoundExp::~CompoundExp() {
-    delete lhs;
-    delete rhs;
-}
-
 /*
- * Implementation notes: eval
- * --------------------------
- * The eval method for the compound expression case must check for the
- * assignment operator as a special case.  Unlike the arithmetic operators
- * the assignment operator does not evaluate its left operand.
+ * Implementation notes: evaluate
+ * ------------------------------
+ * The evaluate method for the compound expression case must check for
+ * the assignment operator as a special case.  Unlike the arithmetic
+ * operators the assignment operator does not evaluate its left operand.
+ * An error in either operand is passed up unchanged.
  */
 
-int CompoundExp::eval(EvalState &state) {
-    if (op == "=") {
-        if (lhs->getType() != IDENTIFIER) {
-            error("Illegal variable in assignment");
-        }
-        if (lhs->getType() == IDENTIFIER && lhs->toString() == "LET")
-            error("SYNTAX ERROR");
-        int val = rhs->eval(state);
-        state.setValue(((IdentifierExp *) lhs)->getName(), val);
+EvalResult CompoundExp::evaluate(EvalState &state) {
+    if (*op == "=") {
+        if (lhs->getType() != IDENTIFIER) return {0, ERR_ILLEGAL_ASSIGNMENT};
+        if (lhs->toString() == "LET") return {0, ERR_SYNTAX};
+        EvalResult val = rhs->evaluate(state);
+        if (val.error == ERR_NONE) state.setValue(((IdentifierExp *) lhs)->getSlot(), val.value);
         return val;
     }
-    int left = lhs->eval(state);
-    int right = rhs->eval(state);
-    if (op == "+") return left + right;
-    if (op == "-") return left - right;
-    if (op == "*") return left * right;
-    if (op == "/") {
-        if (right == 0) error("DIVIDE BY ZERO");
-        return left / right;
+    EvalResult left = lhs->evaluate(state);
+    if (left.error != ERR_NONE) return left;
+    EvalResult right = rhs->evaluate(state);
+    if (right.error != ERR_NONE) return right;
+    if (*op == "+") return {left.value + right.value, ERR_NONE};
+    if (*op == "-") return {left.value - right.value, ERR_NONE};
+    if (*op == "*") return {left.value * right.value, ERR_NONE};
+    if (*op == "/") {
+        if (right.value == 0) return {0, ERR_DIVIDE_BY_ZERO};
+        return {left.value / right.value, ERR_NONE};
     }
-    return 0;
+    return {0, ERR_NONE};
 }
 
 std::string CompoundExp::toString() {
-    return '(' + lhs->toString() + ' ' + op + ' ' + rhs->toString() + ')';
+    return '(' + lhs->toString() + ' ' + *op + ' ' + rhs->toString() + ')';
 }
 
 ExpressionType CompoundExp::getType() {
@@ -133,7 +151,7 @@ ExpressionType CompoundExp::getType() {
 }
 
 std::string CompoundExp::getOp() {
-    return op;
+    return *op;
 }
 
 Expression *CompoundExp::getLHS() {
@@ -143,3 +161,342 @@ Expression *CompoundExp::getLHS() {
 Expression *CompoundExp::getRHS() {
     return rhs;
 }
+
+/*
+ * Implementation notes: the NegateExp subclass
+ * --------------------------------------------
+ * Negation is computed as 0 - value so that it wraps exactly like the
+ * subtraction the parser used to build for a leading minus.
+ */
+
+NegateExp::NegateExp(Expression *operand) {
+    this->operand = operand;
+}
+
+EvalResult NegateExp::evaluate(EvalState &state) {
+    EvalResult result = operand->evaluate(state);
+    result.value = 0 - result.value;
+    return result;
+}
+
+std::string NegateExp::toString() {
+    return "(-" + operand->toString() + ')';
+}
+
+ExpressionType NegateExp::getType() {
+    return NEGATE;
+}
+
+Expression *NegateExp::getOperand() {
+    return operand;
+}
+
+/*
+ * Implementation notes: the FlatExp subclass
+ * ------------------------------------------
+ * flatten walks the tree twice: once to size the array and find the
+ * deepest point of the value stack, and once to emit the operations.
+ * Postfix order is exactly the order in which CompoundExp::evaluate visits
+ * the nodes, so values are computed and errors raised in the same
+ * sequence.  An assignment whose left side is not a plain variable
+ * raises its error before its right side is evaluated, which postfix
+ * code cannot express, so such trees are not flattened.
+ */
+
+static const char *const FLAT_OPERATORS[] = {"", "", "=", "+", "-", "*", "/", "-"};
+
+static bool flatOperator(const std::string &op, FlatOpCode &code) {
+    for (int i = FLAT_ASSIGN; i <= FLAT_DIV; i++) {
+        if (op == FLAT_OPERATORS[i]) {
+            code = static_cast<FlatOpCode>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool measureFlat(Expression *exp, int height, int &length, int &depth) {
+    length++;
+    if (exp->getType() == NEGATE) {
+        return measureFlat(((NegateExp *) exp)->getOperand(), height, length, depth);
+    }
+    if (exp->getType() != COMPOUND) {
+        if (height + 1 > depth) depth = height + 1;
+        return exp->getType() == CONSTANT || exp->getType() == IDENTIFIER;
+    }
+    CompoundExp *compound = (CompoundExp *) exp;
+    FlatOpCode code;
+    if (!flatOperator(compound->getOp(), code)) return false;
+    if (code == FLAT_ASSIGN) {
+        Expression *lhs = compound->getLHS();
+        if (lhs->getType() != IDENTIFIER || lhs->toString() == "LET") return false;
+        return measureFlat(compound->getRHS(), height, length, depth);
+    }
+    return measureFlat(compound->getLHS(), height, length, depth)
+           && measureFlat(compound->getRHS(), height + 1, length, depth);
+}
+
+static void emitFlat(Expression *exp, FlatOp *&out) {
+    switch (exp->getType()) {
+        case CONSTANT:
+            *out++ = {FLAT_CONST, ((ConstantExp *) exp)->getValue()};
+            return;
+        case IDENTIFIER:
+            *out++ = {FLAT_LOAD, ((IdentifierExp *) exp)->getSlot()};
+            return;
+        case NEGATE:
+            emitFlat(((NegateExp *) exp)->getOperand(), out);
+            *out++ = {FLAT_NEG, 0};
+            return;
+        default:
+            break;
+    }
+    CompoundExp *compound = (CompoundExp *) exp;
+    FlatOpCode code = FLAT_ADD;
+    flatOperator(compound->getOp(), code);
+    if (code == FLAT_ASSIGN) {
+        emitFlat(compound->getRHS(), out);
+        *out++ = {FLAT_ASSIGN, ((IdentifierExp *) compound->getLHS())->getSlot()};
+        return;
+    }
+    emitFlat(compound->getLHS(), out);
+    emitFlat(compound->getRHS(), out);
+    *out++ = {code, 0};
+}
+
+Expression *FlatExp::flatten(Expression *tree, Arena &arena) {
+    if (tree->getType() != COMPOUND && tree->getType() != NEGATE) return tree;
+    int length = 0;
+    int depth = 0;
+    if (!measureFlat(tree, 0, length, depth)) return tree;
+    FlatOp *code = static_cast<FlatOp *>(arena.allocate(length * sizeof(FlatOp), alignof(FlatOp)));
+    FlatOp *out = code;
+    emitFlat(tree, out);
+    return new (arena) FlatExp(code, length, depth);
+}
+
+FlatExp::FlatExp(const FlatOp *code, int length, int depth) {
+    this->code = code;
+    this->length = length;
+    this->depth = depth;
+}
+
+EvalResult FlatExp::evaluate(EvalState &state) {
+    int local[16];
+    std::vector<int> spill;
+    int *sp = local;
+    if (depth > 16) {
+        spill.resize(depth);
+        sp = spill.data();
+    }
+    for (const FlatOp *ip = code, *end = code + length; ip != end; ip++) {
+        switch (ip->op) {
+            case FLAT_CONST:
+                *sp++ = ip->operand;
+                break;
+            case FLAT_LOAD:
+                if (!state.isDefined(ip->operand)) return {0, ERR_VARIABLE_NOT_DEFINED};
+                *sp++ = state.getValue(ip->operand);
+                break;
+            case FLAT_ASSIGN:
+                state.setValue(ip->operand, sp[-1]);
+                break;
+            case FLAT_ADD:
+                sp--;
+                sp[-1] = sp[-1] + *sp;
+                break;
+            case FLAT_SUB:
+                sp--;
+                sp[-1] = sp[-1] - *sp;
+                break;
+            case FLAT_MUL:
+                sp--;
+                sp[-1] = sp[-1] * *sp;
+                break;
+            case FLAT_DIV:
+                sp--;
+                if (*sp == 0) return {0, ERR_DIVIDE_BY_ZERO};
+                sp[-1] = sp[-1] / *sp;
+                break;
+            case FLAT_NEG:
+                sp[-1] = 0 - sp[-1];
+                break;
+        }
+    }
+    return {sp[-1], ERR_NONE};
+}
+
+/*
+ * Implementation notes: toString
+ * ------------------------------
+ * The decompiler replays the code on a stack of strings, rebuilding
+ * the parenthesized text that CompoundExp::toString produces.
+ */
+
+std::string FlatExp::toString() {
+    std::vector<std::string> stack;
+    for (int i = 0; i < length; i++) {
+        const FlatOp &ins = code[i];
+        switch (ins.op) {
+            case FLAT_CONST:
+                stack.push_back(integerToString(ins.operand));
+                break;
+            case FLAT_LOAD:
+                stack.push_back(getSymbolName(ins.operand));
+                break;
+            case FLAT_ASSIGN:
+                stack.back() = "(" + getSymbolName(ins.operand) + " = " + stack.back() + ")";
+                break;
+            case FLAT_NEG:
+                stack.back() = "(-" + stack.back() + ")";
+                break;
+            default: {
+                std::string rhs = stack.back();
+                stack.pop_back();
+                stack.back() = "(" + stack.back() + " " + FLAT_OPERATORS[ins.op] + " " + rhs + ")";
+                break;
+            }
+        }
+    }
+    return stack.back();
+}
+
+ExpressionType FlatExp::getType() {
+    return FLAT;
+}
+
+const FlatOp *FlatExp::getCode() {
+    return code;
+}
+
+int FlatExp::getLength() {
+    return length;
+}
+
+/*
+ * Implementation notes: relations
+ * -------------------------------
+ * The names are indexed by relation, for toString.
+ */
+
+static const char *const RELATION_NAMES[] = {"=", "<>", "<", "<=", ">", ">="};
+
+bool compare(Relation relation, int lhs, int rhs) {
+    switch (relation) {
+        case REL_EQ: return lhs == rhs;
+        case REL_NE: return lhs != rhs;
+        case REL_LT: return lhs < rhs;
+        case REL_LE: return lhs <= rhs;
+        case REL_GT: return lhs > rhs;
+        case REL_GE: return lhs >= rhs;
+    }
+    return false;
+}
+
+Relation negateRelation(Relation relation) {
+    switch (relation) {
+        case REL_EQ: return REL_NE;
+        case REL_NE: return REL_EQ;
+        case REL_LT: return REL_GE;
+        case REL_LE: return REL_GT;
+        case REL_GT: return REL_LE;
+        case REL_GE: return REL_LT;
+    }
+    return relation;
+}
+
+Relation mirrorRelation(Relation relation) {
+    switch (relation) {
+        case REL_LT: return REL_GT;
+        case REL_LE: return REL_GE;
+        case REL_GT: return REL_LT;
+        case REL_GE: return REL_LE;
+        default: return relation;
+    }
+}
+
+/*
+ * Implementation notes: the Condition class
+ * -----------------------------------------
+ * A node is either a relation, which uses lhs and rhs, or an AND or
+ * OR, which uses first and second; the unused fields stay null.
+ */
+
+Condition::Condition(Relation relation, Expression *lhs, Expression *rhs) {
+    this->type = RELATION;
+    this->relation = relation;
+    this->lhs = lhs;
+    this->rhs = rhs;
+}
+
+Condition::Condition(ConditionType type, Condition *first, Condition *second) {
+    this->type = type;
+    this->first = first;
+    this->second = second;
+}
+
+EvalResult Condition::evaluate(EvalState &state) {
+    if (type == RELATION) {
+        EvalResult left = lhs->evaluate(state);
+        if (left.error != ERR_NONE) return left;
+        EvalResult right = rhs->evaluate(state);
+        if (right.error != ERR_NONE) return right;
+        return {compare(relation, left.value, right.value), ERR_NONE};
+    }
+    EvalResult result = first->evaluate(state);
+    if (result.error != ERR_NONE || result.value == (type == DISJUNCTION)) return result;
+    return second->evaluate(state);
+}
+
+bool Condition::test(EvalState &state) {
+    EvalResult result = evaluate(state);
+    if (result.error != ERR_NONE) error(result.error);
+    return result.value != 0;
+}
+
+std::string Condition::toString() {
+    if (type == RELATION) {
+        return '(' + lhs->toString() + ' ' + RELATION_NAMES[relation] + ' ' + rhs->toString() + ')';
+    }
+    std::string op = type == CONJUNCTION ? " AND " : " OR ";
+    return '(' + first->toString() + op + second->toString() + ')';
+}
+
+ConditionType Condition::getType() {
+    return type;
+}
+
+Relation Condition::getRelation() {
+    return relation;
+}
+
+Expression *Condition::getLHS() {
+    return lhs;
+}
+
+Expression *Condition::getRHS() {
+    return rhs;
+}
+
+Condition *Condition::getFirst() {
+    return first;
+}
+
+Condition *Condition::getSecond() {
+    return second;
+}
+
+Condition *Condition::negate(Arena &arena) {
+    if (type == RELATION) {
+        return new (arena) Condition(negateRelation(relation), lhs, rhs);
+    }
+    ConditionType opposite = type == CONJUNCTION ? DISJUNCTION : CONJUNCTION;
+    return new (arena) Condition(opposite, first->negate(arena), second->negate(arena));
+}
+
+Condition *Condition::flatten(Arena &arena) {
+    if (type == RELATION) {
+        return new (arena) Condition(relation, FlatExp::flatten(lhs, arena), FlatExp::flatten(rhs, arena));
+    }
+    return new (arena) Condition(type, first->flatten(arena), second->flatten(arena));
+}
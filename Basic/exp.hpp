@@ -14,15 +14,31 @@
 #include "evalstate.hpp"
 #include "Utils/strlib.hpp"
 
+class Arena;
+
+/*
+ * Type: EvalResult
+ * ----------------
+ * The outcome of an evaluation: value holds the result when error is
+ * ERR_NONE and is meaningless otherwise.  The pair fits in a single
+ * register, so returning it costs no more than returning the value.
+ */
+
+struct EvalResult {
+    int value;
+    ErrorCode error;
+};
+
 /*
  * Type: ExpressionType
  * --------------------
- * This enumerated type is used to differentiate the three different
- * expression types: CONSTANT, IDENTIFIER, and COMPOUND.
+ * This enumerated type is used to differentiate the expression types:
+ * CONSTANT, IDENTIFIER, COMPOUND, and NEGATE for the nodes of a tree,
+ * and FLAT for a tree that has been flattened into a FlatExp.
  */
 
 enum ExpressionType {
-    CONSTANT, IDENTIFIER, COMPOUND
+    CONSTANT, IDENTIFIER, COMPOUND, NEGATE, FLAT
 };
 
 /*
@@ -31,12 +47,14 @@ enum ExpressionType {
  * This class is used to represent a node in an expression tree.
  * Expression is an example of an abstract class, which defines
  * the structure and behavior of a set of classes but has no
- * objects of its own.  Any object must be one of the three
+ * objects of its own.  Any object must be one of the five
  * concrete subclasses of Expression:
  *
  *  1. ConstantExp   -- an integer constant
  *  2. IdentifierExp -- a string representing an identifier
  *  3. CompoundExp   -- two expressions combined by an operator
+ *  4. NegateExp     -- the negation of a subexpression
+ *  5. FlatExp       -- a whole tree compiled to postfix code
  *
  * The Expression class defines the interface common to all
  * Expression objects; each subclass provides its own specific
@@ -63,24 +81,35 @@ public:
 
 /*
  * Destructor: ~Expression
- * Usage: delete exp;
- * ------------------
- * The destructor deallocates the storage for this expression.
- * It must be declared virtual to ensure that the correct subclass
- * destructor is called when deleting an expression.
+ * -----------------------
+ * Expression nodes are allocated in an Arena and released with it,
+ * so their destructors are never run and no node owns memory of its
+ * own.  The destructor stays virtual for the benefit of subclasses.
  */
 
     virtual ~Expression();
 
+/*
+ * Method: evaluate
+ * Usage: EvalResult result = exp->evaluate(state);
+ * ------------------------------------------------
+ * Evaluates this expression in the context of the specified EvalState
+ * object.  A runtime error stops the evaluation and is returned in the
+ * result instead of being thrown; assignments made before it stay in
+ * place.
+ */
+
+    virtual EvalResult evaluate(EvalState &state) = 0;
+
 /*
  * Method: eval
  * Usage: int value = exp->eval(state);
  * ------------------------------------
- * Evaluates this expression and returns its value in the context of
- * the specified EvalState object.
+ * Evaluates this expression and returns its value, raising a runtime
+ * error with error().
  */
 
-    virtual int eval(EvalState &state) = 0;
+    int eval(EvalState &state);
 
 /*
  * Method: toString
@@ -96,7 +125,7 @@ public:
  * Usage: ExpressionType type = exp->getType();
  * --------------------------------------------
  * Returns the type of the expression, which must be one of the constants
- * CONSTANT, IDENTIFIER, or COMPOUND.
+ * CONSTANT, IDENTIFIER, COMPOUND, NEGATE, or FLAT.
  */
 
     virtual ExpressionType getType() = 0;
@@ -115,8 +144,8 @@ public:
 
 /*
  * Constructor: ConstantExp
- * Usage: Expression *exp = new ConstantExp(value);
- * ------------------------------------------------
+ * Usage: Expression *exp = new (arena) ConstantExp(value);
+ * --------------------------------------------------------
  * The constructor initializes a new integer constant expression
  * to the given value.
  */
@@ -130,7 +159,7 @@ public:
  * base class and don't require additional documentation.
  */
 
-    virtual int eval(EvalState &state);
+    virtual EvalResult evaluate(EvalState &state);
 
     virtual std::string toString();
 
@@ -164,8 +193,8 @@ public:
 
 /*
  * Constructor: IdentifierExp
- * Usage: Expression *exp = new IdentifierExp(name);
- * -------------------------------------------------
+ * Usage: Expression *exp = new (arena) IdentifierExp(name);
+ * ---------------------------------------------------------
  * The constructor initializes a new identifier expression
  * for the variable named by name.
  */
@@ -179,7 +208,7 @@ public:
  * base class and don't require additional documentation.
  */
 
-    virtual int eval(EvalState &state);
+    virtual EvalResult evaluate(EvalState &state);
 
     virtual std::string toString();
 
@@ -195,9 +224,18 @@ public:
 
     std::string getName();
 
+/*
+ * Method: getSlot
+ * Usage: int slot = ((IdentifierExp *) exp)->getSlot();
+ * -----------------------------------------------------
+ * Returns the slot the name was interned to when the node was built.
+ */
+
+    int getSlot();
+
 private:
 
-    std::string name;
+    int slot;
 
 };
 
@@ -214,8 +252,8 @@ public:
 
 /*
  * Constructor: CompoundExp
- * Usage: Expression *exp = new CompoundExp(op, lhs, rhs);
- * -------------------------------------------------------
+ * Usage: Expression *exp = new (arena) CompoundExp(op, lhs, rhs);
+ * ---------------------------------------------------------------
  * The constructor initializes a new compound expression
  * which is composed of the operator (op) and the left and
  * right subexpression (lhs and rhs).
@@ -230,9 +268,7 @@ public:
  * base class and don't require additional documentation.
  */
 
-    virtual ~CompoundExp();
-
-    virtual int eval(EvalState &state);
+    virtual EvalResult evaluate(EvalState &state);
 
     virtual std::string toString();
 
@@ -256,9 +292,287 @@ public:
 
 private:
 
-    std::string op;
+    const std::string *op;
     Expression *lhs, *rhs;
 
 };
 
+/*
+ * Class: NegateExp
+ * ----------------
+ * This subclass represents a unary minus applied to a subexpression.
+ * It evaluates to 0 - operand, which is what the parser produced for
+ * a leading minus before this node existed.
+ */
+
+class NegateExp : public Expression {
+
+public:
+
+/*
+ * Constructor: NegateExp
+ * Usage: Expression *exp = new (arena) NegateExp(operand);
+ * --------------------------------------------------------
+ * The constructor initializes a new negation of operand.
+ */
+
+    NegateExp(Expression *operand);
+
+    virtual EvalResult evaluate(EvalState &state);
+
+    virtual std::string toString();
+
+    virtual ExpressionType getType();
+
+/*
+ * Method: getOperand
+ * Usage: Expression *operand = ((NegateExp *) exp)->getOperand();
+ * ---------------------------------------------------------------
+ * Returns the negated subexpression and can be applied only to an
+ * object known to be a NegateExp.
+ */
+
+    Expression *getOperand();
+
+private:
+
+    Expression *operand;
+
+};
+
+/*
+ * Type: FlatOpCode
+ * ----------------
+ * The operations of a flattened expression.  FLAT_CONST pushes its
+ * operand, FLAT_LOAD pushes the variable in the operand slot and
+ * FLAT_ASSIGN stores the top of the stack into it, leaving the value
+ * in place; the arithmetic operations pop two values and push one, and
+ * FLAT_NEG negates the top of the stack.
+ */
+
+enum FlatOpCode : unsigned char {
+    FLAT_CONST, FLAT_LOAD, FLAT_ASSIGN, FLAT_ADD, FLAT_SUB, FLAT_MUL, FLAT_DIV, FLAT_NEG
+};
+
+struct FlatOp {
+    FlatOpCode op;
+    int operand;
+};
+
+/*
+ * Class: FlatExp
+ * --------------
+ * This subclass holds an expression tree compiled into one contiguous
+ * array of postfix operations.  It evaluates with a single loop over
+ * the array and a small value stack, in the same order and with the
+ * same errors as the tree it was built from, and toString decompiles
+ * the array back into the text the tree would have produced.
+ */
+
+class FlatExp : public Expression {
+
+public:
+
+/*
+ * Function: flatten
+ * Usage: Expression *exp = FlatExp::flatten(tree, arena);
+ * -------------------------------------------------------
+ * Returns a FlatExp for tree allocated in arena.  Trees that would not
+ * gain from flattening, a single constant or variable, and trees the
+ * flat form cannot express are returned unchanged.
+ */
+
+    static Expression *flatten(Expression *tree, Arena &arena);
+
+    virtual EvalResult evaluate(EvalState &state);
+
+    virtual std::string toString();
+
+    virtual ExpressionType getType();
+
+/*
+ * Methods: getCode, getLength
+ * Usage: const FlatOp *code = flat->getCode();
+ * --------------------------------------------
+ * These methods return the operation array and its length.
+ */
+
+    const FlatOp *getCode();
+
+    int getLength();
+
+private:
+
+    FlatExp(const FlatOp *code, int length, int depth);
+
+    const FlatOp *code;
+    int length;
+    int depth;
+
+};
+
+/*
+ * Type: Relation
+ * --------------
+ * The comparisons a condition can make between two integers: =, <>,
+ * <, <=, > and >=.
+ */
+
+enum Relation {
+    REL_EQ, REL_NE, REL_LT, REL_LE, REL_GT, REL_GE
+};
+
+/*
+ * Function: compare
+ * Usage: if (compare(relation, lhs, rhs)) . . .
+ * ---------------------------------------------
+ * Returns whether lhs and rhs stand in the given relation.
+ */
+
+bool compare(Relation relation, int lhs, int rhs);
+
+/*
+ * Functions: negateRelation, mirrorRelation
+ * Usage: Relation opposite = negateRelation(relation);
+ *        Relation swapped = mirrorRelation(relation);
+ * ---------------------------------------------------
+ * negateRelation returns the relation that holds exactly when the
+ * given one does not, and mirrorRelation the one that holds between
+ * the same operands written the other way around.
+ */
+
+Relation negateRelation(Relation relation);
+
+Relation mirrorRelation(Relation relation);
+
+/*
+ * Type: ConditionType
+ * -------------------
+ * The kinds of condition node: a RELATION between two expressions,
+ * and the CONJUNCTION (AND) and DISJUNCTION (OR) of two conditions.
+ */
+
+enum ConditionType {
+    RELATION, CONJUNCTION, DISJUNCTION
+};
+
+/*
+ * Class: Condition
+ * ----------------
+ * This class represents the condition of an IF statement as a tree
+ * whose leaves are relations between two expressions.  There is no
+ * node for NOT: the parser pushes a negation down to the relations
+ * with De Morgan's laws, which keeps the order in which the leaves
+ * are evaluated.  Like expressions, conditions are allocated in an
+ * Arena and own no memory.
+ */
+
+class Condition {
+
+public:
+
+/*
+ * Constructor: Condition
+ * Usage: Condition *cond = new (arena) Condition(relation, lhs, rhs);
+ *        Condition *cond = new (arena) Condition(type, first, second);
+ * --------------------------------------------------------------------
+ * The first form builds a RELATION between lhs and rhs, the second a
+ * CONJUNCTION or DISJUNCTION of first and second.
+ */
+
+    Condition(Relation relation, Expression *lhs, Expression *rhs);
+
+    Condition(ConditionType type, Condition *first, Condition *second);
+
+/*
+ * Method: evaluate
+ * Usage: EvalResult result = cond->evaluate(state);
+ * -------------------------------------------------
+ * Evaluates the condition in the context of state, giving a value of
+ * 1 if it holds and 0 if not.  A relation evaluates its left operand
+ * and then its right; AND and OR evaluate their second condition only
+ * when the first does not decide the result.  Runtime errors are
+ * returned as for Expression::evaluate.
+ */
+
+    EvalResult evaluate(EvalState &state);
+
+/*
+ * Method: test
+ * Usage: if (cond->test(state)) . . .
+ * -----------------------------------
+ * Evaluates the condition like evaluate, raising a runtime error with
+ * error().
+ */
+
+    bool test(EvalState &state);
+
+/*
+ * Method: toString
+ * Usage: string str = cond->toString();
+ * -------------------------------------
+ * Returns a fully parenthesized string representation of the
+ * condition.
+ */
+
+    std::string toString();
+
+    ConditionType getType();
+
+/*
+ * Methods: getRelation, getLHS, getRHS
+ * Usage: Relation relation = cond->getRelation();
+ * -----------------------------------------------
+ * These methods return the parts of a RELATION.
+ */
+
+    Relation getRelation();
+
+    Expression *getLHS();
+
+    Expression *getRHS();
+
+/*
+ * Methods: getFirst, getSecond
+ * Usage: Condition *first = cond->getFirst();
+ * -------------------------------------------
+ * These methods return the two halves of a CONJUNCTION or
+ * DISJUNCTION, in the order they are evaluated.
+ */
+
+    Condition *getFirst();
+
+    Condition *getSecond();
+
+/*
+ * Method: negate
+ * Usage: Condition *opposite = cond->negate(arena);
+ * -------------------------------------------------
+ * Returns a condition, allocated in arena, that holds exactly when
+ * this one does not and evaluates the same leaves in the same order.
+ */
+
+    Condition *negate(Arena &arena);
+
+/*
+ * Method: flatten
+ * Usage: Condition *flat = cond->flatten(arena);
+ * ----------------------------------------------
+ * Returns a copy of the condition, allocated in arena, whose operands
+ * have been passed through FlatExp::flatten.
+ */
+
+    Condition *flatten(Arena &arena);
+
+private:
+
+    ConditionType type;
+    Relation relation = REL_EQ;
+    Expression *lhs = nullptr;
+    Expression *rhs = nullptr;
+    Condition *first = nullptr;
+    Condition *second = nullptr;
+
+};
+
 #endif
@@ -0,0 +1,756 @@
+/*
+ * File: jit.cpp
+ * -------------
+ * This file implements the JIT class.
+ */
+
+#include "jit.hpp"
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include "Utils/error.hpp"
+#include "statement.hpp"
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__unix__) || defined(__APPLE__))
+#define BASIC_JIT 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+/*
+ * Type: JitFrame
+ * --------------
+ * The single argument of the generated function.  The generated code
+ * reads the first three fields and the bounds of the return stack and
+ * writes exitOperand at fixed offsets, so the layout must not change.
+ * The return stack holds the native addresses that RETURN jumps to.
+ */
+
+struct JitFrame
+{
+  int *slots;
+  std::uint64_t *defined;
+  int *stack;
+  std::string *message;
+  int exitOperand;
+  const void **calls;
+  const void **callsEnd;
+};
+
+/*
+ * The generated function returns a VMStatus, or JIT_HELPER_ERROR when
+ * a runtime helper caught an ErrorException whose message it stored in
+ * JitFrame::message.
+ */
+
+static const int JIT_HELPER_ERROR = -1;
+
+typedef int (*JitFunction)(JitFrame *frame);
+
+static void jitPrint(int value) { std::cout << value << "\n"; }
+
+/*
+ * Implementation notes: jitInput
+ * ------------------------------
+ * C++ exceptions cannot unwind through generated code, which has no
+ * unwind tables, so an error raised while reading input is caught here
+ * and turned into a status.
+ */
+
+static int jitInput(JitFrame *frame, int slot)
+{
+  try
+  {
+    frame->slots[slot] = readInputValue();
+    markSlot(frame->defined, slot);
+    return 0;
+  }
+  catch (ErrorException &ex)
+  {
+    *frame->message = ex.getMessage();
+    return 1;
+  }
+}
+
+#if defined(BASIC_JIT)
+
+enum X64Register
+{
+  RAX = 0,
+  RCX = 1,
+  RDX = 2,
+  RBX = 3,
+  RSP = 4,
+  RBP = 5,
+  RSI = 6,
+  RDI = 7,
+  R12 = 12,
+  R13 = 13,
+  R14 = 14,
+  R15 = 15
+};
+
+/*
+ * Class: X64Emitter
+ * -----------------
+ * Appends x86-64 machine code to a byte buffer.  Only the handful of
+ * encodings the templates need are provided; memory operands always
+ * use the [base + disp32] form.
+ */
+
+class X64Emitter
+{
+public:
+  std::vector<std::uint8_t> bytes;
+
+  int here() const { return static_cast<int>(bytes.size()); }
+
+  void byte(std::uint8_t value) { bytes.push_back(value); }
+
+  void dword(std::int32_t value)
+  {
+    std::uint32_t bits = static_cast<std::uint32_t>(value);
+    for (int i = 0; i < 4; i++)
+      byte(static_cast<std::uint8_t>(bits >> (8 * i)));
+  }
+
+  void qword(std::uint64_t value)
+  {
+    for (int i = 0; i < 8; i++)
+      byte(static_cast<std::uint8_t>(value >> (8 * i)));
+  }
+
+  /*
+   * Emits opcode with a ModRM operand of the form reg, [base + disp].
+   * For group opcodes reg holds the opcode extension.
+   */
+
+  void mem(std::initializer_list<std::uint8_t> opcode, int reg, int base, int disp, bool wide = false)
+  {
+    std::uint8_t rex = 0x40 | (wide ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((base & 8) ? 0x01 : 0);
+    if (rex != 0x40)
+      byte(rex);
+    for (std::uint8_t op : opcode)
+      byte(op);
+    byte(static_cast<std::uint8_t>(0x80 | ((reg & 7) << 3) | (base & 7)));
+    if ((base & 7) == RSP)
+      byte(0x24);
+    dword(disp);
+  }
+
+  void movImm(int reg, std::int32_t value)
+  {
+    byte(static_cast<std::uint8_t>(0xB8 + reg));
+    dword(value);
+  }
+
+  void callAbsolute(const void *target)
+  {
+    byte(0x48);
+    byte(0xB8);
+    qword(reinterpret_cast<std::uint64_t>(target));
+    byte(0xFF);
+    byte(0xD0);
+  }
+
+  /*
+   * Emits a jmp (cc < 0) or jcc rel32 and returns the position of the
+   * displacement so it can be patched once the target is known.
+   */
+
+  int jump(int cc = -1)
+  {
+    if (cc < 0)
+    {
+      byte(0xE9);
+    }
+    else
+    {
+      byte(0x0F);
+      byte(static_cast<std::uint8_t>(0x80 | cc));
+    }
+    dword(0);
+    return here() - 4;
+  }
+
+  void patch(int at, int target)
+  {
+    std::int32_t rel = target - (at + 4);
+    std::memcpy(&bytes[at], &rel, 4);
+  }
+};
+
+static const int CC_NOT_CARRY = 0x3;
+static const int CC_EQUAL = 0x4;
+static const int CC_NOT_EQUAL = 0x5;
+static const int CC_LESS = 0xC;
+static const int CC_GREATER_EQUAL = 0xD;
+static const int CC_LESS_EQUAL = 0xE;
+static const int CC_GREATER = 0xF;
+
+/*
+ * The condition of each of OP_JUMP_EQ through OP_JUMP_GE, in opcode
+ * order.
+ */
+
+static const int JUMP_CONDITIONS[] = {CC_EQUAL, CC_NOT_EQUAL, CC_LESS, CC_LESS_EQUAL, CC_GREATER, CC_GREATER_EQUAL};
+
+static int stackEffect(OpCode op)
+{
+  switch (op)
+  {
+    case OP_CONST:
+    case OP_LOAD:
+      return 1;
+    case OP_STORE:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_PRINT:
+      return -1;
+    case OP_ON_GOTO:
+    case OP_ON_GOSUB:
+      return -1;
+    case OP_JUMP_EQ:
+    case OP_JUMP_NE:
+    case OP_JUMP_LT:
+    case OP_JUMP_LE:
+    case OP_JUMP_GT:
+    case OP_JUMP_GE:
+      return -2;
+    default:
+      return 0;
+  }
+}
+
+/*
+ * Returns k if value is 2^k for some k from 1 to 30, and 0 otherwise.
+ */
+
+static int powerOfTwo(int value)
+{
+  for (int k = 1; k <= 30; k++)
+  {
+    if (value == 1 << k)
+      return k;
+  }
+  return 0;
+}
+
+/*
+ * Implementation notes: translateMulConst
+ * ---------------------------------------
+ * A multiplication by 2^k is a left shift in place; any other constant
+ * uses the three-operand imul with an immediate.
+ */
+
+static void translateMulConst(X64Emitter &x, int value, int top)
+{
+  int k = powerOfTwo(value);
+  if (k > 0)
+  {
+    x.mem({0xC1}, 4, R13, top);
+    x.byte(static_cast<std::uint8_t>(k));
+    return;
+  }
+  x.mem({0x69}, RAX, R13, top);
+  x.dword(value);
+  x.mem({0x89}, RAX, R13, top);
+}
+
+/*
+ * Implementation notes: translateDivConst
+ * ---------------------------------------
+ * Division by 2^k adds 2^k - 1 to a negative dividend before the
+ * arithmetic shift, so the shift truncates toward zero like idiv:
+ *
+ *   mov eax, [top]; cdq; shr edx, 32 - k; add eax, edx; sar eax, k
+ *
+ * Any other divisor follows divideByMagic: the 64-bit product of the
+ * sign-extended dividend and the multiplier is shifted down to its
+ * high half, adjusted, shifted by the magic shift (folded into the
+ * first shift when there is no adjustment), and rounded toward zero
+ * by adding its own sign bit.
+ */
+
+static void translateDivConst(X64Emitter &x, const DivMagic &magic, int top)
+{
+  int k = powerOfTwo(magic.divisor);
+  if (k > 0)
+  {
+    x.mem({0x8B}, RAX, R13, top);
+    x.byte(0x99);
+    x.byte(0xC1);
+    x.byte(0xEA);
+    x.byte(static_cast<std::uint8_t>(32 - k));
+    x.byte(0x01);
+    x.byte(0xD0);
+    x.byte(0xC1);
+    x.byte(0xF8);
+    x.byte(static_cast<std::uint8_t>(k));
+    x.mem({0x89}, RAX, R13, top);
+    return;
+  }
+  x.mem({0x63}, RAX, R13, top, true);
+  x.byte(0x48);
+  x.byte(0x69);
+  x.byte(0xD0);
+  x.dword(magic.multiplier);
+  x.byte(0x48);
+  x.byte(0xC1);
+  x.byte(0xFA);
+  if (magic.adjust == 0)
+  {
+    x.byte(static_cast<std::uint8_t>(32 + magic.shift));
+  }
+  else
+  {
+    x.byte(32);
+    x.byte(magic.adjust > 0 ? 0x01 : 0x29);
+    x.byte(0xC2);
+    if (magic.shift > 0)
+    {
+      x.byte(0xC1);
+      x.byte(0xFA);
+      x.byte(static_cast<std::uint8_t>(magic.shift));
+    }
+  }
+  x.byte(0x89);
+  x.byte(0xD0);
+  x.byte(0xC1);
+  x.byte(0xE8);
+  x.byte(0x1F);
+  x.byte(0x01);
+  x.byte(0xC2);
+  x.mem({0x89}, RDX, R13, top);
+}
+
+/*
+ * Implementation notes: translate
+ * -------------------------------
+ * Register assignment inside the generated function:
+ *
+ *   rbx  variable slots      r12  defined-bitset
+ *   r13  operand stack       r14  the JitFrame
+ *   r15  one past the top of the return stack
+ *
+ * The bitset is addressed as 32-bit words, which on x86 hold the same
+ * bits as the 64-bit words EvalState uses, so bt and bts can test and
+ * set a slot with an immediate bit offset.
+ *
+ * The prologue saves these five, which leaves rsp 16-byte aligned for
+ * the helper calls.  A GOSUB stores the native address of the next
+ * instruction, taken with a RIP-relative lea that is patched like a
+ * jump, so a RETURN is a compare, a decrement and an indirect jump.
+ *
+ * An ON indexes a table of 32-bit displacements laid out after the
+ * epilogue, each relative to the end of its own entry, which is what
+ * a patched jump holds, so the entries are fixed up with the jumps:
+ *
+ *   mov eax, [top]; sub eax, 1; cmp eax, n; jae next
+ *   lea rcx, [table]; lea rcx, [rcx + 4 * rax]; movsxd rax, [rcx]
+ *   lea rax, [rcx + rax + 4]; jmp rax
+ *
+ * An entry for a missing line leads to the LINE NUMBER ERROR stub; for
+ * ON . . . GOSUB, which must not push a return address first, such
+ * choices are compared against before the lookup.  Stack slot i is
+ * the memory at [r13 + 4 * i]; the depth before every instruction is
+ * computed here, and resets to 0 after an unconditional transfer
+ * because every jump the compiler emits lands where the operand stack
+ * is empty.
+ */
+
+static void translate(const Chunk &chunk, X64Emitter &x)
+{
+  struct Fixup
+  {
+    int at;
+    int target;
+  };
+  struct Table
+  {
+    int at;
+    int first;
+    int count;
+  };
+  const int n = static_cast<int>(chunk.code.size());
+  std::vector<int> offset(n, 0);
+  std::vector<Fixup> fixups;
+  std::vector<Table> tables;
+  std::vector<int> undefined_jumps, divide_jumps, input_jumps, overflow_jumps, underflow_jumps, line_jumps, exit_jumps;
+
+  x.byte(0x53);
+  x.byte(0x41);
+  x.byte(0x54);
+  x.byte(0x41);
+  x.byte(0x55);
+  x.byte(0x41);
+  x.byte(0x56);
+  x.byte(0x41);
+  x.byte(0x57);
+  x.byte(0x49);
+  x.byte(0x89);
+  x.byte(0xFE);
+  x.mem({0x8B}, RBX, RDI, 0, true);
+  x.mem({0x8B}, R12, RDI, 8, true);
+  x.mem({0x8B}, R13, RDI, 16, true);
+  x.mem({0x8B}, R15, RDI, 40, true);
+
+  auto checkDefined = [&](int slot) {
+    x.mem({0x0F, 0xBA}, 4, R12, 4 * (slot >> 5));
+    x.byte(static_cast<std::uint8_t>(slot & 31));
+    undefined_jumps.push_back(x.jump(CC_NOT_CARRY));
+  };
+
+  int depth = 0;
+  for (int pc = 0; pc < n; pc++)
+  {
+    const Instruction &ins = chunk.code[pc];
+    offset[pc] = x.here();
+    int top = 4 * (depth - 1);
+    int next = 4 * (depth - 2);
+    switch (ins.op)
+    {
+      case OP_CONST:
+        x.mem({0xC7}, 0, R13, 4 * depth);
+        x.dword(ins.operand);
+        break;
+      case OP_LOAD:
+        checkDefined(ins.operand);
+        x.mem({0x8B}, RAX, RBX, 4 * ins.operand);
+        x.mem({0x89}, RAX, R13, 4 * depth);
+        break;
+      case OP_STORE:
+      case OP_ASSIGN:
+        x.mem({0x8B}, RAX, R13, top);
+        x.mem({0x89}, RAX, RBX, 4 * ins.operand);
+        x.mem({0x0F, 0xBA}, 5, R12, 4 * (ins.operand >> 5));
+        x.byte(static_cast<std::uint8_t>(ins.operand & 31));
+        break;
+      case OP_ADD:
+        x.mem({0x8B}, RAX, R13, next);
+        x.mem({0x03}, RAX, R13, top);
+        x.mem({0x89}, RAX, R13, next);
+        break;
+      case OP_SUB:
+        x.mem({0x8B}, RAX, R13, next);
+        x.mem({0x2B}, RAX, R13, top);
+        x.mem({0x89}, RAX, R13, next);
+        break;
+      case OP_MUL:
+        x.mem({0x8B}, RAX, R13, next);
+        x.mem({0x0F, 0xAF}, RAX, R13, top);
+        x.mem({0x89}, RAX, R13, next);
+        break;
+      case OP_DIV:
+        x.mem({0x8B}, RCX, R13, top);
+        x.byte(0x85);
+        x.byte(0xC9);
+        divide_jumps.push_back(x.jump(CC_EQUAL));
+        x.mem({0x8B}, RAX, R13, next);
+        x.byte(0x99);
+        x.byte(0xF7);
+        x.byte(0xF9);
+        x.mem({0x89}, RAX, R13, next);
+        break;
+      case OP_ADD_CONST:
+        x.mem({0x81}, 0, R13, top);
+        x.dword(ins.operand);
+        break;
+      case OP_MUL_CONST:
+        translateMulConst(x, ins.operand, top);
+        break;
+      case OP_DIV_CONST:
+        translateDivConst(x, chunk.divisors[ins.operand], top);
+        break;
+      case OP_PRINT:
+        x.mem({0x8B}, RDI, R13, top);
+        x.callAbsolute(reinterpret_cast<const void *>(&jitPrint));
+        break;
+      case OP_INPUT:
+        x.byte(0x4C);
+        x.byte(0x89);
+        x.byte(0xF7);
+        x.movImm(RSI, ins.operand);
+        x.callAbsolute(reinterpret_cast<const void *>(&jitInput));
+        x.byte(0x85);
+        x.byte(0xC0);
+        input_jumps.push_back(x.jump(CC_NOT_EQUAL));
+        break;
+      case OP_JUMP:
+        fixups.push_back({x.jump(), ins.operand});
+        break;
+      case OP_JUMP_EQ:
+      case OP_JUMP_NE:
+      case OP_JUMP_LT:
+      case OP_JUMP_LE:
+      case OP_JUMP_GT:
+      case OP_JUMP_GE:
+        x.mem({0x8B}, RAX, R13, next);
+        x.mem({0x3B}, RAX, R13, top);
+        fixups.push_back({x.jump(JUMP_CONDITIONS[ins.op - OP_JUMP_EQ]), ins.operand});
+        break;
+      case OP_LINE_ERROR:
+        x.movImm(RAX, VM_LINE_NUMBER_ERROR);
+        exit_jumps.push_back(x.jump());
+        break;
+      case OP_HALT:
+        x.movImm(RAX, VM_HALT);
+        exit_jumps.push_back(x.jump());
+        break;
+      case OP_EXIT:
+        x.mem({0xC7}, 0, R14, 32);
+        x.dword(ins.operand);
+        x.movImm(RAX, VM_EXIT);
+        exit_jumps.push_back(x.jump());
+        break;
+      case OP_GOSUB:
+        x.mem({0x3B}, R15, R14, 48, true);
+        overflow_jumps.push_back(x.jump(CC_EQUAL));
+        x.byte(0x48);
+        x.byte(0x8D);
+        x.byte(0x05);
+        x.dword(0);
+        fixups.push_back({x.here() - 4, pc + 1});
+        x.mem({0x89}, RAX, R15, 0, true);
+        x.byte(0x49);
+        x.byte(0x83);
+        x.byte(0xC7);
+        x.byte(0x08);
+        fixups.push_back({x.jump(), ins.operand});
+        break;
+      case OP_RETURN:
+        x.mem({0x3B}, R15, R14, 40, true);
+        underflow_jumps.push_back(x.jump(CC_EQUAL));
+        x.byte(0x49);
+        x.byte(0x83);
+        x.byte(0xEF);
+        x.byte(0x08);
+        x.mem({0xFF}, 4, R15, 0);
+        break;
+      case OP_ON_GOTO:
+      case OP_ON_GOSUB:
+        x.mem({0x8B}, RAX, R13, top);
+        x.byte(0x83);
+        x.byte(0xE8);
+        x.byte(0x01);
+        x.byte(0x3D);
+        x.dword(ins.a);
+        fixups.push_back({x.jump(CC_NOT_CARRY), pc + 1});
+        for (int choice = 0; choice < ins.a && ins.op == OP_ON_GOSUB; choice++)
+        {
+          if (chunk.targets[ins.operand + choice] >= 0)
+            continue;
+          x.byte(0x3D);
+          x.dword(choice);
+          line_jumps.push_back(x.jump(CC_EQUAL));
+        }
+        x.byte(0x48);
+        x.byte(0x8D);
+        x.byte(0x0D);
+        x.dword(0);
+        tables.push_back({x.here() - 4, ins.operand, ins.a});
+        x.byte(0x48);
+        x.byte(0x8D);
+        x.byte(0x0C);
+        x.byte(0x81);
+        x.byte(0x48);
+        x.byte(0x63);
+        x.byte(0x01);
+        x.byte(0x48);
+        x.byte(0x8D);
+        x.byte(0x44);
+        x.byte(0x01);
+        x.byte(0x04);
+        if (ins.op == OP_ON_GOSUB)
+        {
+          x.mem({0x3B}, R15, R14, 48, true);
+          overflow_jumps.push_back(x.jump(CC_EQUAL));
+          x.byte(0x48);
+          x.byte(0x8D);
+          x.byte(0x15);
+          x.dword(0);
+          fixups.push_back({x.here() - 4, pc + 1});
+          x.mem({0x89}, RDX, R15, 0, true);
+          x.byte(0x49);
+          x.byte(0x83);
+          x.byte(0xC7);
+          x.byte(0x08);
+        }
+        x.byte(0xFF);
+        x.byte(0xE0);
+        break;
+      case OP_INC:
+        checkDefined(ins.operand);
+        x.mem({0x81}, 0, RBX, 4 * ins.operand);
+        x.dword(ins.a);
+        break;
+      case OP_JUMP_EQ_CONST:
+      case OP_JUMP_LT_CONST:
+      case OP_JUMP_GT_CONST:
+        checkDefined(ins.a);
+        x.mem({0x81}, 7, RBX, 4 * ins.a);
+        x.dword(ins.b);
+        fixups.push_back({x.jump(ins.op == OP_JUMP_EQ_CONST  ? CC_EQUAL
+                                 : ins.op == OP_JUMP_LT_CONST ? CC_LESS
+                                                              : CC_GREATER),
+                          ins.operand});
+        break;
+      case OP_JUMP_EQ_VARS:
+      case OP_JUMP_LT_VARS:
+      case OP_JUMP_GT_VARS:
+        checkDefined(ins.a);
+        checkDefined(ins.b);
+        x.mem({0x8B}, RAX, RBX, 4 * ins.a);
+        x.mem({0x3B}, RAX, RBX, 4 * ins.b);
+        fixups.push_back({x.jump(ins.op == OP_JUMP_EQ_VARS  ? CC_EQUAL
+                                 : ins.op == OP_JUMP_LT_VARS ? CC_LESS
+                                                             : CC_GREATER),
+                          ins.operand});
+        break;
+      case OP_PRINT_VAR:
+        checkDefined(ins.operand);
+        x.mem({0x8B}, RDI, RBX, 4 * ins.operand);
+        x.callAbsolute(reinterpret_cast<const void *>(&jitPrint));
+        break;
+      case OP_NEXT_UP:
+      case OP_NEXT_DOWN:
+        x.mem({0x8B}, RAX, RBX, 4 * ins.a);
+        x.byte(0x05);
+        x.dword(ins.b);
+        x.mem({0x89}, RAX, RBX, 4 * ins.a);
+        x.mem({0x3B}, RAX, RBX, 4 * ins.c);
+        fixups.push_back({x.jump(ins.op == OP_NEXT_UP ? CC_LESS_EQUAL : CC_GREATER_EQUAL), ins.operand});
+        break;
+    }
+    depth += stackEffect(ins.op);
+    if (ins.op == OP_JUMP || ins.op == OP_LINE_ERROR || ins.op == OP_HALT || ins.op == OP_EXIT || ins.op == OP_GOSUB ||
+        ins.op == OP_RETURN)
+      depth = 0;
+  }
+
+  auto stub = [&](const std::vector<int> &jumps, int status) {
+    for (int at : jumps)
+      x.patch(at, x.here());
+    x.movImm(RAX, status);
+    exit_jumps.push_back(x.jump());
+  };
+  stub(undefined_jumps, VM_VARIABLE_NOT_DEFINED);
+  stub(divide_jumps, VM_DIVIDE_BY_ZERO);
+  stub(input_jumps, JIT_HELPER_ERROR);
+  stub(overflow_jumps, VM_GOSUB_OVERFLOW);
+  stub(underflow_jumps, VM_RETURN_WITHOUT_GOSUB);
+  int line_stub = x.here();
+  stub(line_jumps, VM_LINE_NUMBER_ERROR);
+
+  for (int at : exit_jumps)
+    x.patch(at, x.here());
+  x.byte(0x41);
+  x.byte(0x5F);
+  x.byte(0x41);
+  x.byte(0x5E);
+  x.byte(0x41);
+  x.byte(0x5D);
+  x.byte(0x41);
+  x.byte(0x5C);
+  x.byte(0x5B);
+  x.byte(0xC3);
+
+  for (const Table &table : tables)
+  {
+    while (x.here() % 4 != 0)
+      x.byte(0xCC);
+    x.patch(table.at, x.here());
+    for (int choice = 0; choice < table.count; choice++)
+    {
+      int target = chunk.targets[table.first + choice];
+      x.dword(0);
+      if (target < 0)
+        x.patch(x.here() - 4, line_stub);
+      else
+        fixups.push_back({x.here() - 4, target});
+    }
+  }
+
+  for (const Fixup &fixup : fixups)
+    x.patch(fixup.at, offset[fixup.target]);
+}
+
+#endif
+
+JIT::JIT() = default;
+
+JIT::~JIT() { release(); }
+
+bool JIT::isSupported()
+{
+#if defined(BASIC_JIT)
+  return true;
+#else
+  return false;
+#endif
+}
+
+/*
+ * Implementation notes: compile
+ * -----------------------------
+ * The pages are filled while writable and then switched to read and
+ * execute, so they are never writable and executable at once.
+ */
+
+bool JIT::compile(const Chunk &chunk)
+{
+  release();
+#if defined(BASIC_JIT)
+  X64Emitter emitter;
+  translate(chunk, emitter);
+  std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+  std::size_t length = (emitter.bytes.size() + page - 1) / page * page;
+  void *memory = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED)
+    return false;
+  std::memcpy(memory, emitter.bytes.data(), emitter.bytes.size());
+  if (mprotect(memory, length, PROT_READ | PROT_EXEC) != 0)
+  {
+    munmap(memory, length);
+    return false;
+  }
+  code = memory;
+  size = length;
+  return true;
+#else
+  return false;
+#endif
+}
+
+VMStatus JIT::run(const Chunk &chunk, EvalState &state)
+{
+  state.reserveSlots(chunk.numSlots);
+  if (stack.size() < static_cast<std::size_t>(chunk.maxStack) + 1)
+    stack.resize(chunk.maxStack + 1);
+  if (calls.size() < static_cast<std::size_t>(chunk.callDepth))
+    calls.resize(chunk.callDepth);
+  std::string message;
+  JitFrame frame = {state.getValues(), state.getDefinedBits(), stack.data(), &message, EXIT_NEXT_LINE,
+                    calls.data(),      calls.data() + chunk.callDepth};
+  int status = reinterpret_cast<JitFunction>(code)(&frame);
+  if (status == JIT_HELPER_ERROR)
+    error(message);
+  exitOperand = frame.exitOperand;
+  raiseStatus(static_cast<VMStatus>(status));
+  return static_cast<VMStatus>(status);
+}
+
+int JIT::getExit() const { return exitOperand; }
+
+void JIT::release()
+{
+#if defined(BASIC_JIT)
+  if (code != nullptr)
+    munmap(code, size);
+#endif
+  code = nullptr;
+  size = 0;
+}
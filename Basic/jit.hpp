@@ -0,0 +1,86 @@
+/*
+ * File: jit.h
+ * -----------
+ * This interface exports the JIT class, a template compiler that turns
+ * a bytecode Chunk into x86-64 machine code.  Every bytecode
+ * instruction is replaced by a fixed native sequence; the operand
+ * stack depth is known at each instruction, so stack slots become
+ * fixed memory offsets and no stack pointer is kept at run time.
+ *
+ * The JIT is only available on x86-64 systems with mmap.  It is off by
+ * default and is selected with RUN JIT or the --jit flag.
+ */
+
+#ifndef _jit_h
+#define _jit_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "bytecode.hpp"
+#include "evalstate.hpp"
+#include "vm.hpp"
+
+/*
+ * Class: JIT
+ * ----------
+ * Owns the executable pages for one compiled chunk.  The code follows
+ * the same rules as the VM: it works on the variables of the EvalState
+ * in place, and every runtime error is raised at the instruction that
+ * fails.
+ */
+
+class JIT
+{
+public:
+  JIT();
+
+  ~JIT();
+
+  JIT(const JIT &) = delete;
+
+  JIT &operator=(const JIT &) = delete;
+
+  /*
+   * Method: isSupported
+   * Usage: if (JIT::isSupported()) . . .
+   * ------------------------------------
+   * Returns true if this build can generate and run native code.
+   */
+
+  static bool isSupported();
+
+  /*
+   * Method: compile
+   * Usage: if (jit.compile(chunk)) . . .
+   * ------------------------------------
+   * Translates chunk into native code, replacing any code compiled
+   * before.  Returns false if the code could not be generated.
+   */
+
+  bool compile(const Chunk &chunk);
+
+  /*
+   * Method: run
+   * Usage: jit.run(chunk, state);
+   * -----------------------------
+   * Runs the code generated for chunk against the variables in state.
+   * Errors are raised as in VM::run; otherwise the result is VM_HALT or
+   * VM_EXIT, and getExit returns the operand of the OP_EXIT taken.
+   */
+
+  VMStatus run(const Chunk &chunk, EvalState &state);
+
+  int getExit() const;
+
+private:
+  void *code = nullptr;
+  std::size_t size = 0;
+  std::vector<int> stack;
+  std::vector<const void *> calls;
+  int exitOperand = EXIT_NEXT_LINE;
+
+  void release();
+};
+
+#endif
@@ -0,0 +1,192 @@
+/*
+ * File: optimizer.cpp
+ * -------------------
+ * This file implements the expression simplifier.
+ */
+
+#include "optimizer.hpp"
+#include <climits>
+#include <utility>
+
+
+/*
+ * Implementation notes: foldOperator
+ * ----------------------------------
+ * The arithmetic is done on unsigned values so that overflow wraps as
+ * the generated code does instead of being undefined in the compiler.
+ * Division by zero and INT_MIN / -1 fault at run time and are never
+ * folded.
+ */
+
+bool foldOperator(const std::string &op, int lhs, int rhs, int &value)
+{
+  auto a = static_cast<unsigned>(lhs);
+  auto b = static_cast<unsigned>(rhs);
+  if (op == "+")
+    value = static_cast<int>(a + b);
+  else if (op == "-")
+    value = static_cast<int>(a - b);
+  else if (op == "*")
+    value = static_cast<int>(a * b);
+  else if (op == "/" && rhs != 0 && !(lhs == INT_MIN && rhs == -1))
+    value = lhs / rhs;
+  else
+    return false;
+  return true;
+}
+
+/*
+ * Implementation notes: isPure
+ * ----------------------------
+ * A variable may be undefined and an assignment changes the state, so
+ * only constants, and arithmetic on them that cannot fault, are pure.
+ */
+
+bool isPure(Expression *exp)
+{
+  switch (exp->getType())
+  {
+    case CONSTANT:
+      return true;
+    case NEGATE:
+      return isPure(static_cast<NegateExp *>(exp)->getOperand());
+    case COMPOUND:
+      break;
+    default:
+      return false;
+  }
+  auto *compound = static_cast<CompoundExp *>(exp);
+  std::string op = compound->getOp();
+  if (op == "=")
+    return false;
+  if (op == "/")
+  {
+    Expression *rhs = compound->getRHS();
+    if (rhs->getType() != CONSTANT)
+      return false;
+    int divisor = static_cast<ConstantExp *>(rhs)->getValue();
+    if (divisor == 0 || divisor == -1)
+      return false;
+  }
+  return isPure(compound->getLHS()) && isPure(compound->getRHS());
+}
+
+static bool isConstant(Expression *exp, int value)
+{
+  return exp->getType() == CONSTANT && static_cast<ConstantExp *>(exp)->getValue() == value;
+}
+
+static Expression *simplifyNegate(Expression *operand, Arena &arena)
+{
+  if (operand->getType() == CONSTANT)
+  {
+    int value = static_cast<ConstantExp *>(operand)->getValue();
+    foldOperator("-", 0, value, value);
+    return new (arena) ConstantExp(value);
+  }
+  if (operand->getType() == NEGATE)
+    return static_cast<NegateExp *>(operand)->getOperand();
+  return new (arena) NegateExp(operand);
+}
+
+/*
+ * Implementation notes: simplifyExp
+ * ---------------------------------
+ * The children are simplified first, so every rule below sees operands
+ * that are already as small as they will get.  The left side of an
+ * assignment is never touched; it is either the variable being set or
+ * a term whose error must still be reported when the line runs.
+ *
+ * Dropping the operand of X + 0, X - 0, X * 1 or X / 1 keeps every
+ * evaluation of the other operand, in the same order, and 0 - X becomes
+ * a negation.  X * -1 also becomes a negation, which cannot fault where
+ * the multiplication could not.  Only X * 0 throws an operand away, so
+ * it requires that operand to be pure.
+ */
+
+Expression *simplifyExp(Expression *exp, Arena &arena)
+{
+  if (exp->getType() == NEGATE)
+  {
+    Expression *operand = static_cast<NegateExp *>(exp)->getOperand();
+    return simplifyNegate(simplifyExp(operand, arena), arena);
+  }
+  if (exp->getType() != COMPOUND)
+    return exp;
+
+  auto *compound = static_cast<CompoundExp *>(exp);
+  std::string op = compound->getOp();
+  Expression *lhs = compound->getLHS();
+  Expression *rhs = simplifyExp(compound->getRHS(), arena);
+  if (op == "=")
+  {
+    if (rhs == compound->getRHS())
+      return exp;
+    return new (arena) CompoundExp(op, lhs, rhs);
+  }
+  lhs = simplifyExp(lhs, arena);
+
+  int value;
+  if (lhs->getType() == CONSTANT && rhs->getType() == CONSTANT &&
+      foldOperator(op, static_cast<ConstantExp *>(lhs)->getValue(), static_cast<ConstantExp *>(rhs)->getValue(),
+                   value))
+  {
+    return new (arena) ConstantExp(value);
+  }
+  if (op == "+")
+  {
+    if (isConstant(rhs, 0))
+      return lhs;
+    if (isConstant(lhs, 0))
+      return rhs;
+  }
+  else if (op == "-")
+  {
+    if (isConstant(rhs, 0))
+      return lhs;
+    if (isConstant(lhs, 0))
+      return simplifyNegate(rhs, arena);
+  }
+  else if (op == "*")
+  {
+    if (isConstant(rhs, 1))
+      return lhs;
+    if (isConstant(lhs, 1))
+      return rhs;
+    if (isConstant(rhs, -1))
+      return simplifyNegate(lhs, arena);
+    if (isConstant(lhs, -1))
+      return simplifyNegate(rhs, arena);
+    if ((isConstant(rhs, 0) && isPure(lhs)) || (isConstant(lhs, 0) && isPure(rhs)))
+      return new (arena) ConstantExp(0);
+  }
+  else if (op == "/")
+  {
+    if (isConstant(rhs, 1))
+      return lhs;
+  }
+  if (lhs == compound->getLHS() && rhs == compound->getRHS())
+    return exp;
+  return new (arena) CompoundExp(op, lhs, rhs);
+}
+
+bool isStep(Expression *exp, int slot, int &step)
+{
+  if (exp == nullptr || exp->getType() != COMPOUND)
+    return false;
+  auto *compound = static_cast<CompoundExp *>(exp);
+  std::string op = compound->getOp();
+  Expression *lhs = compound->getLHS();
+  Expression *rhs = compound->getRHS();
+  if (op == "+" && lhs->getType() == CONSTANT)
+    std::swap(lhs, rhs);
+  else if (op != "-" && op != "+")
+    return false;
+  if (lhs->getType() != IDENTIFIER || static_cast<IdentifierExp *>(lhs)->getSlot() != slot ||
+      rhs->getType() != CONSTANT)
+    return false;
+  step = static_cast<ConstantExp *>(rhs)->getValue();
+  if (op == "-")
+    foldOperator("-", 0, step, step);
+  return true;
+}
@@ -0,0 +1,63 @@
+/*
+ * File: optimizer.h
+ * -----------------
+ * This interface exports the expression simplifier that the parser
+ * applies to every tree it builds.  Constant subtrees are folded and
+ * arithmetic identities are removed, without changing the value of
+ * the expression, the errors it raises or the order it raises them in.
+ */
+
+#ifndef _optimizer_h
+#define _optimizer_h
+
+#include "exp.hpp"
+#include "Utils/arena.hpp"
+
+/*
+ * Function: simplifyExp
+ * Usage: exp = simplifyExp(exp, arena);
+ * -------------------------------------
+ * Returns a tree equivalent to exp, with any new nodes allocated in
+ * arena.  Nodes of the original tree may be shared by the result.
+ *
+ * A division whose divisor folds to zero is kept, so DIVIDE BY ZERO is
+ * still raised when the line runs, and an operand is only dropped (as
+ * in X * 0) when evaluating it can neither fail nor assign a variable.
+ */
+
+Expression *simplifyExp(Expression *exp, Arena &arena);
+
+/*
+ * Function: foldOperator
+ * Usage: if (foldOperator(op, lhs, rhs, value)) . . .
+ * ---------------------------------------------------
+ * Applies the arithmetic operator op to two constants, storing the
+ * result in value.  Overflow wraps as it does at run time.  Returns
+ * false, leaving value unchanged, if op is not arithmetic or if the
+ * operation must be left to run time because it would fail there.
+ */
+
+bool foldOperator(const std::string &op, int lhs, int rhs, int &value);
+
+/*
+ * Function: isPure
+ * Usage: if (isPure(exp)) . . .
+ * -----------------------------
+ * Returns true if evaluating exp can neither raise an error nor assign
+ * a variable, so that the evaluation may be skipped.
+ */
+
+bool isPure(Expression *exp);
+
+/*
+ * Function: isStep
+ * Usage: if (isStep(exp, slot, step)) . . .
+ * -----------------------------------------
+ * Returns true if exp is slot + c, c + slot or slot - c for a constant
+ * c, which makes LET slot = exp a step of slot by a fixed amount, and
+ * stores that amount, negated for a subtraction, in step.
+ */
+
+bool isStep(Expression *exp, int slot, int &step);
+
+#endif
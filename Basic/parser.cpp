@@ -5,20 +5,137 @@
  */
 
 #include "parser.hpp"
+#include "optimizer.hpp"
 
 
 /*
  * Implementation notes: parseExp
  * ------------------------------
- * This code just reads an expression and then checks for extra tokens.
+ * This code reads an expression, checks for extra tokens and hands the
+ * tree to simplifyExp, so every client sees the folded form.
  */
 
-Expression *parseExp(TokenScanner &scanner) {
-    Expression *exp = readE(scanner);
+Expression *parseExp(TokenScanner &scanner, Arena &arena) {
+    Expression *exp = readE(scanner, arena);
     if (scanner.hasMoreTokens()) {
         error("parseExp: Found extra token: " + scanner.nextToken());
     }
-    return exp;
+    return simplifyExp(exp, arena);
+}
+
+/*
+ * Implementation notes: parseCondition
+ * ------------------------------------
+ * Conditions and expressions share their parentheses, so a condition
+ * is read by one precedence parser over both kinds of operator, with
+ * OR binding loosest, then AND, NOT, the relations and the arithmetic
+ * operators.  Every subtree it returns is either an expression or a
+ * condition, and each operator checks that its operands are of the
+ * kind it takes.  An = is read as a comparison, but a parenthesized
+ * one that is used as an operand of arithmetic or of a relation is an
+ * assignment, as it would be in any other expression.
+ */
+
+static const int NOT_PRECEDENCE = 3;
+
+static const int RELATION_PRECEDENCE = 4;
+
+struct ConditionTerm {
+    Expression *exp;
+    Condition *cond;
+    bool grouped;
+};
+
+static ConditionTerm readCondition(TokenScanner &scanner, Arena &arena, int prec);
+
+static bool relationOf(const std::string &token, Relation &relation) {
+    static const char *const names[] = {"=", "<>", "<", "<=", ">", ">="};
+    for (int i = REL_EQ; i <= REL_GE; i++) {
+        if (token == names[i]) {
+            relation = static_cast<Relation>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+static int conditionPrecedence(const std::string &token) {
+    Relation relation;
+    if (token == "OR") return 1;
+    if (token == "AND") return 2;
+    if (relationOf(token, relation)) return RELATION_PRECEDENCE;
+    int prec = precedence(token);
+    return prec > 1 ? prec + RELATION_PRECEDENCE - 1 : 0;
+}
+
+static Expression *asExpression(const ConditionTerm &term, Arena &arena) {
+    if (term.exp) return term.exp;
+    Condition *cond = term.cond;
+    if (!term.grouped || cond->getType() != RELATION || cond->getRelation() != REL_EQ
+        || cond->getLHS()->getType() != IDENTIFIER) {
+        error("Illegal term in expression");
+    }
+    return new (arena) CompoundExp("=", cond->getLHS(), cond->getRHS());
+}
+
+static Condition *asCondition(const ConditionTerm &term) {
+    if (!term.cond) error("Missing comparison in condition");
+    return term.cond;
+}
+
+static ConditionTerm readConditionTerm(TokenScanner &scanner, Arena &arena) {
+    std::string token = scanner.nextToken();
+    TokenType type = scanner.getTokenType(token);
+    if (token == "NOT") {
+        Condition *operand = asCondition(readCondition(scanner, arena, NOT_PRECEDENCE));
+        return {nullptr, operand->negate(arena), false};
+    }
+    if (token == "-") {
+        Expression *operand = asExpression(readCondition(scanner, arena, RELATION_PRECEDENCE), arena);
+        return {new (arena) NegateExp(operand), nullptr, false};
+    }
+    if (token == "(") {
+        ConditionTerm term = readCondition(scanner, arena, 0);
+        if (scanner.nextToken() != ")") {
+            error("Unbalanced parentheses in expression");
+        }
+        term.grouped = true;
+        return term;
+    }
+    if (token == "AND" || token == "OR" || token == "THEN") error("Illegal term in expression");
+    if (type == WORD) return {new (arena) IdentifierExp(token), nullptr, false};
+    if (type == NUMBER) return {new (arena) ConstantExp(stringToInteger(token)), nullptr, false};
+    error("Illegal term in expression");
+    return {nullptr, nullptr, false};
+}
+
+static ConditionTerm readCondition(TokenScanner &scanner, Arena &arena, int prec) {
+    ConditionTerm term = readConditionTerm(scanner, arena);
+    std::string token;
+    while (true) {
+        token = scanner.nextToken();
+        int newPrec = conditionPrecedence(token);
+        if (newPrec <= prec) break;
+        ConditionTerm rhs = readCondition(scanner, arena, newPrec);
+        Relation relation;
+        if (token == "AND" || token == "OR") {
+            ConditionType type = token == "AND" ? CONJUNCTION : DISJUNCTION;
+            term = {nullptr, new (arena) Condition(type, asCondition(term), asCondition(rhs)), false};
+        } else if (relationOf(token, relation)) {
+            Expression *lhs = simplifyExp(asExpression(term, arena), arena);
+            Expression *right = simplifyExp(asExpression(rhs, arena), arena);
+            term = {nullptr, new (arena) Condition(relation, lhs, right), false};
+        } else {
+            Expression *lhs = asExpression(term, arena);
+            term = {new (arena) CompoundExp(token, lhs, asExpression(rhs, arena)), nullptr, false};
+        }
+    }
+    scanner.saveToken(token);
+    return term;
+}
+
+Condition *parseCondition(TokenScanner &scanner, Arena &arena) {
+    return asCondition(readCondition(scanner, arena, 0));
 }
 
 /*
@@ -32,15 +149,15 @@ Expression *parseExp(TokenScanner &scanner) {
  * readE calls itself recursively to read in that subexpression as a unit.
  */
 
-Expression *readE(TokenScanner &scanner, int prec) {
-    Expression *exp = readT(scanner);
+Expression *readE(TokenScanner &scanner, Arena &arena, int prec) {
+    Expression *exp = readT(scanner, arena);
     std::string token;
     while (true) {
         token = scanner.nextToken();
         int newPrec = precedence(token);
         if (newPrec <= prec) break;
-        Expression *rhs = readE(scanner, newPrec);
-        exp = new CompoundExp(token, exp, rhs);
+        Expression *rhs = readE(scanner, arena, newPrec);
+        exp = new (arena) CompoundExp(token, exp, rhs);
     }
     scanner.saveToken(token);
     return exp;
@@ -50,17 +167,18 @@ Expression *readE(TokenScanner &scanner, int prec) {
  * Implementation notes: readT
  * ---------------------------
  * This function scans a term, which is either an integer, an identifier,
- * or a parenthesized subexpression.
+ * or a parenthesized subexpression.  A leading minus negates the whole
+ * expression that follows it, not just the next term.
  */
 
-Expression *readT(TokenScanner &scanner) {
+Expression *readT(TokenScanner &scanner, Arena &arena) {
     std::string token = scanner.nextToken();
     TokenType type = scanner.getTokenType(token);
-    if (type == WORD) return new IdentifierExp(token);
-    if (type == NUMBER) return new ConstantExp(stringToInteger(token));
-    if (token == "-") return new CompoundExp(token, new ConstantExp(0), readE(scanner));
+    if (type == WORD) return new (arena) IdentifierExp(token);
+    if (type == NUMBER) return new (arena) ConstantExp(stringToInteger(token));
+    if (token == "-") return new (arena) NegateExp(readE(scanner, arena));
     if (token != "(") error("Illegal term in expression");
-    Expression *exp = readE(scanner);
+    Expression *exp = readE(scanner, arena);
     if (scanner.nextToken() != ")") {
         error("Unbalanced parentheses in expression");
     }
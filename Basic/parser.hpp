@@ -11,6 +11,7 @@
 #include <iostream>
 #include "exp.hpp"
 
+#include "Utils/arena.hpp"
 #include "Utils/tokenScanner.hpp"
 #include "Utils/error.hpp"
 #include "Utils/strlib.hpp"
@@ -18,35 +19,53 @@
 
 /*
  * Function: parseExp
- * Usage: Expression *exp = parseExp(scanner);
- * -------------------------------------------
+ * Usage: Expression *exp = parseExp(scanner, arena);
+ * --------------------------------------------------
  * Parses an expression by reading tokens from the scanner, which must
  * be provided by the client.  The scanner should be set to ignore
- * whitespace and to scan numbers.
+ * whitespace and to scan numbers.  Every node of the tree, including
+ * those built before a parse error, is allocated in arena.  The tree
+ * returned has been simplified with simplifyExp.
  */
 
-Expression *parseExp(TokenScanner &scanner);
+Expression *parseExp(TokenScanner &scanner, Arena &arena);
+
+/*
+ * Function: parseCondition
+ * Usage: Condition *cond = parseCondition(scanner, arena);
+ * --------------------------------------------------------
+ * Parses the condition of an IF statement: relations between
+ * expressions written with =, <>, <, <=, > or >=, combined with AND,
+ * OR, NOT and parentheses.  NOT binds tighter than AND, which binds
+ * tighter than OR.  Reading stops at the first token that cannot
+ * continue the condition, which is left in the scanner, and the
+ * scanner should be set up as for parseExp, with the two-character
+ * relations added as operators.  The operands of every relation have
+ * been simplified with simplifyExp.
+ */
+
+Condition *parseCondition(TokenScanner &scanner, Arena &arena);
 
 /*
  * Function: readE
- * Usage: Expression *exp = readE(scanner, prec);
- * ----------------------------------------------
+ * Usage: Expression *exp = readE(scanner, arena, prec);
+ * -----------------------------------------------------
  * Returns the next expression from the scanner involving only operators
  * whose precedence is at least prec.  The prec argument is optional and
  * defaults to 0, which means that the function reads the entire expression.
  */
 
-Expression *readE(TokenScanner &scanner, int prec = 0);
+Expression *readE(TokenScanner &scanner, Arena &arena, int prec = 0);
 
 /*
  * Function: readT
- * Usage: Expression *exp = readT(scanner);
- * ----------------------------------------
+ * Usage: Expression *exp = readT(scanner, arena);
+ * -----------------------------------------------
  * Returns the next individual term, which is either a constant, an
  * identifier, or a parenthesized subexpression.
  */
 
-Expression *readT(TokenScanner &scanner);
+Expression *readT(TokenScanner &scanner, Arena &arena);
 
 /*
  * Function: precedence
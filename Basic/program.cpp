@@ -1,141 +1,451 @@
 /*
  * File: program.cpp
  * -----------------
- * This file is a stub implementation of the program.h interface
- * in which none of the methods do anything beyond returning a
- * value of the correct type.  Your job is to fill in the bodies
- * of each of these methods with an implementation that satisfies
- * the performance guarantees specified in the assignment.
+ * This file implements the Program class: the stored lines of a
+ * BASIC program, their parsed statements, and the state of a running
+ * program, namely its position, the loop stack and the return stack.
  */
 
 #include "program.hpp"
+#include <algorithm>
+#include <unordered_map>
+#include "engine.hpp"
 
 
+LineProfile::LineProfile() = default;
+
+LineProfile::LineProfile(LineProfile &&other) noexcept = default;
+
+LineProfile &LineProfile::operator=(LineProfile &&other) noexcept = default;
+
+LineProfile::~LineProfile() = default;
+
 Program::Program() = default;
 
-Program::~Program() = default;
+Program::~Program() { clear(); }
 
 void Program::clear()
 {
-  // Replace this stub with your own code
-  for (auto it : line_num)
-  {
-    delete statement_list[it];
-  }
-  line_num.clear();
-  line_list.clear();
-  statement_list.clear();
+  lines.clear();
+  sorted = true;
+  linked = false;
+  cur_index = -1;
+  loopDepth = 0;
+  returnDepth = 0;
 }
 
-void Program::addSourceLine(int lineNumber, const std::string &line)
+/*
+ * Implementation notes: addSourceLine, removeSourceLine
+ * -----------------------------------------------------
+ * The lines live in one vector of records sorted by line number.
+ * Lines typed in increasing order are appended and a line that is
+ * retyped is replaced in place.  Any other edit is appended out of
+ * order and the vector is rebuilt the next time the program is read,
+ * usually at RUN or LIST, so loading or editing a long program never
+ * shifts the records line by line.
+ */
+
+void Program::addSourceLine(int lineNumber, const std::string &line, const std::string &lineNumberStr)
 {
-  // Replace this stub with your own code
-  if (isLineExist(lineNumber))
+  // Parse first so that a malformed line leaves the program untouched
+  Arena arena(&pool);
+  Statement *st = Program::setStatement(line, arena);
+  linked = false;
+  if (sorted && (lines.empty() || lines.back().number < lineNumber))
   {
-    delete statement_list[lineNumber];
+    lines.push_back({lineNumber, lineNumberStr, line, st, std::move(arena), LineProfile()});
+    return;
   }
-  line_num.insert(lineNumber);
-  Statement *st = Program::setStatement(line);
-  line_list[lineNumber] = line;
-  statement_list[lineNumber] = st;
+  int index = sorted ? find(lineNumber) : -1;
+  if (index != -1)
+  {
+    lines[index] = {lineNumber, lineNumberStr, line, st, std::move(arena), LineProfile()};
+    return;
+  }
+  lines.push_back({lineNumber, lineNumberStr, line, st, std::move(arena), LineProfile()});
+  sorted = false;
 }
 
 void Program::removeSourceLine(int lineNumber)
 {
-  // Replace this stub with your own code
-  if (isLineExist(lineNumber))
+  if (sorted && find(lineNumber) == -1)
   {
-    line_num.erase(lineNumber);
-    line_list.erase(lineNumber);
-    line_num_str_list.erase(lineNumber);
-    delete statement_list[lineNumber];
-    statement_list.erase(lineNumber);
+    return;
   }
+  lines.push_back({lineNumber, "", "", nullptr, Arena(), LineProfile()});
+  sorted = false;
+  linked = false;
 }
 
-std::string Program::getSourceLine(int lineNumber)
+/*
+ * Restores the invariant that lines is sorted, holds each line number
+ * once and contains no removal markers.  The sort is stable, so for a
+ * number that was edited several times the last record is the one
+ * that counts.
+ */
+
+void Program::rebuild()
 {
-  // Replace this stub with your own code
-  if (isLineExist(lineNumber))
+  if (sorted)
+    return;
+  std::stable_sort(lines.begin(), lines.end(),
+                   [](const LineRecord &a, const LineRecord &b) { return a.number < b.number; });
+  std::size_t kept = 0;
+  for (std::size_t i = 0; i < lines.size(); i++)
   {
-    return line_list[lineNumber];
+    if (i + 1 < lines.size() && lines[i + 1].number == lines[i].number)
+      continue;
+    if (lines[i].stmt == nullptr)
+      continue;
+    if (kept != i)
+      lines[kept] = std::move(lines[i]);
+    kept++;
   }
-  return "";
+  lines.erase(lines.begin() + static_cast<std::ptrdiff_t>(kept), lines.end());
+  sorted = true;
+}
+
+int Program::find(int lineNumber)
+{
+  rebuild();
+  auto it = std::lower_bound(lines.begin(), lines.end(), lineNumber,
+                             [](const LineRecord &record, int number) { return record.number < number; });
+  if (it == lines.end() || it->number != lineNumber)
+    return -1;
+  return static_cast<int>(it - lines.begin());
+}
+
+std::string Program::getSourceLine(int lineNumber)
+{
+  int index = find(lineNumber);
+  return index == -1 ? "" : lines[index].source;
 }
 
 void Program::setParsedStatement(int lineNumber, Statement *stmt)
 {
-  // Replace this stub with your own code
-  if (isLineExist(lineNumber))
+  int index = find(lineNumber);
+  if (index == -1)
+    error("SYNTAX ERROR\n");
+  lines[index].stmt = stmt;
+  lines[index].profile = LineProfile();
+  linked = false;
+}
+
+Statement *Program::getParsedStatement(int lineNumber)
+{
+  int index = find(lineNumber);
+  return index == -1 ? nullptr : lines[index].stmt;
+}
+
+int Program::getFirstLineNumber()
+{
+  rebuild();
+  return lines.empty() ? -1 : lines.front().number;
+}
+
+int Program::getNextLineNumber(int lineNumber)
+{
+  int index = find(lineNumber);
+  if (index == -1 || index + 1 == static_cast<int>(lines.size()))
+    return -1;
+  return lines[index + 1].number;
+}
+
+// more func to add
+bool Program::isLineExist(int lineNumber) { return find(lineNumber) != -1; }
+
+int Program::getLineCount()
+{
+  rebuild();
+  return static_cast<int>(lines.size());
+}
+
+int Program::getLineNumberAt(int index) { return lines[index].number; }
+
+Statement *Program::getStatementAt(int index) { return lines[index].stmt; }
+
+/*
+ * Implementation notes: link
+ * --------------------------
+ * Once the records are in order, the running position is an index
+ * into them, so moving to the next line is an increment and a resolved
+ * jump is a plain assignment.  Any edit clears linked, and the next
+ * RUN links again.  Lines the tiered engine has compiled keep their
+ * chunks across edits, so their exits are resolved again here too.
+ *
+ * A NEXT pairs with the innermost FOR above it that is still open,
+ * provided it names that FOR's variable or none; FOR and NEXT lines
+ * that do not pair leave the program unstructured.  The body of a pair
+ * runs from the line after the FOR through the NEXT, and region holds
+ * for each line the FOR of the innermost body containing it, so a jump
+ * stays within its body exactly when both ends share a region, which
+ * must hold for every target of an ON.  A GOSUB may also call region
+ * -1, outside every loop; the loops around it stay open during the
+ * call, so each must be the only FOR on its variable.  ON . . . GOSUB
+ * is held to the same rules.
+ */
+
+void Program::link()
+{
+  if (linked)
+    return;
+  rebuild();
+  structured = true;
+  std::vector<int> open;
+  std::vector<int> region(lines.size(), -1);
+  std::unordered_map<int, int> loopsOn;
+  std::vector<int> aroundCalls;
+  for (int i = 0; i < static_cast<int>(lines.size()); i++)
   {
-    statement_list[lineNumber] = stmt;
+    Statement *stmt = lines[i].stmt;
+    region[i] = open.empty() ? -1 : open.back();
+    if (stmt->getType() == GOTO)
+    {
+      auto *jump = static_cast<GOTOStatement *>(stmt);
+      jump->targetIndex = find(jump->target);
+    }
+    else if (stmt->getType() == IF)
+    {
+      auto *branch = static_cast<IFStatement *>(stmt);
+      branch->targetIndex = find(branch->target);
+    }
+    else if (stmt->getType() == GOSUB)
+    {
+      auto *call = static_cast<GOSUBStatement *>(stmt);
+      call->targetIndex = find(call->target);
+      for (int outer : open)
+        aroundCalls.push_back(static_cast<FORStatement *>(lines[outer].stmt)->slot);
+    }
+    else if (stmt->getType() == ON)
+    {
+      auto *on = static_cast<ONStatement *>(stmt);
+      for (int choice = 0; choice < on->count; choice++)
+        on->targetIndices[choice] = find(on->targets[choice]);
+      if (on->gosub)
+      {
+        for (int outer : open)
+          aroundCalls.push_back(static_cast<FORStatement *>(lines[outer].stmt)->slot);
+      }
+    }
+    else if (stmt->getType() == FOR)
+    {
+      auto *loop = static_cast<FORStatement *>(stmt);
+      loop->nextIndex = -1;
+      loopsOn[loop->slot]++;
+      for (int outer : open)
+      {
+        if (static_cast<FORStatement *>(lines[outer].stmt)->slot == loop->slot)
+          structured = false;
+      }
+      open.push_back(i);
+      if (static_cast<int>(open.size()) > MAX_LOOP_DEPTH)
+        structured = false;
+    }
+    else if (stmt->getType() == NEXT)
+    {
+      auto *next = static_cast<NEXTStatement *>(stmt);
+      next->forIndex = -1;
+      auto *loop = open.empty() ? nullptr : static_cast<FORStatement *>(lines[open.back()].stmt);
+      if (loop == nullptr || (next->slot != -1 && next->slot != loop->slot))
+      {
+        structured = false;
+        continue;
+      }
+      next->forIndex = open.back();
+      loop->nextIndex = i;
+      open.pop_back();
+    }
   }
-  else
-    error("SYNTAX ERROR\n");
+  if (!open.empty())
+    structured = false;
+  for (int slot : aroundCalls)
+  {
+    if (loopsOn[slot] > 1)
+      structured = false;
+  }
+  for (int i = 0; i < static_cast<int>(lines.size()) && structured; i++)
+  {
+    Statement *stmt = lines[i].stmt;
+    int target = -1;
+    if (stmt->getType() == GOTO)
+      target = static_cast<GOTOStatement *>(stmt)->targetIndex;
+    else if (stmt->getType() == IF)
+      target = static_cast<IFStatement *>(stmt)->targetIndex;
+    else if (stmt->getType() == GOSUB)
+      target = static_cast<GOSUBStatement *>(stmt)->targetIndex;
+    if (target >= 0 && region[target] != region[i] && !(stmt->getType() == GOSUB && region[target] == -1))
+      structured = false;
+    if (stmt->getType() != ON)
+      continue;
+    auto *on = static_cast<ONStatement *>(stmt);
+    for (int choice = 0; choice < on->count; choice++)
+    {
+      target = on->targetIndices[choice];
+      if (target >= 0 && region[target] != region[i] && !(on->gosub && region[target] == -1))
+        structured = false;
+    }
+  }
+  for (LineRecord &record : lines)
+  {
+    if (record.profile.tier != TIER_TREE)
+      linkExits(record.profile);
+  }
+  linked = true;
 }
 
-// void Program::removeSourceLine(int lineNumber) {
+bool Program::hasStructuredLoops()
+{
+  link();
+  return structured;
+}
 
-Statement *Program::getParsedStatement(int lineNumber)
+int Program::getCurLineNumber() const { return cur_index < 0 ? -1 : lines[cur_index].number; }
+
+Statement *Program::getCurStatement() const { return lines[cur_index].stmt; }
+
+LineProfile &Program::getCurProfile() { return lines[cur_index].profile; }
+
+LineProfile &Program::getProfileAt(int index) { return lines[index].profile; }
+
+int Program::getLineIndex(int lineNumber)
 {
-  // Replace this stub with your own code
-  if (isLineExist(lineNumber))
+  link();
+  return find(lineNumber);
+}
+
+void Program::linkExits(LineProfile &profile)
+{
+  profile.exitIndices.clear();
+  for (int lineNumber : profile.chunk.exitLines)
+    profile.exitIndices.push_back(find(lineNumber));
+}
+
+ErrorCode Program::jumpTo(int index)
+{
+  if (index < 0)
   {
-    return statement_list[lineNumber];
+    return ERR_LINE_NUMBER;
   }
-  return nullptr;
+  cur_index = index;
+  return ERR_NONE;
 }
 
-int Program::getFirstLineNumber()
+/*
+ * Implementation notes: openLoop, findLoop, closeLoop
+ * ---------------------------------------------------
+ * The loop stack is searched from the top.  Loops are rarely nested
+ * more than a few deep, so the search is short, and in a structured
+ * program the loop a NEXT closes is always on top.
+ */
+
+ErrorCode Program::openLoop(int slot, int limit, int step)
 {
-  // Replace this stub with your own code
-  if (line_num.empty())
+  for (int i = loopDepth - 1; i >= 0; i--)
   {
-    return -1;
+    if (loops[i].slot == slot)
+    {
+      loopDepth = i;
+      break;
+    }
   }
-  return *line_num.begin();
+  if (loopDepth == MAX_LOOP_DEPTH)
+  {
+    return ERR_FOR_OVERFLOW;
+  }
+  int body = cur_index + 1 < static_cast<int>(lines.size()) ? cur_index + 1 : -1;
+  loops[loopDepth++] = {slot, limit, step, body};
+  return ERR_NONE;
 }
 
-int Program::getNextLineNumber(int lineNumber)
+LoopFrame *Program::findLoop(int slot)
 {
-  // Replace this stub with your own code
-  auto cur_it = line_num.find(lineNumber);
-  if (cur_it != line_num.end())
+  for (int i = loopDepth - 1; i >= 0; i--)
   {
-    ++cur_it;
-    if (cur_it != line_num.end())
+    if (slot == -1 || loops[i].slot == slot)
     {
-      return *cur_it;
+      loopDepth = i + 1;
+      return &loops[i];
     }
   }
-  return -1;
+  return nullptr;
 }
 
-// more func to add
-bool Program::isLineExist(int lineNumber)
+void Program::closeLoop() { loopDepth--; }
+
+/*
+ * Implementation notes: callSubroutine, returnFromSubroutine
+ * ----------------------------------------------------------
+ * A call is a bounds check and one store into the preallocated return
+ * stack, and a return one load, since the positions were resolved by
+ * link.  A return closes the loops opened during the call, but never
+ * reopens one that the subroutine closed itself.
+ */
+
+void Program::setGosubDepth(int depth)
 {
-  if (line_num.find(lineNumber) != line_num.end())
-    return true;
-  return false;
+  returns.assign(depth, ReturnFrame());
+  returnDepth = 0;
 }
 
-int Program::getCurLineNumber() const { return cur_line_num; }
+int Program::getGosubDepth() const { return static_cast<int>(returns.size()); }
 
-void Program::initCurLineNumber() { cur_line_num = getFirstLineNumber(); }
+ErrorCode Program::callSubroutine(int index)
+{
+  if (index < 0)
+  {
+    return ERR_LINE_NUMBER;
+  }
+  if (returnDepth == static_cast<int>(returns.size()))
+  {
+    return ERR_GOSUB_OVERFLOW;
+  }
+  int back = cur_index + 1 < static_cast<int>(lines.size()) ? cur_index + 1 : -1;
+  returns[returnDepth++] = {back, loopDepth};
+  cur_index = index;
+  return ERR_NONE;
+}
 
-void Program::gotoNextLine() { cur_line_num = getNextLineNumber(cur_line_num); }
+ErrorCode Program::returnFromSubroutine()
+{
+  if (returnDepth == 0)
+  {
+    return ERR_RETURN_WITHOUT_GOSUB;
+  }
+  const ReturnFrame &frame = returns[--returnDepth];
+  if (loopDepth > frame.loopDepth)
+    loopDepth = frame.loopDepth;
+  cur_index = frame.index;
+  return ERR_NONE;
+}
+
+void Program::initCurLineNumber()
+{
+  link();
+  cur_index = lines.empty() ? -1 : 0;
+  loopDepth = 0;
+  returnDepth = 0;
+}
+
+void Program::gotoNextLine()
+{
+  if (cur_index >= 0)
+  {
+    cur_index = cur_index + 1 < static_cast<int>(lines.size()) ? cur_index + 1 : -1;
+  }
+}
 
 void Program::adjustGOTO(bool opt) { is_goto = opt; }
 
-void Program::end() { cur_line_num = -1; }
+void Program::end() { cur_index = -1; }
 
 void Program::gotoLineNumber(const int lineNumber)
 {
-  if (isLineExist(lineNumber))
+  int index = getLineIndex(lineNumber);
+  if (index != -1)
   {
     if (is_goto)
     {
-      cur_line_num = lineNumber;
+      cur_index = index;
     }
   }
   else
@@ -144,72 +454,86 @@ void Program::gotoLineNumber(const int lineNumber)
   }
 }
 
-Statement *Program::setStatement(const std::string &line)
+Statement *Program::setStatement(const std::string &line, Arena &arena)
 {
   TokenScanner token_scanner;
   token_scanner.ignoreWhitespace();
   token_scanner.scanNumbers();
-  token_scanner.setInput(line);
+  token_scanner.setInputView(line);
   std::string cmd = token_scanner.nextToken();
   if (cmd == "REM")
   {
-    return new REMStatement(line);
+    return new (arena) REMStatement(line);
   }
   if (cmd == "LET")
   {
-    return new LETStatement(line);
+    return new (arena) LETStatement(line, arena);
   }
   if (cmd == "PRINT")
   {
-    return new PRINTStatement(line);
+    return new (arena) PRINTStatement(line, arena);
   }
   if (cmd == "INPUT")
   {
-    return new INPUTStatement(line);
+    return new (arena) INPUTStatement(line);
   }
   if (cmd == "END")
   {
-    return new ENDStatement();
+    return new (arena) ENDStatement();
   }
   if (cmd == "GOTO")
   {
-    return new GOTOStatement(line);
+    return new (arena) GOTOStatement(line);
   }
   if (cmd == "IF")
   {
-    return new IFStatement(line);
+    return new (arena) IFStatement(line, arena);
+  }
+  if (cmd == "FOR")
+  {
+    return new (arena) FORStatement(line, arena);
+  }
+  if (cmd == "NEXT")
+  {
+    return new (arena) NEXTStatement(line);
+  }
+  if (cmd == "GOSUB")
+  {
+    return new (arena) GOSUBStatement(line);
+  }
+  if (cmd == "RETURN")
+  {
+    return new (arena) RETURNStatement(line);
+  }
+  if (cmd == "ON")
+  {
+    return new (arena) ONStatement(line, arena);
   }
   error("SYNTAX ERROR");
   return nullptr;
 }
 
-void Program::addLineNumberStr(int lineNumber, std::string &lineNumberStr)
-{
-  line_num_str_list[lineNumber] = lineNumberStr;
-}
-
 void Program::list()
 {
-  for (auto it : line_num)
+  rebuild();
+  for (const LineRecord &record : lines)
   {
-    std::cout << line_num_str_list[it] << " " << line_list[it] << "\n";
+    std::cout << record.numberStr << " " << record.source << "\n";
   }
 }
 
-void Program::run(EvalState &state)
+void Program::listTiers()
 {
-  initCurLineNumber();
-  while (cur_line_num != -1)
+  static const char *const names[] = {"TREE", "BYTECODE", "NATIVE"};
+  rebuild();
+  for (const LineRecord &record : lines)
   {
-    Statement *cur_statement = statement_list[cur_line_num];
-    cur_statement->execute(state, *this);
+    std::cout << record.numberStr << " " << names[record.profile.tier] << " " << record.profile.executions << "\n";
   }
 }
 
-void Program::quit()
-{
-  for (auto it : line_num)
-  {
-    delete statement_list[it];
-  }
-}
+void Program::run(EvalState &state) { run(state, getDefaultEngine()); }
+
+void Program::run(EvalState &state, Engine &engine) { engine.run(*this, state); }
+
+void Program::quit() { clear(); }
@@ -8,14 +8,93 @@
 #ifndef _program_h
 #define _program_h
 
-#include <set>
+#include <memory>
 #include <string>
-#include <unordered_map>
 #include <vector>
+#include "Utils/arena.hpp"
+#include "Utils/error.hpp"
+#include "bytecode.hpp"
 #include "statement.hpp"
 
 
 class Statement;
+class Engine;
+class JIT;
+
+/*
+ * Type: ExecutionTier
+ * -------------------
+ * The form in which the tiered engine runs a line: by walking its
+ * statement, as a bytecode chunk on the VM, or as native code.
+ */
+
+enum ExecutionTier
+{
+  TIER_TREE,
+  TIER_BYTECODE,
+  TIER_NATIVE
+};
+
+/*
+ * Type: LineProfile
+ * -----------------
+ * Per-line state of the tiered engine: how often the line has run, the
+ * tier it has reached and the code compiled for that tier.  stuck is
+ * set once a promotion fails so that it is not attempted again.
+ * exitIndices holds the position of each line in chunk.exitLines, or
+ * -1 for a missing line, as resolved by Program::linkExits.  The
+ * profile is discarded whenever the line is replaced or removed.
+ */
+
+struct LineProfile
+{
+  LineProfile();
+
+  LineProfile(LineProfile &&other) noexcept;
+
+  LineProfile &operator=(LineProfile &&other) noexcept;
+
+  ~LineProfile();
+
+  long long executions = 0;
+  ExecutionTier tier = TIER_TREE;
+  Chunk chunk;
+  std::vector<int> exitIndices;
+  std::unique_ptr<JIT> native;
+  bool stuck = false;
+};
+
+/*
+ * Type: LoopFrame
+ * ---------------
+ * One open FOR loop of a program run by the tree walker: the loop
+ * variable, the limit and step computed when the FOR ran, and the
+ * position of the first line of the body, which is -1 if the FOR was
+ * the last line.
+ */
+
+struct LoopFrame
+{
+  int slot;
+  int limit;
+  int step;
+  int body;
+};
+
+/*
+ * Type: ReturnFrame
+ * -----------------
+ * One GOSUB of a program run by the tree walker that has not returned
+ * yet: the position of the line to return to, which is -1 if the GOSUB
+ * was the last line, and the number of loops that were open when it
+ * ran.
+ */
+
+struct ReturnFrame
+{
+  int index;
+  int loopDepth;
+};
 
 /*
  * This class stores the lines in a BASIC program.  Each line
@@ -70,10 +149,11 @@ public:
    * If that line already exists, the text of the line replaces
    * the text of any existing line and the parsed representation
    * (if any) is deleted.  If the line is new, it is added to the
-   * program in the correct sequence.
+   * program in the correct sequence.  lineNumberStr is the number as
+   * it was typed, which LIST prints back.
    */
 
-  void addSourceLine(int lineNumber, const std::string &line);
+  void addSourceLine(int lineNumber, const std::string &line, const std::string &lineNumberStr);
 
   /*
    * Method: removeSourceLine
@@ -144,8 +224,186 @@ public:
 
   bool isLineExist(int lineNumber);
 
+  /*
+   * Methods: getLineCount, getLineNumberAt, getStatementAt
+   * Usage: for (int i = 0; i < program.getLineCount(); i++) . . .
+   * -------------------------------------------------------------
+   * Walk the lines in order by position, which is cheaper than
+   * following getNextLineNumber.
+   */
+
+  int getLineCount();
+
+  int getLineNumberAt(int index);
+
+  Statement *getStatementAt(int index);
+
+  /*
+   * Method: link
+   * Usage: program.link();
+   * ----------------------
+   * Lays the lines out in order and resolves the target of every GOTO,
+   * IF, GOSUB and ON to the position of the target line, so that taking
+   * a jump needs no lookup, and pairs every NEXT with its FOR.  A
+   * missing target is left unresolved and raises LINE NUMBER ERROR when
+   * the jump is taken.  Linking is redone only after the program has
+   * been edited.
+   */
+
+  void link();
+
   int getCurLineNumber() const;
 
+  /*
+   * Method: getCurStatement
+   * Usage: Statement *stmt = program.getCurStatement();
+   * ---------------------------------------------------
+   * Returns the statement at the current position of a running
+   * program, which must not have ended.
+   */
+
+  Statement *getCurStatement() const;
+
+  /*
+   * Method: getLineIndex
+   * Usage: int index = program.getLineIndex(lineNumber);
+   * ----------------------------------------------------
+   * Returns the position of a line in the linked program, or -1 if
+   * there is no such line.
+   */
+
+  int getLineIndex(int lineNumber);
+
+  /*
+   * Method: linkExits
+   * Usage: program.linkExits(profile);
+   * ----------------------------------
+   * Resolves the exitLines of the chunk in profile to positions in the
+   * linked program, so that following an exit needs no lookup.  link
+   * does the same for every compiled line after an edit.
+   */
+
+  void linkExits(LineProfile &profile);
+
+  /*
+   * Method: jumpTo
+   * Usage: ErrorCode code = program.jumpTo(index);
+   * -----------------------------------------------
+   * Continues a running program at a position resolved by link, or
+   * returns ERR_LINE_NUMBER if index is -1.  Like the other methods
+   * that move a running program, it reports errors by returning them,
+   * so that the tree walker never throws while a program runs.
+   */
+
+  ErrorCode jumpTo(int index);
+
+  /*
+   * Constant: MAX_LOOP_DEPTH
+   * ------------------------
+   * The number of FOR loops that can be open at the same time.  The
+   * loop stack is allocated with the program and never grows.
+   */
+
+  static const int MAX_LOOP_DEPTH = 64;
+
+  /*
+   * Method: openLoop
+   * Usage: ErrorCode code = program.openLoop(slot, limit, step);
+   * ------------------------------------------------------------
+   * Opens a loop on variable slot whose body starts at the line after
+   * the current one.  A loop already open on the same variable is
+   * closed first, together with every loop opened after it.  Returns
+   * ERR_FOR_OVERFLOW if MAX_LOOP_DEPTH loops are open.
+   */
+
+  ErrorCode openLoop(int slot, int limit, int step);
+
+  /*
+   * Method: findLoop
+   * Usage: LoopFrame *frame = program.findLoop(slot);
+   * -------------------------------------------------
+   * Returns the innermost open loop on variable slot, or the innermost
+   * open loop of all if slot is -1, and closes every loop opened after
+   * it.  Returns nullptr and closes nothing if there is no such loop.
+   */
+
+  LoopFrame *findLoop(int slot);
+
+  /*
+   * Method: closeLoop
+   * Usage: program.closeLoop();
+   * ---------------------------
+   * Closes the innermost open loop.
+   */
+
+  void closeLoop();
+
+  /*
+   * Method: hasStructuredLoops
+   * Usage: if (program.hasStructuredLoops()) . . .
+   * ----------------------------------------------
+   * Links the program and returns true if its loops can run without a
+   * loop stack: every FOR pairs with a later NEXT by position, a NEXT
+   * that names a variable names the one of the innermost open FOR, no
+   * loop reuses the variable of a loop around it or nests deeper than
+   * MAX_LOOP_DEPTH, and every GOTO, IF and ON jumps within the loop
+   * body it appears in.  A GOSUB or ON . . . GOSUB may call a line
+   * outside every loop as well, provided each loop around it is the
+   * only FOR on its variable, so no subroutine can reopen it.  Control
+   * then only enters a loop through its FOR and only leaves it through
+   * its NEXT or for the length of a subroutine call, so the open loops
+   * always mirror the nesting of the lines.
+   */
+
+  bool hasStructuredLoops();
+
+  /*
+   * Constants: DEFAULT_GOSUB_DEPTH, MAX_GOSUB_DEPTH
+   * -----------------------------------------------
+   * The number of GOSUBs that can be active at the same time unless
+   * setGosubDepth says otherwise, and the largest number it accepts.
+   */
+
+  static const int DEFAULT_GOSUB_DEPTH = 256;
+
+  static const int MAX_GOSUB_DEPTH = 1 << 20;
+
+  /*
+   * Methods: setGosubDepth, getGosubDepth
+   * Usage: program.setGosubDepth(depth);
+   * ------------------------------------
+   * Set and return the number of GOSUBs that can be active at the same
+   * time, which must be from 1 to MAX_GOSUB_DEPTH.  The return stack is allocated here
+   * and never grows while a program runs; the compiled engines size
+   * their own return stacks from the same limit.
+   */
+
+  void setGosubDepth(int depth);
+
+  int getGosubDepth() const;
+
+  /*
+   * Method: callSubroutine
+   * Usage: ErrorCode code = program.callSubroutine(index);
+   * ------------------------------------------------------
+   * Saves the line after the current one on the return stack and
+   * continues at a position resolved by link.  Returns ERR_LINE_NUMBER
+   * if index is -1 and ERR_GOSUB_OVERFLOW if the return stack is full.
+   */
+
+  ErrorCode callSubroutine(int index);
+
+  /*
+   * Method: returnFromSubroutine
+   * Usage: ErrorCode code = program.returnFromSubroutine();
+   * -------------------------------------------------------
+   * Continues at the position saved by the most recent active GOSUB and
+   * closes every loop opened since it ran.  Returns
+   * ERR_RETURN_WITHOUT_GOSUB if no GOSUB is active.
+   */
+
+  ErrorCode returnFromSubroutine();
+
   void initCurLineNumber();
 
   void gotoNextLine();
@@ -156,24 +414,97 @@ public:
 
   void gotoLineNumber(int lineNumber);
 
-  Statement *setStatement(const std::string &line);
+  /*
+   * Method: setStatement
+   * Usage: Statement *stmt = program.setStatement(line, arena);
+   * -----------------------------------------------------------
+   * Parses line, which must not include the line number, into a
+   * statement allocated in arena.  Raises SYNTAX ERROR if the line is
+   * malformed.
+   */
 
-  void addLineNumberStr(int lineNumber, std::string &lineNumberStr);
+  Statement *setStatement(const std::string &line, Arena &arena);
 
   void list();
 
+  /*
+   * Method: getCurProfile
+   * Usage: LineProfile &profile = program.getCurProfile();
+   * ------------------------------------------------------
+   * Returns the tiering profile of the line at the current position of
+   * a running program.
+   */
+
+  LineProfile &getCurProfile();
+
+  /*
+   * Method: getProfileAt
+   * Usage: long long runs = program.getProfileAt(index).executions;
+   * ---------------------------------------------------------------
+   * Returns the tiering profile of the line at a position.
+   */
+
+  LineProfile &getProfileAt(int index);
+
+  /*
+   * Method: listTiers
+   * Usage: program.listTiers();
+   * ---------------------------
+   * Prints every line number with the tier the tiered engine has
+   * promoted it to and the number of times it has run.
+   */
+
+  void listTiers();
+
+  /*
+   * Method: run
+   * Usage: program.run(state);
+   *        program.run(state, engine);
+   * ----------------------------------
+   * Runs the program from its first line, either on the default
+   * engine or on the one given.
+   */
+
   void run(EvalState &state);
 
+  void run(EvalState &state, Engine &engine);
+
   void quit();
 
 private:
-  std::set<int> line_num;
-  std::unordered_map<int, std::string> line_list;
-  std::unordered_map<int, Statement *> statement_list;
-  std::unordered_map<int, std::string> line_num_str_list;
-  int cur_line_num = -1;
+  /*
+   * Everything the program knows about one line is kept in a single
+   * record.  The statement and its expressions live in the record's
+   * own arena, which draws its blocks from the program's pool, so an
+   * edit releases exactly the memory of the line it replaces.  A record
+   * whose stmt is nullptr marks a removal that has not been applied yet.
+   */
+
+  struct LineRecord
+  {
+    int number;
+    std::string numberStr;
+    std::string source;
+    Statement *stmt;
+    Arena arena;
+    LineProfile profile;
+  };
+
+  ArenaPool pool;
+  std::vector<LineRecord> lines;
+  bool sorted = true;
+  bool linked = false;
+  int cur_index = -1;
   bool is_goto = false;
-  // Fill this in with whatever types and instance variables you need
+  bool structured = true;
+  LoopFrame loops[MAX_LOOP_DEPTH];
+  int loopDepth = 0;
+  std::vector<ReturnFrame> returns = std::vector<ReturnFrame>(DEFAULT_GOSUB_DEPTH);
+  int returnDepth = 0;
+
+  void rebuild();
+
+  int find(int lineNumber);
 };
 
 #endif
@@ -0,0 +1,635 @@
+/*
+ * File: regvm.cpp
+ * ---------------
+ * This file implements the RegCompiler and RegVM classes.
+ */
+
+#include "regvm.hpp"
+#include <iostream>
+#include "Utils/error.hpp"
+
+
+/*
+ * Implementation notes: register numbering
+ * ----------------------------------------
+ * The number of variables and constants is only known once the whole
+ * program has been compiled, so registers are first numbered within
+ * their own class (tagged with CONST_TAG or TEMP_TAG) and relocated to
+ * their final index in a last pass over the code.
+ */
+
+static const int CONST_TAG = 1 << 24;
+static const int TEMP_TAG = 1 << 25;
+
+bool RegCompiler::compile(Program &program, RegChunk &chunk)
+{
+  this->chunk = &chunk;
+  source = &program;
+  chunk = RegChunk();
+  if (!program.hasStructuredLoops())
+    return false;
+  chunk.callDepth = program.getGosubDepth();
+  vars.clear();
+  consts.clear();
+  linePc.clear();
+  pending.clear();
+  nextTemp = 0;
+  bodyPc.clear();
+  flow.analyze(program);
+  for (int i = 0; i < program.getLineCount(); i++)
+  {
+    int number = program.getLineNumberAt(i);
+    linePc[number] = static_cast<int>(chunk.code.size());
+    const LineFacts &facts = flow.getFacts(i);
+    for (const Hoist &hoisted : facts.preheader)
+    {
+      if (compileExp(hoisted.exp, varReg(hoisted.slot)) < 0)
+        return false;
+      nextTemp = 0;
+    }
+    bodyPc[number] = static_cast<int>(chunk.code.size());
+    currentLine = i;
+    if (!facts.reachable || facts.deadStore)
+      continue;
+    if (!compileStatement(program.getStatementAt(i), facts))
+    {
+      return false;
+    }
+    for (const Hoist &hoisted : facts.after)
+    {
+      if (compileExp(hoisted.exp, varReg(hoisted.slot)) < 0)
+        return false;
+      nextTemp = 0;
+    }
+  }
+  emit(REG_HALT, 0);
+
+  int error_stub = -1;
+  for (const PendingJump &jump : pending)
+  {
+    RegInstruction &ins = chunk.code[jump.pc];
+    const std::unordered_map<int, int> &pcs = jump.inLoop ? bodyPc : linePc;
+    auto it = pcs.find(jump.lineNumber);
+    if (jump.entry >= 0)
+    {
+      chunk.targets[jump.entry] = it != pcs.end() ? it->second : -1;
+    }
+    else if (it != pcs.end())
+    {
+      ins.dst = it->second;
+    }
+    else if (ins.op == REG_JUMP || ins.op == REG_GOSUB)
+    {
+      ins.op = REG_LINE_ERROR;
+    }
+    else
+    {
+      if (error_stub == -1)
+      {
+        error_stub = emit(REG_LINE_ERROR, 0);
+      }
+      chunk.code[jump.pc].dst = error_stub;
+    }
+  }
+
+  int num_vars = static_cast<int>(chunk.slots.size());
+  int num_consts = static_cast<int>(chunk.constants.size());
+  auto relocate = [&](int &reg) {
+    if (reg >= TEMP_TAG)
+      reg = reg - TEMP_TAG + num_vars + num_consts;
+    else if (reg >= CONST_TAG)
+      reg = reg - CONST_TAG + num_vars;
+  };
+  for (RegInstruction &ins : chunk.code)
+  {
+    if (ins.op < REG_JUMP)
+      relocate(ins.dst);
+    relocate(ins.a);
+    if (ins.op != REG_ON_GOTO && ins.op != REG_ON_GOSUB)
+      relocate(ins.b);
+  }
+  return true;
+}
+
+static bool isLeaf(Expression *exp) { return exp->getType() == CONSTANT || exp->getType() == IDENTIFIER; }
+
+bool RegCompiler::compileStatement(Statement *stmt, const LineFacts &facts)
+{
+  switch (stmt->getType())
+  {
+    case REM:
+      return true;
+    case LET:
+      {
+        auto *let = static_cast<LETStatement *>(stmt);
+        nextTemp = 0;
+        return compileExp(facts.exp, varReg(let->getSlot())) >= 0;
+      }
+    case PRINT:
+      {
+        int reg = compileExp(facts.exp, -1);
+        if (reg < 0)
+          return false;
+        emit(REG_PRINT, 0, reg);
+        nextTemp = 0;
+        return true;
+      }
+    case INPUT:
+      emit(REG_INPUT, varReg(static_cast<INPUTStatement *>(stmt)->getSlot()));
+      return true;
+    case END:
+      emit(REG_HALT, 0);
+      return true;
+    case GOTO:
+      {
+        auto *jump = static_cast<GOTOStatement *>(stmt);
+        addJump(emit(REG_JUMP, 0), jump->getTarget(), jump->getTargetIndex());
+        return true;
+      }
+    case IF:
+      {
+        auto *branch = static_cast<IFStatement *>(stmt);
+        if (facts.branch == BRANCH_NEVER)
+          return true;
+        if (facts.branch == BRANCH_ALWAYS)
+        {
+          addJump(emit(REG_JUMP, 0), branch->getTarget(), branch->getTargetIndex());
+          return true;
+        }
+        std::vector<int> jumps;
+        if (!compileCondition(facts.cond, true, jumps))
+          return false;
+        for (int pc : jumps)
+          addJump(pc, branch->getTarget(), branch->getTargetIndex());
+        return true;
+      }
+    case FOR:
+      {
+        auto *loop = static_cast<FORStatement *>(stmt);
+        int first = tempReg();
+        if (compileExp(facts.exp, first) < 0 || compileExp(facts.lhs, varReg(loop->getLimitSlot())) < 0 ||
+            compileExp(facts.rhs, varReg(loop->getStepSlot())) < 0)
+          return false;
+        emit(REG_MOVE, varReg(loop->getSlot()), first);
+        nextTemp = 0;
+        return true;
+      }
+    case NEXT:
+      return compileNext(static_cast<NEXTStatement *>(stmt), facts);
+    case GOSUB:
+      {
+        auto *call = static_cast<GOSUBStatement *>(stmt);
+        addJump(emit(REG_GOSUB, 0), call->getTarget(), call->getTargetIndex());
+        return true;
+      }
+    case RETURN:
+      emit(REG_RETURN, 0);
+      return true;
+    case ON:
+      return compileOn(static_cast<ONStatement *>(stmt), facts);
+  }
+  return false;
+}
+
+/*
+ * Implementation notes: compileCondition
+ * --------------------------------------
+ * Conditions become chains of conditional jumps exactly as in
+ * Compiler::compileCondition.  The left operand of a relation is read
+ * from a variable register only after the right one has been
+ * computed, so it is copied to a temporary first when computing the
+ * right one might assign it.
+ */
+
+static const RegOpCode RELATION_JUMPS[] = {REG_JUMP_EQ, REG_JUMP_NE, REG_JUMP_LT,
+                                           REG_JUMP_LE, REG_JUMP_GT, REG_JUMP_GE};
+
+bool RegCompiler::compileCondition(Condition *cond, bool when, std::vector<int> &jumps)
+{
+  if (cond->getType() == RELATION)
+    return compileRelation(cond, when, jumps);
+  if ((cond->getType() == CONJUNCTION) != when)
+    return compileCondition(cond->getFirst(), when, jumps) && compileCondition(cond->getSecond(), when, jumps);
+  std::vector<int> skips;
+  if (!compileCondition(cond->getFirst(), !when, skips) || !compileCondition(cond->getSecond(), when, jumps))
+    return false;
+  for (int pc : skips)
+    chunk->code[pc].dst = static_cast<int>(chunk->code.size());
+  return true;
+}
+
+bool RegCompiler::compileRelation(Condition *cond, bool when, std::vector<int> &jumps)
+{
+  Relation relation = when ? cond->getRelation() : negateRelation(cond->getRelation());
+  Expression *lhsExp = cond->getLHS();
+  Expression *rhsExp = cond->getRHS();
+  if (lhsExp->getType() == CONSTANT && rhsExp->getType() == CONSTANT)
+  {
+    int left = static_cast<ConstantExp *>(lhsExp)->getValue();
+    if (compare(relation, left, static_cast<ConstantExp *>(rhsExp)->getValue()))
+      jumps.push_back(emit(REG_JUMP, 0));
+    return true;
+  }
+  int lhs = compileExp(lhsExp, -1);
+  if (lhs < 0)
+    return false;
+  if (isVarReg(lhs) && !isLeaf(rhsExp))
+  {
+    int temp = tempReg();
+    emit(REG_MOVE, temp, lhs);
+    lhs = temp;
+  }
+  int rhs = compileExp(rhsExp, -1);
+  if (rhs < 0)
+    return false;
+  jumps.push_back(emit(RELATION_JUMPS[relation], 0, lhs, rhs));
+  nextTemp = 0;
+  return true;
+}
+
+/*
+ * Implementation notes: compileNext
+ * ---------------------------------
+ * The loop variable is stepped in place and then compared with the
+ * limit: the loop repeats unless the comparison finds the limit passed,
+ * which is > for a step of zero or more and < for a negative one.  A
+ * step that is not constant picks the comparison at run time.
+ */
+
+bool RegCompiler::compileNext(NEXTStatement *next, const LineFacts &facts)
+{
+  auto *loop = static_cast<FORStatement *>(source->getStatementAt(next->getForIndex()));
+  int var = varReg(loop->getSlot());
+  int step = compileExp(facts.exp, -1);
+  int limit = compileExp(facts.rhs, -1);
+  if (step < 0 || limit < 0)
+    return false;
+  int body = source->getLineNumberAt(next->getTargetIndex());
+  auto repeat = [&](RegOpCode passed) {
+    int exit = emit(passed, 0, var, limit);
+    addJump(emit(REG_JUMP, 0), body, next->getTargetIndex());
+    return exit;
+  };
+  emit(REG_ADD, var, var, step);
+  std::vector<int> exits;
+  if (facts.exp->getType() == CONSTANT)
+  {
+    exits.push_back(repeat(static_cast<ConstantExp *>(facts.exp)->getValue() >= 0 ? REG_JUMP_GT : REG_JUMP_LT));
+  }
+  else
+  {
+    int negative = emit(REG_JUMP_LT, 0, step, constReg(0));
+    exits.push_back(repeat(REG_JUMP_GT));
+    chunk->code[negative].dst = static_cast<int>(chunk->code.size());
+    exits.push_back(repeat(REG_JUMP_LT));
+  }
+  for (int exit : exits)
+    chunk->code[exit].dst = static_cast<int>(chunk->code.size());
+  return true;
+}
+
+/*
+ * Implementation notes: compileOn
+ * -------------------------------
+ * As in Compiler::compileOn, the selector indexes a jump table whose
+ * entries are patched like any other jump, and a constant selector
+ * picks its target at compile time.
+ */
+
+bool RegCompiler::compileOn(ONStatement *on, const LineFacts &facts)
+{
+  int count = on->getTargetCount();
+  if (facts.exp->getType() == CONSTANT)
+  {
+    unsigned choice = static_cast<unsigned>(static_cast<ConstantExp *>(facts.exp)->getValue()) - 1u;
+    if (choice < static_cast<unsigned>(count))
+    {
+      int pc = emit(on->isGosub() ? REG_GOSUB : REG_JUMP, 0);
+      addJump(pc, on->getTarget(static_cast<int>(choice)), on->getTargetIndex(static_cast<int>(choice)));
+    }
+    return true;
+  }
+  int selector = compileExp(facts.exp, -1);
+  if (selector < 0)
+    return false;
+  int first = static_cast<int>(chunk->targets.size());
+  int pc = emit(on->isGosub() ? REG_ON_GOSUB : REG_ON_GOTO, first, selector, count);
+  nextTemp = 0;
+  for (int choice = 0; choice < count; choice++)
+  {
+    chunk->targets.push_back(-1);
+    addJump(pc, on->getTarget(choice), on->getTargetIndex(choice), first + choice);
+  }
+  return true;
+}
+
+/*
+ * Implementation notes: compileExp
+ * --------------------------------
+ * Returns the register that holds the value of exp, or -1 if exp can't
+ * be compiled.  If dst is a register, the result is written there by
+ * the last instruction of the expression.  Leaves cost no instruction
+ * unless a destination is requested.
+ *
+ * Operands are read when the instruction runs rather than when the
+ * tree walker would have read them.  When the left operand is a
+ * variable and the right operand is not a leaf, the right side may
+ * assign that variable or fail first, so the left value is copied into
+ * a temporary beforehand to keep the evaluation order of
+ * CompoundExp::eval.
+ */
+
+int RegCompiler::compileExp(Expression *exp, int dst)
+{
+  int reg;
+  switch (exp->getType())
+  {
+    case CONSTANT:
+      reg = constReg(static_cast<ConstantExp *>(exp)->getValue());
+      break;
+    case IDENTIFIER:
+      reg = varReg(static_cast<IdentifierExp *>(exp)->getSlot());
+      break;
+    case NEGATE:
+      {
+        int mark = nextTemp;
+        int operand = compileExp(static_cast<NegateExp *>(exp)->getOperand(), -1);
+        if (operand < 0)
+          return -1;
+        nextTemp = mark;
+        if (dst < 0)
+          dst = tempReg();
+        emit(REG_SUB, dst, constReg(0), operand);
+        return dst;
+      }
+    case FLAT:
+      return -1;
+    case COMPOUND:
+    default:
+      reg = -1;
+      break;
+  }
+  if (reg >= 0)
+  {
+    if (dst < 0)
+      return reg;
+    emit(REG_MOVE, dst, reg);
+    return dst;
+  }
+
+  auto *compound = static_cast<CompoundExp *>(exp);
+  std::string op = compound->getOp();
+  if (op == "=")
+  {
+    Expression *lhs = compound->getLHS();
+    if (lhs->getType() != IDENTIFIER || lhs->toString() == "LET")
+      return -1;
+    int var = varReg(static_cast<IdentifierExp *>(lhs)->getSlot());
+    if (compileExp(compound->getRHS(), var) < 0)
+      return -1;
+    if (dst < 0 || dst == var)
+      return var;
+    emit(REG_MOVE, dst, var);
+    return dst;
+  }
+
+  RegOpCode code;
+  if (op == "+")
+    code = REG_ADD;
+  else if (op == "-")
+    code = REG_SUB;
+  else if (op == "*")
+    code = REG_MUL;
+  else if (op == "/")
+    code = REG_DIV;
+  else
+    return -1;
+  int mark = nextTemp;
+  int lhs = compileExp(compound->getLHS(), -1);
+  if (lhs < 0)
+    return -1;
+  if (isVarReg(lhs) && !isLeaf(compound->getRHS()))
+  {
+    int temp = tempReg();
+    emit(REG_MOVE, temp, lhs);
+    lhs = temp;
+  }
+  int rhs = compileExp(compound->getRHS(), -1);
+  if (rhs < 0)
+    return -1;
+  nextTemp = mark;
+  if (dst < 0)
+    dst = tempReg();
+  emit(code, dst, lhs, rhs);
+  return dst;
+}
+
+void RegCompiler::addJump(int pc, int lineNumber, int lineIndex, int entry)
+{
+  pending.push_back({pc, lineNumber, flow.skipsPreheader(currentLine, lineIndex), entry});
+}
+
+int RegCompiler::varReg(int slot)
+{
+  auto it = vars.find(slot);
+  if (it != vars.end())
+    return it->second;
+  int reg = static_cast<int>(chunk->slots.size());
+  chunk->slots.push_back(slot);
+  vars[slot] = reg;
+  return reg;
+}
+
+int RegCompiler::constReg(int value)
+{
+  auto it = consts.find(value);
+  if (it != consts.end())
+    return it->second;
+  int reg = CONST_TAG + static_cast<int>(chunk->constants.size());
+  chunk->constants.push_back(value);
+  consts[value] = reg;
+  return reg;
+}
+
+int RegCompiler::tempReg()
+{
+  if (nextTemp == chunk->numTemps)
+    chunk->numTemps++;
+  return TEMP_TAG + nextTemp++;
+}
+
+bool RegCompiler::isVarReg(int reg) const { return reg < CONST_TAG; }
+
+int RegCompiler::emit(RegOpCode op, int dst, int a, int b)
+{
+  chunk->code.push_back({op, dst, a, b});
+  return static_cast<int>(chunk->code.size()) - 1;
+}
+
+void RegVM::run(const RegChunk &chunk, EvalState &state)
+{
+  std::size_t num_vars = chunk.slots.size();
+  std::size_t size = num_vars + chunk.constants.size() + chunk.numTemps;
+  regs.assign(size, 0);
+  defined.assign(size, 1);
+  for (std::size_t i = 0; i < num_vars; i++)
+  {
+    defined[i] = state.isDefined(chunk.slots[i]);
+    if (defined[i])
+      regs[i] = state.getValue(chunk.slots[i]);
+  }
+  for (std::size_t i = 0; i < chunk.constants.size(); i++)
+  {
+    regs[num_vars + i] = chunk.constants[i];
+  }
+  if (calls.size() < static_cast<std::size_t>(chunk.callDepth))
+    calls.resize(chunk.callDepth);
+  VMStatus status = execute(chunk);
+  for (std::size_t i = 0; i < num_vars; i++)
+  {
+    if (defined[i])
+      state.setValue(chunk.slots[i], regs[i]);
+  }
+  raiseStatus(status);
+}
+
+/*
+ * Implementation notes: execute
+ * -----------------------------
+ * Constants and temporaries are always marked as defined, so a single
+ * check of both source registers covers every case.
+ */
+
+VMStatus RegVM::execute(const RegChunk &chunk)
+{
+  const RegInstruction *code = chunk.code.data();
+  const int *targets = chunk.targets.data();
+  int *r = regs.data();
+  char *set = defined.data();
+  int *const call_base = calls.data();
+  int *const calls_end = call_base + chunk.callDepth;
+  int *rp = call_base;
+  int pc = 0;
+  while (true)
+  {
+    const RegInstruction &ins = code[pc++];
+    switch (ins.op)
+    {
+      case REG_MOVE:
+        if (!set[ins.a])
+          return VM_VARIABLE_NOT_DEFINED;
+        r[ins.dst] = r[ins.a];
+        set[ins.dst] = 1;
+        break;
+      case REG_ADD:
+        if (!(set[ins.a] & set[ins.b]))
+          return VM_VARIABLE_NOT_DEFINED;
+        r[ins.dst] = r[ins.a] + r[ins.b];
+        set[ins.dst] = 1;
+        break;
+      case REG_SUB:
+        if (!(set[ins.a] & set[ins.b]))
+          return VM_VARIABLE_NOT_DEFINED;
+        r[ins.dst] = r[ins.a] - r[ins.b];
+        set[ins.dst] = 1;
+        break;
+      case REG_MUL:
+        if (!(set[ins.a] & set[ins.b]))
+          return VM_VARIABLE_NOT_DEFINED;
+        r[ins.dst] = r[ins.a] * r[ins.b];
+        set[ins.dst] = 1;
+        break;
+      case REG_DIV:
+        if (!(set[ins.a] & set[ins.b]))
+          return VM_VARIABLE_NOT_DEFINED;
+        if (r[ins.b] == 0)
+          return VM_DIVIDE_BY_ZERO;
+        r[ins.dst] = r[ins.a] / r[ins.b];
+        set[ins.dst] = 1;
+        break;
+      case REG_PRINT:
+        if (!set[ins.a])
+          return VM_VARIABLE_NOT_DEFINED;
+        std::cout << r[ins.a] << "\n";
+        break;
+      case REG_INPUT:
+        r[ins.dst] = readInputValue();
+        set[ins.dst] = 1;
+        break;
+      case REG_JUMP:
+        pc = ins.dst;
+        break;
+      case REG_JUMP_EQ:
+        if (!(set[ins.a] & set[ins.b]))
+          return VM_VARIABLE_NOT_DEFINED;
+        if (r[ins.a] == r[ins.b])
+          pc = ins.dst;
+        break;
+      case REG_JUMP_NE:
+        if (!(set[ins.a] & set[ins.b]))
+          return VM_VARIABLE_NOT_DEFINED;
+        if (r[ins.a] != r[ins.b])
+          pc = ins.dst;
+        break;
+      case REG_JUMP_LT:
+        if (!(set[ins.a] & set[ins.b]))
+          return VM_VARIABLE_NOT_DEFINED;
+        if (r[ins.a] < r[ins.b])
+          pc = ins.dst;
+        break;
+      case REG_JUMP_LE:
+        if (!(set[ins.a] & set[ins.b]))
+          return VM_VARIABLE_NOT_DEFINED;
+        if (r[ins.a] <= r[ins.b])
+          pc = ins.dst;
+        break;
+      case REG_JUMP_GT:
+        if (!(set[ins.a] & set[ins.b]))
+          return VM_VARIABLE_NOT_DEFINED;
+        if (r[ins.a] > r[ins.b])
+          pc = ins.dst;
+        break;
+      case REG_JUMP_GE:
+        if (!(set[ins.a] & set[ins.b]))
+          return VM_VARIABLE_NOT_DEFINED;
+        if (r[ins.a] >= r[ins.b])
+          pc = ins.dst;
+        break;
+      case REG_LINE_ERROR:
+        return VM_LINE_NUMBER_ERROR;
+      case REG_HALT:
+        return VM_HALT;
+      case REG_GOSUB:
+        if (rp == calls_end)
+          return VM_GOSUB_OVERFLOW;
+        *rp++ = pc;
+        pc = ins.dst;
+        break;
+      case REG_RETURN:
+        if (rp == call_base)
+          return VM_RETURN_WITHOUT_GOSUB;
+        pc = *--rp;
+        break;
+      case REG_ON_GOTO:
+      case REG_ON_GOSUB:
+        {
+          if (!set[ins.a])
+            return VM_VARIABLE_NOT_DEFINED;
+          unsigned choice = static_cast<unsigned>(r[ins.a]) - 1u;
+          if (choice >= static_cast<unsigned>(ins.b))
+            break;
+          int target = targets[ins.dst + choice];
+          if (target < 0)
+            return VM_LINE_NUMBER_ERROR;
+          if (ins.op == REG_ON_GOSUB)
+          {
+            if (rp == calls_end)
+              return VM_GOSUB_OVERFLOW;
+            *rp++ = pc;
+          }
+          pc = target;
+          break;
+        }
+    }
+  }
+}
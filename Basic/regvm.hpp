@@ -0,0 +1,183 @@
+/*
+ * File: regvm.h
+ * -------------
+ * This interface exports a register-machine variant of the VM.  Every
+ * variable, constant and temporary of the program lives in a register,
+ * and arithmetic is expressed as three-address instructions, so that
+ * LET X = X + Y * 2 becomes
+ *
+ *    MUL t0, Y, #2
+ *    ADD X, X, t0
+ */
+
+#ifndef _regvm_h
+#define _regvm_h
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "dataflow.hpp"
+#include "evalstate.hpp"
+#include "exp.hpp"
+#include "program.hpp"
+#include "statement.hpp"
+#include "vm.hpp"
+
+/*
+ * Type: RegOpCode
+ * ---------------
+ * The register instruction set.  a and b name source registers, dst
+ * the destination and target an instruction index.  Reading a variable
+ * register that has never been assigned is VARIABLE NOT DEFINED.
+ *
+ *   REG_MOVE dst, a             dst = a
+ *   REG_ADD .. REG_DIV dst, a, b   dst = a op b
+ *   REG_PRINT a                 print a
+ *   REG_INPUT dst               prompt for an integer into dst
+ *   REG_JUMP target
+ *   REG_JUMP_EQ .. REG_JUMP_GE a, b, target
+ *                               jump if a =, <>, <, <=, > or >= b
+ *   REG_LINE_ERROR, REG_HALT
+ *   REG_GOSUB target            push the next index, jump to target
+ *   REG_RETURN                  pop an index and continue there
+ *   REG_ON_GOTO first, a, n     jump to targets[first + a - 1] if
+ *                               1 <= a <= n, or fall through
+ *   REG_ON_GOSUB first, a, n    as REG_ON_GOTO, pushing the next index
+ *                               before the jump
+ *
+ * A target of -1 in targets is a missing line, which stops with LINE
+ * NUMBER ERROR when chosen.
+ */
+
+enum RegOpCode : std::uint8_t
+{
+  REG_MOVE,
+  REG_ADD,
+  REG_SUB,
+  REG_MUL,
+  REG_DIV,
+  REG_PRINT,
+  REG_INPUT,
+  REG_JUMP,
+  REG_JUMP_EQ,
+  REG_JUMP_NE,
+  REG_JUMP_LT,
+  REG_JUMP_LE,
+  REG_JUMP_GT,
+  REG_JUMP_GE,
+  REG_LINE_ERROR,
+  REG_HALT,
+  REG_GOSUB,
+  REG_RETURN,
+  REG_ON_GOTO,
+  REG_ON_GOSUB
+};
+
+struct RegInstruction
+{
+  RegOpCode op;
+  int dst;
+  int a;
+  int b;
+};
+
+/*
+ * Type: RegChunk
+ * --------------
+ * A compiled program.  Registers are laid out as the program variables
+ * (register i holds the EvalState slot slots[i]), then the constant
+ * pool, then numTemps temporaries.  At most callDepth REG_GOSUB can be
+ * active at once.  targets holds the jump tables of the REG_ON_*
+ * instructions.
+ */
+
+struct RegChunk
+{
+  std::vector<RegInstruction> code;
+  std::vector<int> targets;
+  std::vector<int> slots;
+  std::vector<int> constants;
+  int numTemps = 0;
+  int callDepth = 0;
+};
+
+/*
+ * Class: RegCompiler
+ * ------------------
+ * Lowers a Program to a RegChunk.  Like Compiler, it skips the lines
+ * Dataflow finds cannot run and returns false for programs it cannot
+ * express so the caller can fall back.
+ */
+
+class RegCompiler
+{
+public:
+  bool compile(Program &program, RegChunk &chunk);
+
+private:
+  struct PendingJump
+  {
+    int pc;
+    int lineNumber;
+    bool inLoop;
+    int entry;
+  };
+
+  RegChunk *chunk = nullptr;
+  Program *source = nullptr;
+  Dataflow flow;
+  std::unordered_map<int, int> vars;
+  std::unordered_map<int, int> consts;
+  std::unordered_map<int, int> linePc;
+  std::unordered_map<int, int> bodyPc;
+  std::vector<PendingJump> pending;
+  std::vector<int> tempRegs;
+  int nextTemp = 0;
+  int currentLine = 0;
+
+  bool compileStatement(Statement *stmt, const LineFacts &facts);
+
+  bool compileCondition(Condition *cond, bool when, std::vector<int> &jumps);
+
+  bool compileRelation(Condition *cond, bool when, std::vector<int> &jumps);
+
+  bool compileNext(NEXTStatement *next, const LineFacts &facts);
+
+  bool compileOn(ONStatement *on, const LineFacts &facts);
+
+  int compileExp(Expression *exp, int dst);
+
+  void addJump(int pc, int lineNumber, int lineIndex, int entry = -1);
+
+  int varReg(int slot);
+
+  int constReg(int value);
+
+  int tempReg();
+
+  bool isVarReg(int reg) const;
+
+  int emit(RegOpCode op, int dst, int a = 0, int b = 0);
+};
+
+/*
+ * Class: RegVM
+ * ------------
+ * Runs a RegChunk.  Variables are exchanged with the EvalState on entry
+ * and exit in the same way as VM::run.
+ */
+
+class RegVM
+{
+public:
+  void run(const RegChunk &chunk, EvalState &state);
+
+private:
+  std::vector<int> regs;
+  std::vector<char> defined;
+  std::vector<int> calls;
+
+  VMStatus execute(const RegChunk &chunk);
+};
+
+#endif
@@ -16,346 +16,480 @@ bool isVariable(const std::string &var);
 
 bool isNumber(const std::string &temp);
 
-int GetValue(TokenScanner &token_scanner, EvalState &state);
+Expression *parseRest(TokenScanner &token_scanner, Arena &arena);
 
-bool check(char op, int lvalue, int rvalue);
+Expression *parseSpan(const std::string &text, Arena &arena);
+
+int parseLineNumber(TokenScanner &token_scanner);
 
 Statement::Statement() = default;
 
 Statement::~Statement() = default;
 
-REMStatement::REMStatement(const std::string &line) { this->line = line; }
+REMStatement::REMStatement(const std::string &line) {}
 
-void REMStatement::execute(EvalState &state, Program &program)
+ErrorCode REMStatement::execute(EvalState &state, Program &program)
 {
   program.adjustGOTO(false);
   program.gotoNextLine();
+  return ERR_NONE;
 }
 
 void REMStatement::dir_execute(EvalState &state, Program &program) { program.adjustGOTO(false); }
 
-LETStatement::LETStatement(const std::string &line) { this->line = line; }
-
-void LETStatement::execute(EvalState &state, Program &program)
+LETStatement::LETStatement(const std::string &line, Arena &arena)
 {
-  program.adjustGOTO(false);
   TokenScanner token_scanner;
   token_scanner.ignoreWhitespace();
-  // token_scanner.scanNumbers();
-  token_scanner.setInput(line);
+  token_scanner.setInputView(line);
   token_scanner.nextToken();
   std::string var = token_scanner.nextToken();
-  if (!isVariable(var))
-  {
-    error("SYNTAX ERROR");
-  }
-  if (token_scanner.nextToken() == "=")
-  {
-    int value = GetValue(token_scanner, state);
-    state.setValue(var, value);
-    program.gotoNextLine();
-  }
-  else
+  if (!isVariable(var) || token_scanner.nextToken() != "=")
   {
     error("SYNTAX ERROR");
   }
+  slot = internSymbol(var);
+  exp = parseRest(token_scanner, arena);
+  flat = FlatExp::flatten(exp, arena);
+}
+
+ErrorCode LETStatement::execute(EvalState &state, Program &program)
+{
+  program.adjustGOTO(false);
+  EvalResult result = flat->evaluate(state);
+  if (result.error != ERR_NONE)
+    return result.error;
+  state.setValue(slot, result.value);
+  program.gotoNextLine();
+  return ERR_NONE;
 }
 
 void LETStatement::dir_execute(EvalState &state, Program &program)
 {
   program.adjustGOTO(false);
+  state.setValue(slot, flat->eval(state));
+}
+
+PRINTStatement::PRINTStatement(const std::string &line, Arena &arena)
+{
   TokenScanner token_scanner;
   token_scanner.ignoreWhitespace();
   token_scanner.scanNumbers();
-  token_scanner.setInput(line);
+  token_scanner.setInputView(line);
   token_scanner.nextToken();
-  std::string var = token_scanner.nextToken();
-  if (!isVariable(var))
-  {
-    error("SYNTAX ERROR");
-  }
-  if (token_scanner.nextToken() == "=")
-  {
-    int value = GetValue(token_scanner, state);
-    state.setValue(var, value);
-  }
-  else
-  {
-    error("SYNTAX ERROR");
-  }
+  exp = parseRest(token_scanner, arena);
+  flat = FlatExp::flatten(exp, arena);
 }
 
-PRINTStatement::PRINTStatement(const std::string &line) { this->line = line; }
-
-void PRINTStatement::execute(EvalState &state, Program &program)
+ErrorCode PRINTStatement::execute(EvalState &state, Program &program)
 {
   program.adjustGOTO(false);
-  TokenScanner token_scanner;
-  token_scanner.ignoreWhitespace();
-  token_scanner.scanNumbers();
-  token_scanner.setInput(line);
-  token_scanner.nextToken();
-  int value = GetValue(token_scanner, state);
-  if (value == -1919810)
-  {
-    program.end();
-    return;
-  }
-  if (value != -114514)
-  {
-    std::cout << value << "\n";
-  }
+  EvalResult result = flat->evaluate(state);
+  if (result.error != ERR_NONE)
+    return result.error;
+  std::cout << result.value << "\n";
   program.gotoNextLine();
+  return ERR_NONE;
 }
 
 void PRINTStatement::dir_execute(EvalState &state, Program &program)
 {
   program.adjustGOTO(false);
-  TokenScanner token_scanner;
-  token_scanner.ignoreWhitespace();
-  token_scanner.scanNumbers();
-  token_scanner.setInput(line);
-  token_scanner.nextToken();
-  int value = GetValue(token_scanner, state);
-  if (value == -1919810)
-  {
-    program.end();
-    return;
-  }
-  if (value != -114514)
-  {
-    std::cout << value << "\n";
-  }
+  std::cout << flat->eval(state) << "\n";
 }
 
-INPUTStatement::INPUTStatement(const std::string &line) { this->line = line; }
-
-void INPUTStatement::execute(EvalState &state, Program &program)
+INPUTStatement::INPUTStatement(const std::string &line)
 {
-  program.adjustGOTO(false);
-  std::cout << " ? ";
   TokenScanner token_scanner;
   token_scanner.ignoreWhitespace();
-  // token_scanner.scanNumbers();
-  token_scanner.setInput(line);
+  token_scanner.setInputView(line);
   token_scanner.nextToken();
   std::string var = token_scanner.nextToken();
-  std::string temp;
-  int value;
-  while (true)
+  if (!isVariable(var) || token_scanner.hasMoreTokens())
   {
-    getline(std::cin, temp);
-    if (!isNumber(temp))
-    {
-      std::cout << "INVALID NUMBER\n"
-                << " ? ";
-    }
-    else
-    {
-      value = stringToInteger(temp);
-      break;
-    }
+    error("SYNTAX ERROR");
   }
-  state.setValue(var, value);
+  slot = internSymbol(var);
+}
+
+ErrorCode INPUTStatement::execute(EvalState &state, Program &program)
+{
+  dir_execute(state, program);
   program.gotoNextLine();
+  return ERR_NONE;
 }
 
 void INPUTStatement::dir_execute(EvalState &state, Program &program)
 {
   program.adjustGOTO(false);
+  state.setValue(slot, readInputValue());
+}
+
+int readInputValue()
+{
   std::cout << " ? ";
-  TokenScanner token_scanner;
-  token_scanner.ignoreWhitespace();
-  token_scanner.scanNumbers();
-  token_scanner.setInput(line);
-  token_scanner.nextToken();
-  std::string var = token_scanner.nextToken();
   std::string temp;
-  int value;
   while (true)
   {
     getline(std::cin, temp);
-    if (!isNumber(temp))
+    if (isNumber(temp))
     {
-      std::cout << "INVALID NUMBER\n"
-                << " ? ";
-    }
-    else
-    {
-      value = stringToInteger(temp);
-      break;
+      return stringToInteger(temp);
     }
+    std::cout << "INVALID NUMBER\n"
+              << " ? ";
   }
-  state.setValue(var, value);
 }
 
 ENDStatement::ENDStatement() = default;
 
-void ENDStatement::execute(EvalState &state, Program &program) { program.end(); }
+ErrorCode ENDStatement::execute(EvalState &state, Program &program)
+{
+  program.end();
+  return ERR_NONE;
+}
 
 void ENDStatement::dir_execute(EvalState &state, Program &program) { program.end(); }
 
-GOTOStatement::GOTOStatement(const std::string &line) { this->line = line; }
-
-void GOTOStatement::execute(EvalState &state, Program &program)
+GOTOStatement::GOTOStatement(const std::string &line)
 {
-  program.adjustGOTO(true);
   TokenScanner token_scanner;
   token_scanner.ignoreWhitespace();
   token_scanner.scanNumbers();
-  token_scanner.setInput(line);
+  token_scanner.setInputView(line);
   token_scanner.nextToken();
-  int lineNumber = stringToInteger(token_scanner.nextToken());
-  program.gotoLineNumber(lineNumber);
+  target = parseLineNumber(token_scanner);
 }
 
+ErrorCode GOTOStatement::execute(EvalState &state, Program &program) { return program.jumpTo(targetIndex); }
+
 void GOTOStatement::dir_execute(EvalState &state, Program &program)
 {
   program.adjustGOTO(true);
+  program.gotoLineNumber(target);
+}
+
+/*
+ * The condition runs up to the THEN keyword, which cannot occur inside
+ * it since it cannot name a variable.  It is parsed here, once, so
+ * execute only has to test the tree.  If the line turns out to be
+ * malformed, the nodes already built are released with the arena.
+ */
+
+IFStatement::IFStatement(const std::string &line, Arena &arena)
+{
   TokenScanner token_scanner;
   token_scanner.ignoreWhitespace();
   token_scanner.scanNumbers();
-  token_scanner.setInput(line);
+  token_scanner.addOperator("<>");
+  token_scanner.addOperator("<=");
+  token_scanner.addOperator(">=");
+  token_scanner.setInputView(line);
   token_scanner.nextToken();
-  int lineNumber = stringToInteger(token_scanner.nextToken());
-  program.gotoLineNumber(lineNumber);
+  try
+  {
+    cond = parseCondition(token_scanner, arena);
+  }
+  catch (ErrorException &ex)
+  {
+    error("SYNTAX ERROR");
+  }
+  if (token_scanner.nextToken() != "THEN")
+  {
+    error("SYNTAX ERROR");
+  }
+  target = parseLineNumber(token_scanner);
+  flat = cond->flatten(arena);
+}
+
+ErrorCode IFStatement::execute(EvalState &state, Program &program)
+{
+  EvalResult holds = flat->evaluate(state);
+  if (holds.error != ERR_NONE)
+    return holds.error;
+  if (holds.value)
+    return program.jumpTo(targetIndex);
+  program.gotoNextLine();
+  return ERR_NONE;
+}
+
+void IFStatement::dir_execute(EvalState &state, Program &program)
+{
+  if (flat->test(state))
+  {
+    program.adjustGOTO(true);
+    program.gotoLineNumber(target);
+  }
+  else
+    program.gotoNextLine();
 }
 
-IFStatement::IFStatement(const std::string &line) { this->line = line; }
+/*
+ * The three expressions are separated by the TO and STEP keywords,
+ * which cannot occur inside an expression since neither can name a
+ * variable.  Each one is collected token by token and parsed on its
+ * own.  The hidden variables hold a character that no BASIC name can,
+ * like the temporaries of the optimizer.
+ */
 
-void IFStatement::execute(EvalState &state, Program &program)
+FORStatement::FORStatement(const std::string &line, Arena &arena)
 {
-  int cmp = 0;
-  while (line[cmp] != '=' && line[cmp] != '>' && line[cmp] != '<')
+  TokenScanner token_scanner;
+  token_scanner.ignoreWhitespace();
+  token_scanner.scanNumbers();
+  token_scanner.setInputView(line);
+  token_scanner.nextToken();
+  std::string var = token_scanner.nextToken();
+  if (!isVariable(var) || token_scanner.nextToken() != "=")
   {
-    cmp++;
+    error("SYNTAX ERROR");
   }
-  char op = line[cmp];
-  std::string left_exp = line.substr(3, cmp - 3);
-  TokenScanner left_scanner;
-  left_scanner.ignoreWhitespace();
-  // left_scanner.scanNumbers();
-  left_scanner.setInput(left_exp);
-  int left_value = GetValue(left_scanner, state);
-  if (left_value == -1919810)
+  std::string parts[3];
+  int part = 0;
+  while (token_scanner.hasMoreTokens())
   {
-    program.end();
-    return;
+    std::string token = token_scanner.nextToken();
+    if ((token == "TO" && part == 0) || (token == "STEP" && part == 1))
+      part++;
+    else
+      parts[part] += token + " ";
   }
-  int r_begin = cmp + 1;
-  while (line[r_begin] == ' ')
+  if (part == 0)
   {
-    r_begin++;
+    error("SYNTAX ERROR");
   }
-  int r_end = r_begin;
-  while (line[r_end + 1] != 'T' || line[r_end + 2] != 'H' || line[r_end + 3] != 'E' || line[r_end + 4] != 'N')
+  slot = internSymbol(var);
+  limitSlot = internSymbol("$TO " + var);
+  stepSlot = internSymbol("$STEP " + var);
+  start = parseSpan(parts[0], arena);
+  limit = parseSpan(parts[1], arena);
+  step = part == 1 ? new (arena) ConstantExp(1) : parseSpan(parts[2], arena);
+  flatStart = FlatExp::flatten(start, arena);
+  flatLimit = FlatExp::flatten(limit, arena);
+  flatStep = FlatExp::flatten(step, arena);
+}
+
+ErrorCode FORStatement::execute(EvalState &state, Program &program)
+{
+  EvalResult first = flatStart->evaluate(state);
+  if (first.error != ERR_NONE)
+    return first.error;
+  EvalResult last = flatLimit->evaluate(state);
+  if (last.error != ERR_NONE)
+    return last.error;
+  EvalResult by = flatStep->evaluate(state);
+  if (by.error != ERR_NONE)
+    return by.error;
+  state.setValue(slot, first.value);
+  ErrorCode code = program.openLoop(slot, last.value, by.value);
+  if (code != ERR_NONE)
+    return code;
+  program.gotoNextLine();
+  return ERR_NONE;
+}
+
+void FORStatement::dir_execute(EvalState &state, Program &program) { error("SYNTAX ERROR"); }
+
+NEXTStatement::NEXTStatement(const std::string &line)
+{
+  TokenScanner token_scanner;
+  token_scanner.ignoreWhitespace();
+  token_scanner.setInputView(line);
+  token_scanner.nextToken();
+  if (!token_scanner.hasMoreTokens())
+    return;
+  std::string var = token_scanner.nextToken();
+  if (!isVariable(var) || token_scanner.hasMoreTokens())
   {
-    r_end++;
+    error("SYNTAX ERROR");
   }
-  std::string right_exp = line.substr(r_begin, r_end - r_begin + 1);
-  TokenScanner right_scanner;
-  right_scanner.ignoreWhitespace();
-  // right_scanner.scanNumbers();
-  right_scanner.setInput(right_exp);
-  int right_value = GetValue(right_scanner, state);
-  if (right_value == -1919810)
+  slot = internSymbol(var);
+}
+
+/*
+ * This is the counted-loop step of the tree walker: one addition, one
+ * comparison against the limit fixed at the FOR, and a jump to the
+ * saved body position.  A positive or zero step runs up to the limit
+ * and a negative one down to it.
+ */
+
+ErrorCode NEXTStatement::execute(EvalState &state, Program &program)
+{
+  LoopFrame *frame = program.findLoop(slot);
+  if (frame == nullptr)
   {
-    program.end();
-    return;
+    return ERR_NEXT_WITHOUT_FOR;
   }
-  if (check(op, left_value, right_value))
+  int value = state.getValue(frame->slot) + frame->step;
+  state.setValue(frame->slot, value);
+  if (frame->step >= 0 ? value <= frame->limit : value >= frame->limit)
   {
-    std::string then_exp = line.substr(r_end + 1);
-    TokenScanner scanner;
-    scanner.ignoreWhitespace();
-    scanner.scanNumbers();
-    scanner.setInput(then_exp);
-    scanner.nextToken();
-    int lineNumber = stringToInteger(scanner.nextToken());
-    program.adjustGOTO(true);
-    program.gotoLineNumber(lineNumber);
+    if (frame->body < 0)
+      program.end();
+    else
+      program.jumpTo(frame->body);
+    return ERR_NONE;
   }
-  else
-    program.gotoNextLine();
+  program.closeLoop();
+  program.gotoNextLine();
+  return ERR_NONE;
 }
 
-void IFStatement::dir_execute(EvalState &state, Program &program)
+void NEXTStatement::dir_execute(EvalState &state, Program &program) { error("SYNTAX ERROR"); }
+
+GOSUBStatement::GOSUBStatement(const std::string &line)
+{
+  TokenScanner token_scanner;
+  token_scanner.ignoreWhitespace();
+  token_scanner.scanNumbers();
+  token_scanner.setInputView(line);
+  token_scanner.nextToken();
+  target = parseLineNumber(token_scanner);
+}
+
+ErrorCode GOSUBStatement::execute(EvalState &state, Program &program) { return program.callSubroutine(targetIndex); }
+
+void GOSUBStatement::dir_execute(EvalState &state, Program &program) { error("SYNTAX ERROR"); }
+
+RETURNStatement::RETURNStatement(const std::string &line)
+{
+  TokenScanner token_scanner;
+  token_scanner.ignoreWhitespace();
+  token_scanner.setInputView(line);
+  token_scanner.nextToken();
+  if (token_scanner.hasMoreTokens())
+  {
+    error("SYNTAX ERROR");
+  }
+}
+
+ErrorCode RETURNStatement::execute(EvalState &state, Program &program) { return program.returnFromSubroutine(); }
+
+void RETURNStatement::dir_execute(EvalState &state, Program &program) { error("SYNTAX ERROR"); }
+
+/*
+ * The selector runs up to the GOTO or GOSUB keyword and is parsed like
+ * the parts of a FOR.  The targets that follow are line numbers
+ * separated by commas; they are gathered first so that the arrays can
+ * be allocated at their final size.
+ */
+
+ONStatement::ONStatement(const std::string &line, Arena &arena)
 {
-  int cmp = 0;
-  while (line[cmp] != '=' && line[cmp] != '>' && line[cmp] != '<')
+  TokenScanner token_scanner;
+  token_scanner.ignoreWhitespace();
+  token_scanner.scanNumbers();
+  token_scanner.setInputView(line);
+  token_scanner.nextToken();
+  std::string selector;
+  std::string token;
+  while (token_scanner.hasMoreTokens())
   {
-    cmp++;
+    token = token_scanner.nextToken();
+    if (token == "GOTO" || token == "GOSUB")
+      break;
+    selector += token + " ";
   }
-  char op = line[cmp];
-  std::string left_exp = line.substr(3, cmp - 3);
-  TokenScanner left_scanner;
-  left_scanner.ignoreWhitespace();
-  left_scanner.scanNumbers();
-  left_scanner.setInput(left_exp);
-  int left_value = GetValue(left_scanner, state);
-  int r_begin = cmp + 1;
-  while (line[r_begin] == ' ')
+  if ((token != "GOTO" && token != "GOSUB") || selector.empty())
   {
-    r_begin++;
+    error("SYNTAX ERROR");
   }
-  int r_end = r_begin;
-  while (line[r_end + 1] != 'T' || line[r_end + 2] != 'H' || line[r_end + 3] != 'E' || line[r_end + 4] != 'N')
+  gosub = token == "GOSUB";
+  std::vector<int> numbers;
+  while (true)
   {
-    r_end++;
+    token = token_scanner.nextToken();
+    if (token_scanner.getTokenType(token) != NUMBER)
+    {
+      error("SYNTAX ERROR");
+    }
+    try
+    {
+      numbers.push_back(stringToInteger(token));
+    }
+    catch (ErrorException &ex)
+    {
+      error("SYNTAX ERROR");
+    }
+    if (!token_scanner.hasMoreTokens())
+      break;
+    if (token_scanner.nextToken() != ",")
+    {
+      error("SYNTAX ERROR");
+    }
   }
-  std::string right_exp = line.substr(r_begin, r_end - r_begin + 1);
-  TokenScanner right_scanner;
-  right_scanner.ignoreWhitespace();
-  right_scanner.scanNumbers();
-  right_scanner.setInput(right_exp);
-  int right_value = GetValue(right_scanner, state);
-  if (check(op, left_value, right_value))
+  exp = parseSpan(selector, arena);
+  flat = FlatExp::flatten(exp, arena);
+  count = static_cast<int>(numbers.size());
+  targets = static_cast<int *>(arena.allocate(count * sizeof(int), alignof(int)));
+  targetIndices = static_cast<int *>(arena.allocate(count * sizeof(int), alignof(int)));
+  for (int i = 0; i < count; i++)
   {
-    std::string then_exp = line.substr(r_end + 1);
-    TokenScanner scanner;
-    scanner.ignoreWhitespace();
-    scanner.scanNumbers();
-    scanner.setInput(then_exp);
-    scanner.nextToken();
-    int lineNumber = stringToInteger(scanner.nextToken());
-    program.adjustGOTO(true);
-    program.gotoLineNumber(lineNumber);
+    targets[i] = numbers[i];
+    targetIndices[i] = -1;
   }
-  else
+}
+
+ErrorCode ONStatement::execute(EvalState &state, Program &program)
+{
+  EvalResult result = flat->evaluate(state);
+  if (result.error != ERR_NONE)
+    return result.error;
+  unsigned choice = static_cast<unsigned>(result.value) - 1u;
+  if (choice >= static_cast<unsigned>(count))
+  {
     program.gotoNextLine();
+    return ERR_NONE;
+  }
+  if (gosub)
+    return program.callSubroutine(targetIndices[choice]);
+  return program.jumpTo(targetIndices[choice]);
 }
 
-int GetValue(TokenScanner &token_scanner, EvalState &state)
+void ONStatement::dir_execute(EvalState &state, Program &program) { error("SYNTAX ERROR"); }
+
+/*
+ * Reads everything left in the scanner as one expression.  Any parse
+ * failure, including trailing tokens, is reported as SYNTAX ERROR.
+ */
+
+Expression *parseRest(TokenScanner &token_scanner, Arena &arena)
 {
-  Expression *exp = parseExp(token_scanner);
   try
   {
-    const int value = exp->eval(state);
-    delete exp;
-    return value;
+    return parseExp(token_scanner, arena);
   }
   catch (ErrorException &ex)
   {
-    std::cout << ex.getMessage() << std::endl;
-    delete exp;
-    if (ex.getMessage() == "DIVIDE BY ZERO")
-    {
-      return -1919810;
-    }
-    return -114514;
+    error("SYNTAX ERROR");
   }
+  return nullptr;
 }
 
-bool check(const char op, const int lvalue, const int rvalue)
+Expression *parseSpan(const std::string &text, Arena &arena)
 {
-  if (op == '=')
-    return lvalue == rvalue;
-  if (op == '<')
-    return lvalue < rvalue;
-  if (op == '>')
-    return lvalue > rvalue;
-  error("SYNTAX ERROR");
-  return false;
+  TokenScanner token_scanner;
+  token_scanner.ignoreWhitespace();
+  token_scanner.setInputView(text);
+  return parseRest(token_scanner, arena);
+}
+
+int parseLineNumber(TokenScanner &token_scanner)
+{
+  std::string token = token_scanner.nextToken();
+  if (token_scanner.getTokenType(token) != NUMBER || token_scanner.hasMoreTokens())
+  {
+    error("SYNTAX ERROR");
+  }
+  try
+  {
+    return stringToInteger(token);
+  }
+  catch (ErrorException &ex)
+  {
+    error("SYNTAX ERROR");
+  }
+  return -1;
 }
 
 bool isVariable(const std::string &var)
@@ -368,7 +502,8 @@ bool isVariable(const std::string &var)
   }
   if (var == "REM" || var == "LET" || var == "PRINT" || var == "END" || var == "RUN" || var == "INPUT" ||
       var == "GOTO" || var == "IF" || var == "THEN" || var == "QUIT" || var == "LIST" || var == "CLEAR" ||
-      var == "HELP")
+      var == "HELP" || var == "FOR" || var == "TO" || var == "STEP" || var == "NEXT" || var == "GOSUB" ||
+      var == "RETURN" || var == "ON" || var == "AND" || var == "OR" || var == "NOT")
   {
     return false;
   }
@@ -24,6 +24,30 @@
 
 class Program;
 
+/*
+ * Type: StatementType
+ * -------------------
+ * This enumerated type identifies the statement forms that can be
+ * stored in a program.  Compilers switch on it in the same way the
+ * evaluator switches on ExpressionType.
+ */
+
+enum StatementType
+{
+  REM,
+  LET,
+  PRINT,
+  INPUT,
+  END,
+  GOTO,
+  IF,
+  FOR,
+  NEXT,
+  GOSUB,
+  RETURN,
+  ON
+};
+
 /*
  * Class: Statement
  * ----------------
@@ -47,32 +71,54 @@ public:
   Statement();
   /*
    * Destructor: ~Statement
-   * Usage: delete stmt;
-   * -------------------
-   * The destructor deallocates the storage for this expression.
-   * It must be declared virtual to ensure that the correct subclass
-   * destructor is called when deleting a statement.
+   * ----------------------
+   * Statements are allocated in the Arena of their program line, like
+   * the expressions they hold, and are released with it; destructors
+   * are not run, so a statement owns no memory outside the arena.
    */
 
   virtual ~Statement();
 
   /*
    * Method: execute
-   * Usage: stmt->execute(state);
-   * ----------------------------
+   * Usage: ErrorCode code = stmt->execute(state, program);
+   * ------------------------------------------------------
    * This method executes a BASIC statement.  Each of the subclasses
    * defines its own execute method that implements the necessary
    * operations.  As was true for the expression evaluator, this
    * method takes an EvalState object for looking up variables or
-   * controlling the operation of the interpreter.
+   * controlling the operation of the interpreter.  A runtime error is
+   * returned rather than thrown, and the caller decides how to raise
+   * it; dir_execute, which runs a statement typed without a line
+   * number, raises its errors with error().
    */
-  virtual void execute(EvalState &state, Program &program) = 0;
+  virtual ErrorCode execute(EvalState &state, Program &program) = 0;
 
   virtual void dir_execute(EvalState &state, Program &program) = 0;
 
+  /*
+   * Method: getType
+   * Usage: StatementType type = stmt->getType();
+   * --------------------------------------------
+   * Returns the form of this statement, so that code other than the
+   * tree walker can inspect the parsed representation.
+   */
+
+  virtual StatementType getType() const = 0;
+
 private:
 };
 
+/*
+ * Function: readInputValue
+ * Usage: int value = readInputValue();
+ * ------------------------------------
+ * Prompts with " ? " and reads lines from std::cin until one holds a
+ * valid integer, printing INVALID NUMBER for every rejected line.
+ */
+
+int readInputValue();
+
 
 /*
  * The remainder of this file must consists of subclass
@@ -87,7 +133,6 @@ private:
 
 class REMStatement : public Statement
 {
-  std::string line;
   friend Program;
   friend void direct_execute(std::string &line, Program &program, EvalState &state);
 
@@ -95,44 +140,72 @@ class REMStatement : public Statement
 
   ~REMStatement() override = default;
 
-  void execute(EvalState &state, Program &program) override;
+  ErrorCode execute(EvalState &state, Program &program) override;
 
   void dir_execute(EvalState &state, Program &program) override;
+
+public:
+  StatementType getType() const override { return REM; }
 };
 
+/*
+ * The statements below are parsed once, when the line is entered.
+ * A malformed line raises SYNTAX ERROR from the constructor, so a
+ * successfully constructed statement only evaluates the trees it owns.
+ * Each tree is kept for the compilers and also flattened with
+ * FlatExp::flatten, and execute evaluates the flattened form.
+ */
+
 class LETStatement : public Statement
 {
-  std::string line;
+  int slot = -1;
+  Expression *exp = nullptr;
+  Expression *flat = nullptr;
   friend Program;
   friend void direct_execute(std::string &line, Program &program, EvalState &state);
 
-  LETStatement(const std::string &line);
+  LETStatement(const std::string &line, Arena &arena);
 
   ~LETStatement() override = default;
 
-  void execute(EvalState &state, Program &program) override;
+  ErrorCode execute(EvalState &state, Program &program) override;
 
   void dir_execute(EvalState &state, Program &program) override;
+
+public:
+  StatementType getType() const override { return LET; }
+
+  const std::string &getVar() const { return getSymbolName(slot); }
+
+  int getSlot() const { return slot; }
+
+  Expression *getExp() const { return exp; }
 };
 
 class PRINTStatement : public Statement
 {
-  std::string line;
+  Expression *exp = nullptr;
+  Expression *flat = nullptr;
   friend Program;
   friend void direct_execute(std::string &line, Program &program, EvalState &state);
 
-  PRINTStatement(const std::string &line);
+  PRINTStatement(const std::string &line, Arena &arena);
 
   ~PRINTStatement() override = default;
 
-  void execute(EvalState &state, Program &program) override;
+  ErrorCode execute(EvalState &state, Program &program) override;
 
   void dir_execute(EvalState &state, Program &program) override;
+
+public:
+  StatementType getType() const override { return PRINT; }
+
+  Expression *getExp() const { return exp; }
 };
 
 class INPUTStatement : public Statement
 {
-  std::string line;
+  int slot = -1;
   friend Program;
   friend void direct_execute(std::string &line, Program &program, EvalState &state);
 
@@ -140,9 +213,16 @@ class INPUTStatement : public Statement
 
   ~INPUTStatement() override = default;
 
-  void execute(EvalState &state, Program &program) override;
+  ErrorCode execute(EvalState &state, Program &program) override;
 
   void dir_execute(EvalState &state, Program &program) override;
+
+public:
+  StatementType getType() const override { return INPUT; }
+
+  const std::string &getVar() const { return getSymbolName(slot); }
+
+  int getSlot() const { return slot; }
 };
 
 class ENDStatement : public Statement
@@ -154,14 +234,18 @@ class ENDStatement : public Statement
 
   ~ENDStatement() override = default;
 
-  void execute(EvalState &state, Program &program) override;
+  ErrorCode execute(EvalState &state, Program &program) override;
 
   void dir_execute(EvalState &state, Program &program) override;
+
+public:
+  StatementType getType() const override { return END; }
 };
 
 class GOTOStatement : public Statement
 {
-  std::string line;
+  int target = -1;
+  int targetIndex = -1;
   friend Program;
   friend void direct_execute(std::string &line, Program &program, EvalState &state);
 
@@ -169,23 +253,256 @@ class GOTOStatement : public Statement
 
   ~GOTOStatement() override = default;
 
-  void execute(EvalState &state, Program &program) override;
+  ErrorCode execute(EvalState &state, Program &program) override;
 
   void dir_execute(EvalState &state, Program &program) override;
+
+public:
+  StatementType getType() const override { return GOTO; }
+
+  int getTarget() const { return target; }
+
+  /*
+   * Method: getTargetIndex
+   * Usage: int index = stmt->getTargetIndex();
+   * ------------------------------------------
+   * Returns the position of the target line in the linked program, or
+   * -1 if the target did not exist when the program was last linked.
+   */
+
+  int getTargetIndex() const { return targetIndex; }
 };
 
+/*
+ * IF C THEN N continues at line N when the condition C holds.  C is
+ * parsed once, into a Condition tree that the analyses and compilers
+ * read, and a copy with flattened operands that execute evaluates.
+ */
+
 class IFStatement : public Statement
 {
-  std::string line;
+  Condition *cond = nullptr;
+  Condition *flat = nullptr;
+  int target = -1;
+  int targetIndex = -1;
   friend Program;
   friend void direct_execute(std::string &line, Program &program, EvalState &state);
 
-  IFStatement(const std::string &line);
+  IFStatement(const std::string &line, Arena &arena);
 
   ~IFStatement() override = default;
 
-  void execute(EvalState &state, Program &program) override;
+  ErrorCode execute(EvalState &state, Program &program) override;
+
+  void dir_execute(EvalState &state, Program &program) override;
+
+public:
+  StatementType getType() const override { return IF; }
+
+  Condition *getCondition() const { return cond; }
+
+  int getTarget() const { return target; }
+
+  int getTargetIndex() const { return targetIndex; }
+};
+
+/*
+ * FOR V = A TO B [STEP C] evaluates A, B and C, in that order, then
+ * sets V to A and opens a loop; STEP defaults to 1.  The body always
+ * runs at least once, and each NEXT V adds C to V and repeats the
+ * body while V has not passed B.  The tree walker keeps the open loops
+ * on the program's loop stack.  The compilers instead keep B and C in
+ * two hidden variables of V, which is only possible for the programs
+ * that Program::hasStructuredLoops accepts.
+ */
+
+class FORStatement : public Statement
+{
+  int slot = -1;
+  int limitSlot = -1;
+  int stepSlot = -1;
+  Expression *start = nullptr;
+  Expression *limit = nullptr;
+  Expression *step = nullptr;
+  Expression *flatStart = nullptr;
+  Expression *flatLimit = nullptr;
+  Expression *flatStep = nullptr;
+  int nextIndex = -1;
+  friend Program;
+  friend void direct_execute(std::string &line, Program &program, EvalState &state);
+
+  FORStatement(const std::string &line, Arena &arena);
+
+  ~FORStatement() override = default;
+
+  ErrorCode execute(EvalState &state, Program &program) override;
+
+  void dir_execute(EvalState &state, Program &program) override;
+
+public:
+  StatementType getType() const override { return FOR; }
+
+  const std::string &getVar() const { return getSymbolName(slot); }
+
+  int getSlot() const { return slot; }
+
+  /*
+   * Methods: getLimitSlot, getStepSlot
+   * Usage: int slot = stmt->getLimitSlot();
+   * ---------------------------------------
+   * Return the hidden variables that compiled code keeps the limit and
+   * the step of the loop in.  No BASIC variable can name them.
+   */
+
+  int getLimitSlot() const { return limitSlot; }
+
+  int getStepSlot() const { return stepSlot; }
+
+  Expression *getStart() const { return start; }
+
+  Expression *getLimit() const { return limit; }
+
+  Expression *getStep() const { return step; }
+
+  /*
+   * Method: getNextIndex
+   * Usage: int index = stmt->getNextIndex();
+   * ----------------------------------------
+   * Returns the position of the NEXT that closes this loop in the
+   * linked program, or -1 if no NEXT does.
+   */
+
+  int getNextIndex() const { return nextIndex; }
+};
+
+class NEXTStatement : public Statement
+{
+  int slot = -1;
+  int forIndex = -1;
+  friend Program;
+  friend void direct_execute(std::string &line, Program &program, EvalState &state);
+
+  NEXTStatement(const std::string &line);
+
+  ~NEXTStatement() override = default;
+
+  ErrorCode execute(EvalState &state, Program &program) override;
+
+  void dir_execute(EvalState &state, Program &program) override;
+
+public:
+  StatementType getType() const override { return NEXT; }
+
+  /*
+   * Method: getSlot
+   * Usage: int slot = stmt->getSlot();
+   * ----------------------------------
+   * Returns the variable named after NEXT, or -1 for a bare NEXT, which
+   * closes the innermost open loop.
+   */
+
+  int getSlot() const { return slot; }
+
+  /*
+   * Methods: getForIndex, getTargetIndex
+   * Usage: int index = stmt->getTargetIndex();
+   * ------------------------------------------
+   * Return the position of the FOR this NEXT closes in the linked
+   * program and the position of the first line of the loop body, where
+   * the loop repeats; both are -1 if no FOR pairs with it.
+   */
+
+  int getForIndex() const { return forIndex; }
+
+  int getTargetIndex() const { return forIndex < 0 ? -1 : forIndex + 1; }
+};
+
+/*
+ * GOSUB N saves the position of the line after it on the program's
+ * return stack and continues at line N; RETURN continues at the most
+ * recently saved position and drops it.  The target is resolved by
+ * Program::link like that of a GOTO.
+ */
+
+class GOSUBStatement : public Statement
+{
+  int target = -1;
+  int targetIndex = -1;
+  friend Program;
+  friend void direct_execute(std::string &line, Program &program, EvalState &state);
+
+  GOSUBStatement(const std::string &line);
+
+  ~GOSUBStatement() override = default;
+
+  ErrorCode execute(EvalState &state, Program &program) override;
 
   void dir_execute(EvalState &state, Program &program) override;
+
+public:
+  StatementType getType() const override { return GOSUB; }
+
+  int getTarget() const { return target; }
+
+  int getTargetIndex() const { return targetIndex; }
+};
+
+class RETURNStatement : public Statement
+{
+  friend Program;
+  friend void direct_execute(std::string &line, Program &program, EvalState &state);
+
+  RETURNStatement(const std::string &line);
+
+  ~RETURNStatement() override = default;
+
+  ErrorCode execute(EvalState &state, Program &program) override;
+
+  void dir_execute(EvalState &state, Program &program) override;
+
+public:
+  StatementType getType() const override { return RETURN; }
+};
+
+/*
+ * ON E GOTO N1, N2, . . . evaluates E and continues at the line that
+ * is its E-th target, and ON E GOSUB calls that line as a subroutine.
+ * A value of E outside 1 to the number of targets falls through to the
+ * next line.  The targets are kept in the arena of the line and
+ * resolved to positions by Program::link, so choosing one is a bounds
+ * check and an index into targetIndices.
+ */
+
+class ONStatement : public Statement
+{
+  Expression *exp = nullptr;
+  Expression *flat = nullptr;
+  bool gosub = false;
+  int count = 0;
+  int *targets = nullptr;
+  int *targetIndices = nullptr;
+  friend Program;
+  friend void direct_execute(std::string &line, Program &program, EvalState &state);
+
+  ONStatement(const std::string &line, Arena &arena);
+
+  ~ONStatement() override = default;
+
+  ErrorCode execute(EvalState &state, Program &program) override;
+
+  void dir_execute(EvalState &state, Program &program) override;
+
+public:
+  StatementType getType() const override { return ON; }
+
+  Expression *getExp() const { return exp; }
+
+  bool isGosub() const { return gosub; }
+
+  int getTargetCount() const { return count; }
+
+  int getTarget(int choice) const { return targets[choice]; }
+
+  int getTargetIndex(int choice) const { return targetIndices[choice]; }
 };
 #endif
@@ -0,0 +1,1000 @@
+/*
+ * File: vm.cpp
+ * ------------
+ * This file implements the VM class.  The same instruction set is
+ * interpreted by up to three loops, one per DispatchMode; they must
+ * stay in step whenever an opcode is added.
+ */
+
+#include "vm.hpp"
+#include <iostream>
+#include "Utils/error.hpp"
+#include "statement.hpp"
+
+
+#if defined(__has_cpp_attribute)
+#if __has_cpp_attribute(clang::musttail)
+#define BASIC_MUSTTAIL [[clang::musttail]]
+#elif __has_cpp_attribute(gnu::musttail)
+#define BASIC_MUSTTAIL [[gnu::musttail]]
+#endif
+#endif
+
+#if defined(BASIC_DISPATCH_THREADED) && !defined(__GNUC__)
+#error "BASIC_DISPATCH=threaded needs a compiler with labels-as-values"
+#endif
+
+#if defined(BASIC_DISPATCH_TAILCALL) && !defined(BASIC_MUSTTAIL)
+#error "BASIC_DISPATCH=tailcall needs [[clang::musttail]] support"
+#endif
+
+/*
+ * Implementation notes: switch dispatch
+ * -------------------------------------
+ * The reference loop.  It keeps the program counter and stack pointer
+ * in locals; sp always points one past the top of the operand stack
+ * and rp one past the top of the return stack.
+ * With Count set, it also counts how often each instruction is
+ * dispatched, which is how the benchmarks turn a run time into a cost
+ * per instruction and how the superinstructions were chosen.
+ */
+
+template <bool Count>
+static VMStatus executeSwitch(const Chunk &chunk, int *sp, int *slot, std::uint64_t *set, int *calls, int *exit_operand,
+                              long long *counts)
+{
+  const Instruction *code = chunk.code.data();
+  const DivMagic *divisors = chunk.divisors.data();
+  const int *targets = chunk.targets.data();
+  int *rp = calls;
+  int *const calls_end = calls + chunk.callDepth;
+  int pc = 0;
+  while (true)
+  {
+    if (Count)
+      counts[pc]++;
+    const Instruction &ins = code[pc++];
+    switch (ins.op)
+    {
+      case OP_CONST:
+        *sp++ = ins.operand;
+        break;
+      case OP_LOAD:
+        if (!testSlot(set, ins.operand))
+          return VM_VARIABLE_NOT_DEFINED;
+        *sp++ = slot[ins.operand];
+        break;
+      case OP_STORE:
+        slot[ins.operand] = *--sp;
+        markSlot(set, ins.operand);
+        break;
+      case OP_ASSIGN:
+        slot[ins.operand] = sp[-1];
+        markSlot(set, ins.operand);
+        break;
+      case OP_ADD:
+        sp--;
+        sp[-1] += *sp;
+        break;
+      case OP_SUB:
+        sp--;
+        sp[-1] -= *sp;
+        break;
+      case OP_MUL:
+        sp--;
+        sp[-1] *= *sp;
+        break;
+      case OP_DIV:
+        sp--;
+        if (*sp == 0)
+          return VM_DIVIDE_BY_ZERO;
+        sp[-1] /= *sp;
+        break;
+      case OP_ADD_CONST:
+        sp[-1] += ins.operand;
+        break;
+      case OP_MUL_CONST:
+        sp[-1] *= ins.operand;
+        break;
+      case OP_DIV_CONST:
+        sp[-1] = divideByMagic(sp[-1], divisors[ins.operand]);
+        break;
+      case OP_PRINT:
+        std::cout << *--sp << "\n";
+        break;
+      case OP_INPUT:
+        slot[ins.operand] = readInputValue();
+        markSlot(set, ins.operand);
+        break;
+      case OP_JUMP:
+        pc = ins.operand;
+        break;
+      case OP_JUMP_EQ:
+        sp -= 2;
+        if (sp[0] == sp[1])
+          pc = ins.operand;
+        break;
+      case OP_JUMP_NE:
+        sp -= 2;
+        if (sp[0] != sp[1])
+          pc = ins.operand;
+        break;
+      case OP_JUMP_LT:
+        sp -= 2;
+        if (sp[0] < sp[1])
+          pc = ins.operand;
+        break;
+      case OP_JUMP_LE:
+        sp -= 2;
+        if (sp[0] <= sp[1])
+          pc = ins.operand;
+        break;
+      case OP_JUMP_GT:
+        sp -= 2;
+        if (sp[0] > sp[1])
+          pc = ins.operand;
+        break;
+      case OP_JUMP_GE:
+        sp -= 2;
+        if (sp[0] >= sp[1])
+          pc = ins.operand;
+        break;
+      case OP_LINE_ERROR:
+        return VM_LINE_NUMBER_ERROR;
+      case OP_HALT:
+        return VM_HALT;
+      case OP_EXIT:
+        *exit_operand = ins.operand;
+        return VM_EXIT;
+      case OP_GOSUB:
+        if (rp == calls_end)
+          return VM_GOSUB_OVERFLOW;
+        *rp++ = pc;
+        pc = ins.operand;
+        break;
+      case OP_RETURN:
+        if (rp == calls)
+          return VM_RETURN_WITHOUT_GOSUB;
+        pc = *--rp;
+        break;
+      case OP_ON_GOTO:
+        {
+          unsigned choice = static_cast<unsigned>(*--sp) - 1u;
+          if (choice >= static_cast<unsigned>(ins.a))
+            break;
+          int target = targets[ins.operand + choice];
+          if (target < 0)
+            return VM_LINE_NUMBER_ERROR;
+          pc = target;
+          break;
+        }
+      case OP_ON_GOSUB:
+        {
+          unsigned choice = static_cast<unsigned>(*--sp) - 1u;
+          if (choice >= static_cast<unsigned>(ins.a))
+            break;
+          int target = targets[ins.operand + choice];
+          if (target < 0)
+            return VM_LINE_NUMBER_ERROR;
+          if (rp == calls_end)
+            return VM_GOSUB_OVERFLOW;
+          *rp++ = pc;
+          pc = target;
+          break;
+        }
+      case OP_INC:
+        if (!testSlot(set, ins.operand))
+          return VM_VARIABLE_NOT_DEFINED;
+        slot[ins.operand] += ins.a;
+        break;
+      case OP_JUMP_EQ_CONST:
+        if (!testSlot(set, ins.a))
+          return VM_VARIABLE_NOT_DEFINED;
+        if (slot[ins.a] == ins.b)
+          pc = ins.operand;
+        break;
+      case OP_JUMP_LT_CONST:
+        if (!testSlot(set, ins.a))
+          return VM_VARIABLE_NOT_DEFINED;
+        if (slot[ins.a] < ins.b)
+          pc = ins.operand;
+        break;
+      case OP_JUMP_GT_CONST:
+        if (!testSlot(set, ins.a))
+          return VM_VARIABLE_NOT_DEFINED;
+        if (slot[ins.a] > ins.b)
+          pc = ins.operand;
+        break;
+      case OP_JUMP_EQ_VARS:
+        if (!testSlot(set, ins.a) || !testSlot(set, ins.b))
+          return VM_VARIABLE_NOT_DEFINED;
+        if (slot[ins.a] == slot[ins.b])
+          pc = ins.operand;
+        break;
+      case OP_JUMP_LT_VARS:
+        if (!testSlot(set, ins.a) || !testSlot(set, ins.b))
+          return VM_VARIABLE_NOT_DEFINED;
+        if (slot[ins.a] < slot[ins.b])
+          pc = ins.operand;
+        break;
+      case OP_JUMP_GT_VARS:
+        if (!testSlot(set, ins.a) || !testSlot(set, ins.b))
+          return VM_VARIABLE_NOT_DEFINED;
+        if (slot[ins.a] > slot[ins.b])
+          pc = ins.operand;
+        break;
+      case OP_PRINT_VAR:
+        if (!testSlot(set, ins.operand))
+          return VM_VARIABLE_NOT_DEFINED;
+        std::cout << slot[ins.operand] << "\n";
+        break;
+      case OP_NEXT_UP:
+        slot[ins.a] += ins.b;
+        if (slot[ins.a] <= slot[ins.c])
+          pc = ins.operand;
+        break;
+      case OP_NEXT_DOWN:
+        slot[ins.a] += ins.b;
+        if (slot[ins.a] >= slot[ins.c])
+          pc = ins.operand;
+        break;
+    }
+  }
+}
+
+/*
+ * Implementation notes: threaded dispatch
+ * ---------------------------------------
+ * The chunk is first translated into direct-threaded code, where each
+ * instruction carries the address of its handler label instead of its
+ * opcode.  Every handler ends with its own indirect jump, which gives
+ * the branch predictor one prediction site per opcode.  Threaded
+ * instructions are aligned to 32 bytes, a power of two, so none of
+ * them straddles a cache line and a jump target is one shift away.
+ */
+
+#if defined(__GNUC__)
+static VMStatus executeThreaded(const Chunk &chunk, int *sp, int *slot, std::uint64_t *set, int *calls,
+                                int *exit_operand)
+{
+  static void *const labels[] = {
+    &&op_const,         &&op_load,          &&op_store,         &&op_assign,        &&op_add,
+    &&op_sub,           &&op_mul,           &&op_div,           &&op_add_const,     &&op_mul_const,
+    &&op_div_const,     &&op_print,         &&op_input,         &&op_jump,          &&op_jump_eq,
+    &&op_jump_ne,       &&op_jump_lt,       &&op_jump_le,       &&op_jump_gt,       &&op_jump_ge,
+    &&op_line_error,    &&op_halt,          &&op_exit,          &&op_gosub,         &&op_return,
+    &&op_on_goto,       &&op_on_gosub,      &&op_inc,           &&op_jump_eq_const, &&op_jump_lt_const,
+    &&op_jump_gt_const, &&op_jump_eq_vars,  &&op_jump_lt_vars,  &&op_jump_gt_vars,  &&op_print_var,
+    &&op_next_up,       &&op_next_down};
+  struct alignas(32) Threaded
+  {
+    void *label;
+    int operand;
+    int a;
+    int b;
+    int c;
+  };
+  std::vector<Threaded> code(chunk.code.size());
+  for (std::size_t i = 0; i < code.size(); i++)
+  {
+    const Instruction &ins = chunk.code[i];
+    code[i] = {labels[ins.op], ins.operand, ins.a, ins.b, ins.c};
+  }
+  const Threaded *base = code.data();
+  const Threaded *ip = base;
+  const DivMagic *divisors = chunk.divisors.data();
+  const int *targets = chunk.targets.data();
+  int *rp = calls;
+  int *const calls_end = calls + chunk.callDepth;
+
+#define DISPATCH() goto *ip->label
+#define NEXT()                                                                                                         \
+  do                                                                                                                   \
+  {                                                                                                                    \
+    ++ip;                                                                                                              \
+    DISPATCH();                                                                                                        \
+  } while (false)
+
+  DISPATCH();
+op_const:
+  *sp++ = ip->operand;
+  NEXT();
+op_load:
+  if (!testSlot(set, ip->operand))
+    return VM_VARIABLE_NOT_DEFINED;
+  *sp++ = slot[ip->operand];
+  NEXT();
+op_store:
+  slot[ip->operand] = *--sp;
+  markSlot(set, ip->operand);
+  NEXT();
+op_assign:
+  slot[ip->operand] = sp[-1];
+  markSlot(set, ip->operand);
+  NEXT();
+op_add:
+  sp--;
+  sp[-1] += *sp;
+  NEXT();
+op_sub:
+  sp--;
+  sp[-1] -= *sp;
+  NEXT();
+op_mul:
+  sp--;
+  sp[-1] *= *sp;
+  NEXT();
+op_div:
+  sp--;
+  if (*sp == 0)
+    return VM_DIVIDE_BY_ZERO;
+  sp[-1] /= *sp;
+  NEXT();
+op_add_const:
+  sp[-1] += ip->operand;
+  NEXT();
+op_mul_const:
+  sp[-1] *= ip->operand;
+  NEXT();
+op_div_const:
+  sp[-1] = divideByMagic(sp[-1], divisors[ip->operand]);
+  NEXT();
+op_print:
+  std::cout << *--sp << "\n";
+  NEXT();
+op_input:
+  slot[ip->operand] = readInputValue();
+  markSlot(set, ip->operand);
+  NEXT();
+op_jump:
+  ip = base + ip->operand;
+  DISPATCH();
+op_jump_eq:
+  sp -= 2;
+  if (sp[0] == sp[1])
+  {
+    ip = base + ip->operand;
+    DISPATCH();
+  }
+  NEXT();
+op_jump_ne:
+  sp -= 2;
+  if (sp[0] != sp[1])
+  {
+    ip = base + ip->operand;
+    DISPATCH();
+  }
+  NEXT();
+op_jump_lt:
+  sp -= 2;
+  if (sp[0] < sp[1])
+  {
+    ip = base + ip->operand;
+    DISPATCH();
+  }
+  NEXT();
+op_jump_le:
+  sp -= 2;
+  if (sp[0] <= sp[1])
+  {
+    ip = base + ip->operand;
+    DISPATCH();
+  }
+  NEXT();
+op_jump_gt:
+  sp -= 2;
+  if (sp[0] > sp[1])
+  {
+    ip = base + ip->operand;
+    DISPATCH();
+  }
+  NEXT();
+op_jump_ge:
+  sp -= 2;
+  if (sp[0] >= sp[1])
+  {
+    ip = base + ip->operand;
+    DISPATCH();
+  }
+  NEXT();
+op_line_error:
+  return VM_LINE_NUMBER_ERROR;
+op_halt:
+  return VM_HALT;
+op_exit:
+  *exit_operand = ip->operand;
+  return VM_EXIT;
+op_gosub:
+  if (rp == calls_end)
+    return VM_GOSUB_OVERFLOW;
+  *rp++ = static_cast<int>(ip - base) + 1;
+  ip = base + ip->operand;
+  DISPATCH();
+op_return:
+  if (rp == calls)
+    return VM_RETURN_WITHOUT_GOSUB;
+  ip = base + *--rp;
+  DISPATCH();
+op_on_goto:
+  {
+    unsigned choice = static_cast<unsigned>(*--sp) - 1u;
+    if (choice >= static_cast<unsigned>(ip->a))
+      NEXT();
+    int target = targets[ip->operand + choice];
+    if (target < 0)
+      return VM_LINE_NUMBER_ERROR;
+    ip = base + target;
+    DISPATCH();
+  }
+op_on_gosub:
+  {
+    unsigned choice = static_cast<unsigned>(*--sp) - 1u;
+    if (choice >= static_cast<unsigned>(ip->a))
+      NEXT();
+    int target = targets[ip->operand + choice];
+    if (target < 0)
+      return VM_LINE_NUMBER_ERROR;
+    if (rp == calls_end)
+      return VM_GOSUB_OVERFLOW;
+    *rp++ = static_cast<int>(ip - base) + 1;
+    ip = base + target;
+    DISPATCH();
+  }
+op_inc:
+  if (!testSlot(set, ip->operand))
+    return VM_VARIABLE_NOT_DEFINED;
+  slot[ip->operand] += ip->a;
+  NEXT();
+op_jump_eq_const:
+  if (!testSlot(set, ip->a))
+    return VM_VARIABLE_NOT_DEFINED;
+  if (slot[ip->a] == ip->b)
+  {
+    ip = base + ip->operand;
+    DISPATCH();
+  }
+  NEXT();
+op_jump_lt_const:
+  if (!testSlot(set, ip->a))
+    return VM_VARIABLE_NOT_DEFINED;
+  if (slot[ip->a] < ip->b)
+  {
+    ip = base + ip->operand;
+    DISPATCH();
+  }
+  NEXT();
+op_jump_gt_const:
+  if (!testSlot(set, ip->a))
+    return VM_VARIABLE_NOT_DEFINED;
+  if (slot[ip->a] > ip->b)
+  {
+    ip = base + ip->operand;
+    DISPATCH();
+  }
+  NEXT();
+op_jump_eq_vars:
+  if (!testSlot(set, ip->a) || !testSlot(set, ip->b))
+    return VM_VARIABLE_NOT_DEFINED;
+  if (slot[ip->a] == slot[ip->b])
+  {
+    ip = base + ip->operand;
+    DISPATCH();
+  }
+  NEXT();
+op_jump_lt_vars:
+  if (!testSlot(set, ip->a) || !testSlot(set, ip->b))
+    return VM_VARIABLE_NOT_DEFINED;
+  if (slot[ip->a] < slot[ip->b])
+  {
+    ip = base + ip->operand;
+    DISPATCH();
+  }
+  NEXT();
+op_jump_gt_vars:
+  if (!testSlot(set, ip->a) || !testSlot(set, ip->b))
+    return VM_VARIABLE_NOT_DEFINED;
+  if (slot[ip->a] > slot[ip->b])
+  {
+    ip = base + ip->operand;
+    DISPATCH();
+  }
+  NEXT();
+op_print_var:
+  if (!testSlot(set, ip->operand))
+    return VM_VARIABLE_NOT_DEFINED;
+  std::cout << slot[ip->operand] << "\n";
+  NEXT();
+op_next_up:
+  slot[ip->a] += ip->b;
+  if (slot[ip->a] <= slot[ip->c])
+  {
+    ip = base + ip->operand;
+    DISPATCH();
+  }
+  NEXT();
+op_next_down:
+  slot[ip->a] += ip->b;
+  if (slot[ip->a] >= slot[ip->c])
+  {
+    ip = base + ip->operand;
+    DISPATCH();
+  }
+  NEXT();
+
+#undef NEXT
+#undef DISPATCH
+}
+#endif
+
+/*
+ * Implementation notes: tail-call dispatch
+ * ----------------------------------------
+ * Each opcode is a separate function, and each function ends by
+ * calling the handler of the next instruction.  musttail guarantees
+ * the call compiles to a jump, so the machine stack does not grow and
+ * ip, sp and the frame stay in argument registers across handlers.
+ * The instructions are aligned to 32 bytes like threaded ones.
+ */
+
+#if defined(BASIC_MUSTTAIL)
+struct TailInstruction;
+
+struct TailFrame
+{
+  int *slot;
+  std::uint64_t *set;
+  int *exit_operand;
+  const TailInstruction *base;
+  const DivMagic *divisors;
+  const int *targets;
+  int *calls;
+  int *rp;
+  int *calls_end;
+};
+
+typedef VMStatus (*TailHandler)(const TailInstruction *ip, int *sp, TailFrame *frame);
+
+struct alignas(32) TailInstruction
+{
+  TailHandler handler;
+  int operand;
+  int a;
+  int b;
+  int c;
+};
+
+#define TAIL_DISPATCH(next) BASIC_MUSTTAIL return (next)->handler((next), sp, frame)
+#define TAIL_HANDLER(name) static VMStatus name(const TailInstruction *ip, int *sp, TailFrame *frame)
+
+TAIL_HANDLER(tailConst)
+{
+  *sp++ = ip->operand;
+  TAIL_DISPATCH(ip + 1);
+}
+
+TAIL_HANDLER(tailLoad)
+{
+  if (!testSlot(frame->set, ip->operand))
+    return VM_VARIABLE_NOT_DEFINED;
+  *sp++ = frame->slot[ip->operand];
+  TAIL_DISPATCH(ip + 1);
+}
+
+TAIL_HANDLER(tailStore)
+{
+  frame->slot[ip->operand] = *--sp;
+  markSlot(frame->set, ip->operand);
+  TAIL_DISPATCH(ip + 1);
+}
+
+TAIL_HANDLER(tailAssign)
+{
+  frame->slot[ip->operand] = sp[-1];
+  markSlot(frame->set, ip->operand);
+  TAIL_DISPATCH(ip + 1);
+}
+
+TAIL_HANDLER(tailAdd)
+{
+  sp--;
+  sp[-1] += *sp;
+  TAIL_DISPATCH(ip + 1);
+}
+
+TAIL_HANDLER(tailSub)
+{
+  sp--;
+  sp[-1] -= *sp;
+  TAIL_DISPATCH(ip + 1);
+}
+
+TAIL_HANDLER(tailMul)
+{
+  sp--;
+  sp[-1] *= *sp;
+  TAIL_DISPATCH(ip + 1);
+}
+
+TAIL_HANDLER(tailDiv)
+{
+  sp--;
+  if (*sp == 0)
+    return VM_DIVIDE_BY_ZERO;
+  sp[-1] /= *sp;
+  TAIL_DISPATCH(ip + 1);
+}
+
+TAIL_HANDLER(tailAddConst)
+{
+  sp[-1] += ip->operand;
+  TAIL_DISPATCH(ip + 1);
+}
+
+TAIL_HANDLER(tailMulConst)
+{
+  sp[-1] *= ip->operand;
+  TAIL_DISPATCH(ip + 1);
+}
+
+TAIL_HANDLER(tailDivConst)
+{
+  sp[-1] = divideByMagic(sp[-1], frame->divisors[ip->operand]);
+  TAIL_DISPATCH(ip + 1);
+}
+
+TAIL_HANDLER(tailPrint)
+{
+  std::cout << *--sp << "\n";
+  TAIL_DISPATCH(ip + 1);
+}
+
+TAIL_HANDLER(tailInput)
+{
+  frame->slot[ip->operand] = readInputValue();
+  markSlot(frame->set, ip->operand);
+  TAIL_DISPATCH(ip + 1);
+}
+
+TAIL_HANDLER(tailJump) { TAIL_DISPATCH(frame->base + ip->operand); }
+
+TAIL_HANDLER(tailJumpEq)
+{
+  sp -= 2;
+  const TailInstruction *next = sp[0] == sp[1] ? frame->base + ip->operand : ip + 1;
+  TAIL_DISPATCH(next);
+}
+
+TAIL_HANDLER(tailJumpNe)
+{
+  sp -= 2;
+  const TailInstruction *next = sp[0] != sp[1] ? frame->base + ip->operand : ip + 1;
+  TAIL_DISPATCH(next);
+}
+
+TAIL_HANDLER(tailJumpLt)
+{
+  sp -= 2;
+  const TailInstruction *next = sp[0] < sp[1] ? frame->base + ip->operand : ip + 1;
+  TAIL_DISPATCH(next);
+}
+
+TAIL_HANDLER(tailJumpLe)
+{
+  sp -= 2;
+  const TailInstruction *next = sp[0] <= sp[1] ? frame->base + ip->operand : ip + 1;
+  TAIL_DISPATCH(next);
+}
+
+TAIL_HANDLER(tailJumpGt)
+{
+  sp -= 2;
+  const TailInstruction *next = sp[0] > sp[1] ? frame->base + ip->operand : ip + 1;
+  TAIL_DISPATCH(next);
+}
+
+TAIL_HANDLER(tailJumpGe)
+{
+  sp -= 2;
+  const TailInstruction *next = sp[0] >= sp[1] ? frame->base + ip->operand : ip + 1;
+  TAIL_DISPATCH(next);
+}
+
+TAIL_HANDLER(tailLineError) { return VM_LINE_NUMBER_ERROR; }
+
+TAIL_HANDLER(tailHalt) { return VM_HALT; }
+
+TAIL_HANDLER(tailExit)
+{
+  *frame->exit_operand = ip->operand;
+  return VM_EXIT;
+}
+
+TAIL_HANDLER(tailGosub)
+{
+  if (frame->rp == frame->calls_end)
+    return VM_GOSUB_OVERFLOW;
+  *frame->rp++ = static_cast<int>(ip - frame->base) + 1;
+  TAIL_DISPATCH(frame->base + ip->operand);
+}
+
+TAIL_HANDLER(tailReturn)
+{
+  if (frame->rp == frame->calls)
+    return VM_RETURN_WITHOUT_GOSUB;
+  const TailInstruction *next = frame->base + *--frame->rp;
+  TAIL_DISPATCH(next);
+}
+
+TAIL_HANDLER(tailOnGoto)
+{
+  unsigned choice = static_cast<unsigned>(*--sp) - 1u;
+  if (choice >= static_cast<unsigned>(ip->a))
+    TAIL_DISPATCH(ip + 1);
+  int target = frame->targets[ip->operand + choice];
+  if (target < 0)
+    return VM_LINE_NUMBER_ERROR;
+  TAIL_DISPATCH(frame->base + target);
+}
+
+TAIL_HANDLER(tailOnGosub)
+{
+  unsigned choice = static_cast<unsigned>(*--sp) - 1u;
+  if (choice >= static_cast<unsigned>(ip->a))
+    TAIL_DISPATCH(ip + 1);
+  int target = frame->targets[ip->operand + choice];
+  if (target < 0)
+    return VM_LINE_NUMBER_ERROR;
+  if (frame->rp == frame->calls_end)
+    return VM_GOSUB_OVERFLOW;
+  *frame->rp++ = static_cast<int>(ip - frame->base) + 1;
+  TAIL_DISPATCH(frame->base + target);
+}
+
+TAIL_HANDLER(tailInc)
+{
+  if (!testSlot(frame->set, ip->operand))
+    return VM_VARIABLE_NOT_DEFINED;
+  frame->slot[ip->operand] += ip->a;
+  TAIL_DISPATCH(ip + 1);
+}
+
+TAIL_HANDLER(tailJumpEqConst)
+{
+  if (!testSlot(frame->set, ip->a))
+    return VM_VARIABLE_NOT_DEFINED;
+  const TailInstruction *next = frame->slot[ip->a] == ip->b ? frame->base + ip->operand : ip + 1;
+  TAIL_DISPATCH(next);
+}
+
+TAIL_HANDLER(tailJumpLtConst)
+{
+  if (!testSlot(frame->set, ip->a))
+    return VM_VARIABLE_NOT_DEFINED;
+  const TailInstruction *next = frame->slot[ip->a] < ip->b ? frame->base + ip->operand : ip + 1;
+  TAIL_DISPATCH(next);
+}
+
+TAIL_HANDLER(tailJumpGtConst)
+{
+  if (!testSlot(frame->set, ip->a))
+    return VM_VARIABLE_NOT_DEFINED;
+  const TailInstruction *next = frame->slot[ip->a] > ip->b ? frame->base + ip->operand : ip + 1;
+  TAIL_DISPATCH(next);
+}
+
+TAIL_HANDLER(tailJumpEqVars)
+{
+  if (!testSlot(frame->set, ip->a) || !testSlot(frame->set, ip->b))
+    return VM_VARIABLE_NOT_DEFINED;
+  const TailInstruction *next = frame->slot[ip->a] == frame->slot[ip->b] ? frame->base + ip->operand : ip + 1;
+  TAIL_DISPATCH(next);
+}
+
+TAIL_HANDLER(tailJumpLtVars)
+{
+  if (!testSlot(frame->set, ip->a) || !testSlot(frame->set, ip->b))
+    return VM_VARIABLE_NOT_DEFINED;
+  const TailInstruction *next = frame->slot[ip->a] < frame->slot[ip->b] ? frame->base + ip->operand : ip + 1;
+  TAIL_DISPATCH(next);
+}
+
+TAIL_HANDLER(tailJumpGtVars)
+{
+  if (!testSlot(frame->set, ip->a) || !testSlot(frame->set, ip->b))
+    return VM_VARIABLE_NOT_DEFINED;
+  const TailInstruction *next = frame->slot[ip->a] > frame->slot[ip->b] ? frame->base + ip->operand : ip + 1;
+  TAIL_DISPATCH(next);
+}
+
+TAIL_HANDLER(tailPrintVar)
+{
+  if (!testSlot(frame->set, ip->operand))
+    return VM_VARIABLE_NOT_DEFINED;
+  std::cout << frame->slot[ip->operand] << "\n";
+  TAIL_DISPATCH(ip + 1);
+}
+
+TAIL_HANDLER(tailNextUp)
+{
+  frame->slot[ip->a] += ip->b;
+  const TailInstruction *next = frame->slot[ip->a] <= frame->slot[ip->c] ? frame->base + ip->operand : ip + 1;
+  TAIL_DISPATCH(next);
+}
+
+TAIL_HANDLER(tailNextDown)
+{
+  frame->slot[ip->a] += ip->b;
+  const TailInstruction *next = frame->slot[ip->a] >= frame->slot[ip->c] ? frame->base + ip->operand : ip + 1;
+  TAIL_DISPATCH(next);
+}
+
+#undef TAIL_HANDLER
+#undef TAIL_DISPATCH
+
+static VMStatus executeTailCall(const Chunk &chunk, int *sp, int *slot, std::uint64_t *set, int *calls,
+                                int *exit_operand)
+{
+  static const TailHandler handlers[] = {
+    tailConst,       tailLoad,        tailStore,       tailAssign,      tailAdd,         tailSub,
+    tailMul,         tailDiv,         tailAddConst,    tailMulConst,    tailDivConst,    tailPrint,
+    tailInput,       tailJump,        tailJumpEq,      tailJumpNe,      tailJumpLt,      tailJumpLe,
+    tailJumpGt,      tailJumpGe,      tailLineError,   tailHalt,        tailExit,        tailGosub,
+    tailReturn,      tailOnGoto,      tailOnGosub,     tailInc,         tailJumpEqConst, tailJumpLtConst,
+    tailJumpGtConst, tailJumpEqVars,  tailJumpLtVars,  tailJumpGtVars,  tailPrintVar,    tailNextUp,
+    tailNextDown};
+  std::vector<TailInstruction> code(chunk.code.size());
+  for (std::size_t i = 0; i < code.size(); i++)
+  {
+    const Instruction &ins = chunk.code[i];
+    code[i] = {handlers[ins.op], ins.operand, ins.a, ins.b, ins.c};
+  }
+  TailFrame frame = {slot,  set,   exit_operand, code.data(), chunk.divisors.data(), chunk.targets.data(),
+                     calls, calls, calls + chunk.callDepth};
+  return code[0].handler(code.data(), sp, &frame);
+}
+#endif
+
+VMStatus VM::run(const Chunk &chunk, EvalState &state) { return run(chunk, state, getDefaultDispatch()); }
+
+VMStatus VM::run(const Chunk &chunk, EvalState &state, DispatchMode mode)
+{
+  prepare(chunk, state);
+  int *values = state.getValues();
+  std::uint64_t *defined = state.getDefinedBits();
+  VMStatus status;
+  switch (isAvailable(mode) ? mode : DISPATCH_SWITCH)
+  {
+#if defined(__GNUC__)
+    case DISPATCH_THREADED:
+      status = executeThreaded(chunk, stack.data(), values, defined, calls.data(), &exitOperand);
+      break;
+#endif
+#if defined(BASIC_MUSTTAIL)
+    case DISPATCH_TAILCALL:
+      status = executeTailCall(chunk, stack.data(), values, defined, calls.data(), &exitOperand);
+      break;
+#endif
+    default:
+      status = executeSwitch<false>(chunk, stack.data(), values, defined, calls.data(), &exitOperand, nullptr);
+      break;
+  }
+  raiseStatus(status);
+  return status;
+}
+
+long long VM::countDispatches(const Chunk &chunk, EvalState &state)
+{
+  std::vector<long long> counts;
+  profile(chunk, state, counts);
+  long long dispatches = 0;
+  for (long long count : counts)
+    dispatches += count;
+  return dispatches;
+}
+
+VMStatus VM::profile(const Chunk &chunk, EvalState &state, std::vector<long long> &counts)
+{
+  prepare(chunk, state);
+  counts.assign(chunk.code.size(), 0);
+  VMStatus status = executeSwitch<true>(chunk, stack.data(), state.getValues(), state.getDefinedBits(), calls.data(),
+                                        &exitOperand, counts.data());
+  raiseStatus(status);
+  return status;
+}
+
+int VM::getExit() const { return exitOperand; }
+
+bool VM::isAvailable(DispatchMode mode)
+{
+  switch (mode)
+  {
+    case DISPATCH_SWITCH:
+      return true;
+    case DISPATCH_THREADED:
+#if defined(__GNUC__)
+      return true;
+#else
+      return false;
+#endif
+    case DISPATCH_TAILCALL:
+#if defined(BASIC_MUSTTAIL)
+      return true;
+#else
+      return false;
+#endif
+  }
+  return false;
+}
+
+/*
+ * Implementation notes: getDefaultDispatch
+ * ----------------------------------------
+ * An explicit BASIC_DISPATCH_* definition wins; otherwise threaded
+ * code is used wherever the compiler supports it.
+ */
+
+DispatchMode VM::getDefaultDispatch()
+{
+#if defined(BASIC_DISPATCH_SWITCH)
+  return DISPATCH_SWITCH;
+#elif defined(BASIC_DISPATCH_TAILCALL)
+  return DISPATCH_TAILCALL;
+#elif defined(__GNUC__)
+  return DISPATCH_THREADED;
+#else
+  return DISPATCH_SWITCH;
+#endif
+}
+
+const char *VM::getDispatchName(DispatchMode mode)
+{
+  switch (mode)
+  {
+    case DISPATCH_SWITCH:
+      return "switch";
+    case DISPATCH_THREADED:
+      return "threaded";
+    case DISPATCH_TAILCALL:
+      return "tailcall";
+  }
+  return "unknown";
+}
+
+/*
+ * Implementation notes: prepare
+ * -----------------------------
+ * The machine works directly on the value array and defined-bitset of
+ * the EvalState, so nothing is copied in or out and a runtime error
+ * leaves every earlier assignment in place.  The state only has to be
+ * large enough for every slot the chunk names.  Both stacks are kept
+ * between runs and only grow when a chunk needs more.
+ */
+
+void VM::prepare(const Chunk &chunk, EvalState &state)
+{
+  state.reserveSlots(chunk.numSlots);
+  if (stack.size() < static_cast<std::size_t>(chunk.maxStack) + 1)
+    stack.resize(chunk.maxStack + 1);
+  if (calls.size() < static_cast<std::size_t>(chunk.callDepth))
+    calls.resize(chunk.callDepth);
+}
+
+void raiseStatus(VMStatus status)
+{
+  switch (status)
+  {
+    case VM_HALT:
+    case VM_EXIT:
+      break;
+    case VM_DIVIDE_BY_ZERO:
+      error(ERR_DIVIDE_BY_ZERO);
+    case VM_VARIABLE_NOT_DEFINED:
+      error(ERR_VARIABLE_NOT_DEFINED);
+    case VM_LINE_NUMBER_ERROR:
+      error(ERR_LINE_NUMBER);
+    case VM_GOSUB_OVERFLOW:
+      error(ERR_GOSUB_OVERFLOW);
+    case VM_RETURN_WITHOUT_GOSUB:
+      error(ERR_RETURN_WITHOUT_GOSUB);
+  }
+}
@@ -0,0 +1,141 @@
+/*
+ * File: vm.h
+ * ----------
+ * This interface exports the VM class, a stack machine that runs the
+ * bytecode produced by the Compiler.
+ */
+
+#ifndef _vm_h
+#define _vm_h
+
+#include <vector>
+#include "bytecode.hpp"
+#include "evalstate.hpp"
+
+/*
+ * Type: VMStatus
+ * --------------
+ * The reason the machine stopped.  VM_HALT means the program ended and
+ * VM_EXIT that a single-line chunk left through OP_EXIT.  Anything else
+ * is a runtime error that the caller reports with the matching BASIC
+ * message.
+ */
+
+enum VMStatus
+{
+  VM_HALT,
+  VM_EXIT,
+  VM_DIVIDE_BY_ZERO,
+  VM_VARIABLE_NOT_DEFINED,
+  VM_LINE_NUMBER_ERROR,
+  VM_GOSUB_OVERFLOW,
+  VM_RETURN_WITHOUT_GOSUB
+};
+
+/*
+ * Function: raiseStatus
+ * Usage: raiseStatus(status);
+ * ---------------------------
+ * Raises the BASIC error that corresponds to status with error(), or
+ * returns normally for VM_HALT and VM_EXIT.
+ */
+
+void raiseStatus(VMStatus status);
+
+/*
+ * Type: DispatchMode
+ * ------------------
+ * The ways the interpreter loop can move from one instruction to the
+ * next:
+ *
+ *   DISPATCH_SWITCH    one switch over the opcode per instruction
+ *   DISPATCH_THREADED  direct threading through GCC labels-as-values
+ *   DISPATCH_TAILCALL  one function per opcode, chained by guaranteed
+ *                      tail calls ([[clang::musttail]])
+ *
+ * Which modes exist depends on the compiler; DISPATCH_SWITCH always
+ * does.  The mode used by RUN is picked with the BASIC_DISPATCH build
+ * option.
+ */
+
+enum DispatchMode
+{
+  DISPATCH_SWITCH,
+  DISPATCH_THREADED,
+  DISPATCH_TAILCALL
+};
+
+/*
+ * Class: VM
+ * ---------
+ * Runs a Chunk with an operand stack and a return stack.  Slot
+ * operands index the variables of the EvalState directly.
+ */
+
+class VM
+{
+public:
+  /*
+   * Method: run
+   * Usage: vm.run(chunk, state);
+   * ----------------------------
+   * Executes chunk against the variables in state.  A runtime error is
+   * raised with error(); otherwise the result is VM_HALT or VM_EXIT.
+   */
+
+  VMStatus run(const Chunk &chunk, EvalState &state);
+
+  VMStatus run(const Chunk &chunk, EvalState &state, DispatchMode mode);
+
+  /*
+   * Method: getExit
+   * Usage: int exit = vm.getExit();
+   * -------------------------------
+   * Returns the operand of the OP_EXIT that ended the last run: an index
+   * into the exitLines of the chunk, or EXIT_NEXT_LINE.
+   */
+
+  int getExit() const;
+
+  /*
+   * Method: countDispatches
+   * Usage: long long n = vm.countDispatches(chunk, state);
+   * ------------------------------------------------------
+   * Runs chunk like run, but through a switch loop that also counts
+   * the instructions it dispatches, and returns that count.
+   */
+
+  long long countDispatches(const Chunk &chunk, EvalState &state);
+
+  /*
+   * Method: profile
+   * Usage: vm.profile(chunk, state, counts);
+   * ----------------------------------------
+   * Runs chunk like countDispatches, leaving in counts[pc] the number
+   * of times the instruction at pc was dispatched.
+   */
+
+  VMStatus profile(const Chunk &chunk, EvalState &state, std::vector<long long> &counts);
+
+  /*
+   * Methods: isAvailable, getDefaultDispatch, getDispatchName
+   * ---------------------------------------------------------
+   * Report which dispatch modes this build supports, which one a plain
+   * run uses, and a printable name for each.
+   */
+
+  static bool isAvailable(DispatchMode mode);
+
+  static DispatchMode getDefaultDispatch();
+
+  static const char *getDispatchName(DispatchMode mode);
+
+private:
+  std::vector<int> stack;
+  std::vector<int> calls;
+  int exitOperand = EXIT_NEXT_LINE;
+
+  void prepare(const Chunk &chunk, EvalState &state);
+};
+
+#endif
@@ -0,0 +1,140 @@
+/*
+ * File: arith.cpp
+ * ---------------
+ * Measures arithmetic with a constant operand.  Each benchmark program
+ * is compiled twice, once with the generic two-operand instructions
+ * and once with the constant-operand instructions the compiler emits
+ * by default, and both are run on the VM and, where this build has
+ * one, the native code JIT.  The result is the median run time of
+ * each in milliseconds; only a Release build gives meaningful numbers.
+ *
+ * Usage: bench_arith [iterations]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../Basic/compiler.hpp"
+#include "../Basic/evalstate.hpp"
+#include "../Basic/jit.hpp"
+#include "../Basic/program.hpp"
+#include "../Basic/vm.hpp"
+
+
+struct Benchmark
+{
+  std::string name;
+  std::vector<std::string> lines;
+};
+
+/*
+ * Each program runs i from -N to N, substituted at load time, so that
+ * half of the dividends are negative and truncation toward zero
+ * matters.  div-const divides by odd constants, div-pow2 by powers of
+ * two, mul-const multiplies, and induction uses the same multiple of
+ * the counter three times, which the optimizer keeps in a running sum.
+ */
+
+static const std::vector<Benchmark> benchmarks = {
+  {"div-const",
+   {"10 LET s = 0", "20 LET i = 0 - N", "30 LET s = s + i / 7 - i / 10 + i / 641", "40 LET i = i + 1",
+    "50 IF i < N THEN 30", "60 PRINT s"}},
+  {"div-pow2",
+   {"10 LET s = 0", "20 LET i = 0 - N", "30 LET s = s + i / 8 - i / 1024", "40 LET i = i + 1", "50 IF i < N THEN 30",
+    "60 PRINT s"}},
+  {"mul-const",
+   {"10 LET s = 0", "20 LET i = 0 - N", "30 LET s = s + i * 13 - i * 16", "40 LET i = i + 1", "50 IF i < N THEN 30",
+    "60 PRINT s"}},
+  {"induction",
+   {"10 LET s = 0", "15 LET t = 0", "20 LET i = 0 - N", "30 LET s = s + i * 12 - i * 12 / 5", "35 LET t = t + i * 12",
+    "40 LET i = i + 1", "50 IF i < N THEN 30", "60 PRINT s - t"}},
+};
+
+static void load(Program &program, const Benchmark &bench, int iterations)
+{
+  for (std::string line : bench.lines)
+  {
+    std::size_t n = line.find(" N");
+    if (n != std::string::npos)
+      line.replace(n + 1, 1, std::to_string(iterations));
+    std::size_t split = line.find(' ');
+    program.addSourceLine(std::stoi(line.substr(0, split)), line.substr(split + 1), line.substr(0, split));
+  }
+}
+
+/*
+ * Runs chunk on the VM, or compiled by the JIT when native is set, and
+ * returns the median time in milliseconds of RUNS runs, after one run
+ * to warm up caches and branch predictors.  The output of the program
+ * is discarded.  A chunk the JIT cannot compile ends the benchmark
+ * rather than being reported with the time of nothing.
+ */
+
+static const int RUNS = 5;
+
+static double measure(const Chunk &chunk, bool native)
+{
+  JIT jit;
+  if (native && !jit.compile(chunk))
+  {
+    std::cerr << "bench_arith: the JIT could not compile the program" << std::endl;
+    std::exit(1);
+  }
+  std::vector<double> times;
+  std::streambuf *saved = std::cout.rdbuf(nullptr);
+  for (int run = 0; run <= RUNS; run++)
+  {
+    EvalState state;
+    auto start = std::chrono::steady_clock::now();
+    if (native)
+    {
+      jit.run(chunk, state);
+    }
+    else
+    {
+      VM vm;
+      vm.run(chunk, state);
+    }
+    auto stop = std::chrono::steady_clock::now();
+    if (run > 0)
+      times.push_back(std::chrono::duration<double, std::milli>(stop - start).count());
+  }
+  std::cout.rdbuf(saved);
+  std::sort(times.begin(), times.end());
+  return times[RUNS / 2];
+}
+
+int main(int argc, char **argv)
+{
+  int iterations = argc > 1 ? std::atoi(argv[1]) : 2000000;
+  std::cout << std::left << std::setw(12) << "" << std::setw(12) << "vm generic" << std::setw(12) << "vm reduced";
+  if (JIT::isSupported())
+    std::cout << std::setw(12) << "jit generic" << std::setw(12) << "jit reduced";
+  std::cout << "\n";
+  for (const Benchmark &bench : benchmarks)
+  {
+    Program program;
+    load(program, bench, iterations);
+    Chunk generic, reduced;
+    Compiler compiler;
+    compiler.setStrengthReduction(false);
+    bool compiled = compiler.compile(program, generic);
+    compiler.setStrengthReduction(true);
+    if (!compiled || !compiler.compile(program, reduced))
+    {
+      std::cerr << "bench_arith: " << bench.name << " does not compile to bytecode" << std::endl;
+      return 1;
+    }
+    std::cout << std::setw(12) << bench.name << std::fixed << std::setprecision(1);
+    std::cout << std::setw(12) << measure(generic, false) << std::setw(12) << measure(reduced, false);
+    if (JIT::isSupported())
+      std::cout << std::setw(12) << measure(generic, true) << std::setw(12) << measure(reduced, true);
+    std::cout << "\n";
+    program.clear();
+  }
+  return 0;
+}
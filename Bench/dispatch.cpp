@@ -0,0 +1,91 @@
+/*
+ * File: dispatch.cpp
+ * ------------------
+ * Measures the cost of instruction dispatch in the bytecode VM.  Each
+ * benchmark program is a tight GOTO/IF loop; it is compiled once and
+ * then run under every dispatch mode this build supports.  The result
+ * is reported in nanoseconds per dispatched instruction.
+ *
+ * Usage: bench_dispatch [iterations]
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../Basic/compiler.hpp"
+#include "../Basic/evalstate.hpp"
+#include "../Basic/program.hpp"
+#include "../Basic/vm.hpp"
+
+
+struct Benchmark
+{
+  std::string name;
+  std::vector<std::string> lines;
+};
+
+/*
+ * Each program counts i up to the limit N, substituted at load time.
+ * count-loop is the minimal back-edge; goto-chain bounces through
+ * unconditional jumps; branchy alternates between two IF outcomes.
+ */
+
+static const std::vector<Benchmark> benchmarks = {
+  {"count-loop", {"10 LET i = 0", "20 LET i = i + 1", "30 IF i < N THEN 20", "40 END"}},
+  {"goto-chain",
+   {"10 LET i = 0", "20 GOTO 50", "30 IF i < N THEN 20", "40 END", "50 LET i = i + 1", "60 GOTO 70", "70 GOTO 30"}},
+  {"branchy",
+   {"10 LET i = 0", "20 LET p = 0", "30 LET i = i + 1", "40 IF p = 1 THEN 70", "50 LET p = 1", "60 GOTO 80",
+    "70 LET p = 0", "80 IF N > i THEN 30", "90 END"}},
+};
+
+static void load(Program &program, const Benchmark &bench, int iterations)
+{
+  for (std::string line : bench.lines)
+  {
+    std::size_t n = line.find(" N ");
+    if (n != std::string::npos)
+      line.replace(n + 1, 1, std::to_string(iterations));
+    std::size_t split = line.find(' ');
+    program.addSourceLine(std::stoi(line.substr(0, split)), line.substr(split + 1), line.substr(0, split));
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int iterations = argc > 1 ? std::atoi(argv[1]) : 5000000;
+  const DispatchMode modes[] = {DISPATCH_SWITCH, DISPATCH_THREADED, DISPATCH_TAILCALL};
+  std::cout << "default dispatch: " << VM::getDispatchName(VM::getDefaultDispatch()) << "\n";
+  for (const Benchmark &bench : benchmarks)
+  {
+    Program program;
+    load(program, bench, iterations);
+    Chunk chunk;
+    Compiler compiler;
+    compiler.compile(program, chunk);
+    VM vm;
+    EvalState counted;
+    long long dispatches = vm.countDispatches(chunk, counted);
+    std::cout << bench.name << " (" << dispatches << " dispatches)\n";
+    for (DispatchMode mode : modes)
+    {
+      std::cout << "  " << std::left << std::setw(10) << VM::getDispatchName(mode);
+      if (!VM::isAvailable(mode))
+      {
+        std::cout << "unavailable\n";
+        continue;
+      }
+      EvalState state;
+      auto start = std::chrono::steady_clock::now();
+      vm.run(chunk, state, mode);
+      auto stop = std::chrono::steady_clock::now();
+      double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+      std::cout << std::fixed << std::setprecision(3) << ns / dispatches << " ns/dispatch\n";
+    }
+    program.clear();
+  }
+  return 0;
+}
@@ -0,0 +1,169 @@
+/*
+ * File: opcodes.cpp
+ * -----------------
+ * Profiles which instruction sequences the VM spends its dispatches
+ * on, which is the data the superinstructions are chosen from.  Every
+ * file is read as an interpreter session: numbered lines make up the
+ * program, and each RUN runs it with the plain lines that follow as
+ * input.  Programs are compiled without superinstructions, every run
+ * is profiled, and the most frequent sequences of two and three
+ * instructions that execute back to back are reported with their
+ * share of all dispatches.
+ *
+ * Usage: bench_opcodes file...
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../Basic/Utils/error.hpp"
+#include "../Basic/compiler.hpp"
+#include "../Basic/evalstate.hpp"
+#include "../Basic/program.hpp"
+#include "../Basic/vm.hpp"
+
+
+static const char *const OPCODE_NAMES[] = {
+  "CONST",         "LOAD",          "STORE",         "ASSIGN",        "ADD",           "SUB",
+  "MUL",           "DIV",           "ADD_CONST",     "MUL_CONST",     "DIV_CONST",     "PRINT",
+  "INPUT",         "JUMP",          "JUMP_EQ",       "JUMP_NE",       "JUMP_LT",       "JUMP_LE",
+  "JUMP_GT",       "JUMP_GE",       "LINE_ERROR",    "HALT",          "EXIT",          "GOSUB",
+  "RETURN",        "ON_GOTO",       "ON_GOSUB",      "INC",           "JUMP_EQ_CONST", "JUMP_LT_CONST",
+  "JUMP_GT_CONST", "JUMP_EQ_VARS",  "JUMP_LT_VARS",  "JUMP_GT_VARS",  "PRINT_VAR",     "NEXT_UP",
+  "NEXT_DOWN"};
+
+static const int REPORTED = 12;
+
+/*
+ * A sequence counts as executed back to back as often as its least
+ * executed instruction, and never extends past an instruction that
+ * may transfer control.
+ */
+
+static bool endsSequence(OpCode op)
+{
+  return (op >= OP_JUMP && op <= OP_JUMP_GE) || op == OP_LINE_ERROR || op == OP_HALT || op == OP_EXIT ||
+         op == OP_GOSUB || op == OP_RETURN || op == OP_ON_GOTO || op == OP_ON_GOSUB ||
+         (op >= OP_JUMP_EQ_CONST && op <= OP_JUMP_GT_VARS) || op == OP_NEXT_UP || op == OP_NEXT_DOWN;
+}
+
+static void addSequences(const Chunk &chunk, const std::vector<long long> &counts,
+                         std::map<std::string, long long> &sequences)
+{
+  int n = static_cast<int>(chunk.code.size());
+  for (int pc = 0; pc < n; pc++)
+  {
+    std::string name = OPCODE_NAMES[chunk.code[pc].op];
+    long long weight = counts[pc];
+    for (int next = pc + 1; next < n && next < pc + 3 && !endsSequence(chunk.code[next - 1].op); next++)
+    {
+      name += std::string(" ") + OPCODE_NAMES[chunk.code[next].op];
+      weight = std::min(weight, counts[next]);
+      if (weight > 0)
+        sequences[name] += weight;
+    }
+  }
+}
+
+static void runSession(const std::string &path, std::map<std::string, long long> &sequences, long long &total)
+{
+  std::ifstream file(path);
+  std::vector<std::string> lines;
+  std::string line;
+  while (std::getline(file, line))
+    lines.push_back(line);
+
+  Program program;
+  for (std::size_t i = 0; i < lines.size(); i++)
+  {
+    const std::string &text = lines[i];
+    if (!text.empty() && std::isdigit(static_cast<unsigned char>(text[0])))
+    {
+      std::size_t split = text.find(' ');
+      try
+      {
+        program.addSourceLine(std::stoi(text.substr(0, split)), split == std::string::npos ? "" : text.substr(split + 1),
+                              text.substr(0, split));
+      }
+      catch (ErrorException &)
+      {
+      }
+      continue;
+    }
+    if (text != "RUN")
+      continue;
+
+    std::string input;
+    for (std::size_t j = i + 1; j < lines.size() && lines[j] != "RUN"; j++)
+      input += lines[j] + "\n";
+    for (int j = 0; j < 64; j++)
+      input += "0\n";
+    std::istringstream in(input);
+    std::streambuf *savedIn = std::cin.rdbuf(in.rdbuf());
+    std::streambuf *savedOut = std::cout.rdbuf(nullptr);
+
+    Chunk chunk;
+    Compiler compiler;
+    compiler.setSuperinstructions(false);
+    std::vector<long long> counts;
+    if (compiler.compile(program, chunk))
+    {
+      VM vm;
+      EvalState state;
+      try
+      {
+        vm.profile(chunk, state, counts);
+      }
+      catch (ErrorException &)
+      {
+      }
+    }
+    std::cin.rdbuf(savedIn);
+    std::cout.rdbuf(savedOut);
+    if (counts.empty())
+      continue;
+    for (long long count : counts)
+      total += count;
+    addSequences(chunk, counts, sequences);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  std::map<std::string, long long> sequences;
+  long long total = 0;
+  for (int i = 1; i < argc; i++)
+    runSession(argv[i], sequences, total);
+  if (total == 0)
+  {
+    std::cout << "no instructions executed\n";
+    return 0;
+  }
+
+  std::vector<std::pair<long long, std::string>> ranked;
+  for (const auto &entry : sequences)
+    ranked.emplace_back(entry.second, entry.first);
+  std::sort(ranked.rbegin(), ranked.rend());
+  std::cout << total << " dispatches\n";
+  for (int length = 2; length <= 3; length++)
+  {
+    std::cout << "sequences of " << length << "\n";
+    int shown = 0;
+    for (const auto &entry : ranked)
+    {
+      if (std::count(entry.second.begin(), entry.second.end(), ' ') != length - 1)
+        continue;
+      std::cout << "  " << std::left << std::setw(28) << entry.second << std::right << std::fixed
+                << std::setprecision(1) << std::setw(6) << 100.0 * entry.first / total << "%\n";
+      if (++shown == REPORTED)
+        break;
+    }
+  }
+  return 0;
+}
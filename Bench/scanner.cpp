@@ -0,0 +1,150 @@
+/*
+ * File: scanner.cpp
+ * -----------------
+ * Measures lexing.  A program of BASIC lines is split into tokens with
+ * the rules the interpreter uses for IF, and then again with many more
+ * operators and word characters defined, none of which occur in the
+ * program.  Character classes and operators are looked up in tables,
+ * so the extra rules should cost nothing.  Each configuration is run
+ * through Lexer::tokenize and through a TokenScanner reading the same
+ * lines token by token, and the result is the time per character of
+ * source in nanoseconds.  Long runs of spaces, letters and digits are
+ * skipped a block at a time where the build has SSE2 or AVX2; compile
+ * lexer.cpp with BASIC_LEXER_SCALAR defined to compare.
+ *
+ * Usage: bench_scanner [iterations]
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../Basic/Utils/lexer.hpp"
+#include "../Basic/Utils/tokenScanner.hpp"
+
+
+struct Config
+{
+  std::string name;
+  int operatorLength; /* Length of the extra operators, 0 for none */
+  std::string wordChars;
+};
+
+/*
+ * The extra operators are every string of the given length over
+ * EXTRA_CHARS, which the program below never uses: 64 of length 2
+ * and 512 of length 3.
+ */
+
+static const std::string EXTRA_CHARS = "~`|^&@#$";
+
+static const std::vector<Config> configs = {
+  {"basic", 0, ""},
+  {"+64 ops", 2, ""},
+  {"+512 ops", 3, ""},
+  {"+word chars", 0, "_$#@!?.'"},
+};
+
+static const std::vector<std::string> lines = {
+  "LET total = total + count * 17 - (offset / 3)",
+  "IF count <> 100 THEN 250",
+  "IF alpha >= beta THEN 310",
+  "PRINT (first + second) * third - 12345",
+  "INPUT response",
+  "LET index = index + 1",
+  "IF index <= limit THEN 40",
+  "GOTO 1000",
+  "        LET accumulatedTemperatureReadings = accumulatedTemperatureReadings + 1234567890",
+  "        IF numberOfRemainingIterations > 1000000000 THEN 9000",
+};
+
+static void addOperators(std::string prefix, int length, Lexer &lexer, TokenScanner &scanner)
+{
+  if (length == 0)
+  {
+    lexer.addOperator(prefix);
+    scanner.addOperator(prefix);
+    return;
+  }
+  for (char ch : EXTRA_CHARS)
+    addOperators(prefix + ch, length - 1, lexer, scanner);
+}
+
+static void configure(const Config &config, Lexer &lexer, TokenScanner &scanner)
+{
+  lexer.ignoreWhitespace();
+  lexer.scanNumbers();
+  scanner.ignoreWhitespace();
+  scanner.scanNumbers();
+  for (const char *op : {"<>", "<=", ">="})
+  {
+    lexer.addOperator(op);
+    scanner.addOperator(op);
+  }
+  if (config.operatorLength > 0)
+    addOperators("", config.operatorLength, lexer, scanner);
+  lexer.addWordCharacters(config.wordChars);
+  scanner.addWordCharacters(config.wordChars);
+}
+
+/*
+ * Each run reads every line iterations times and returns the time per
+ * character in nanoseconds.  The token count is returned through
+ * count, so that the work cannot be optimized away.
+ */
+
+static double measureLexer(const Lexer &lexer, int iterations, std::size_t &count)
+{
+  std::vector<Token> tokens;
+  std::size_t chars = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++)
+  {
+    for (const std::string &line : lines)
+    {
+      lexer.tokenize(line, tokens);
+      count += tokens.size();
+      chars += line.size();
+    }
+  }
+  auto stop = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(stop - start).count() / chars;
+}
+
+static double measureScanner(TokenScanner &scanner, int iterations, std::size_t &count)
+{
+  std::size_t chars = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++)
+  {
+    for (const std::string &line : lines)
+    {
+      scanner.setInputView(line);
+      while (scanner.hasMoreTokens())
+        count += scanner.nextToken().size();
+      chars += line.size();
+    }
+  }
+  auto stop = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(stop - start).count() / chars;
+}
+
+int main(int argc, char **argv)
+{
+  int iterations = argc > 1 ? std::atoi(argv[1]) : 200000;
+  std::size_t count = 0;
+  std::cout << std::left << std::setw(14) << "" << std::setw(12) << "lexer" << std::setw(12) << "scanner"
+            << "(ns/char)\n";
+  for (const Config &config : configs)
+  {
+    Lexer lexer;
+    TokenScanner scanner;
+    configure(config, lexer, scanner);
+    std::cout << std::setw(14) << config.name << std::fixed << std::setprecision(2);
+    std::cout << std::setw(12) << measureLexer(lexer, iterations, count);
+    std::cout << std::setw(12) << measureScanner(scanner, iterations, count) << "\n";
+  }
+  return count == 0;
+}
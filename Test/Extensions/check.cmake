@@ -0,0 +1,40 @@
+# Runs one trace through the interpreter and compares what it prints
+# with the expected output next to it, or with what REFERENCE prints
+# for the same trace if that is given.
+#
+# Usage: cmake -DBASIC=<code> -DFLAGS="<options>" -DTRACE=<name.txt>
+#              [-DREFERENCE=<interpreter>] -P check.cmake
+#
+# Options in name.args, if there is one, are passed after FLAGS.
+
+string(REGEX REPLACE "\\.txt$" "" base "${TRACE}")
+separate_arguments(args UNIX_COMMAND "${FLAGS}")
+if (EXISTS "${base}.args")
+    file(READ "${base}.args" extra)
+    separate_arguments(extra UNIX_COMMAND "${extra}")
+    list(APPEND args ${extra})
+endif ()
+
+execute_process(COMMAND "${BASIC}" ${args}
+        INPUT_FILE "${TRACE}"
+        OUTPUT_VARIABLE actual
+        RESULT_VARIABLE status
+        TIMEOUT 10)
+if (DEFINED REFERENCE)
+    execute_process(COMMAND "${REFERENCE}"
+            INPUT_FILE "${TRACE}"
+            OUTPUT_VARIABLE expected
+            RESULT_VARIABLE reference_status
+            TIMEOUT 10)
+    if (NOT reference_status EQUAL 0)
+        message(FATAL_ERROR "${TRACE}: ${REFERENCE} exited with ${reference_status}")
+    endif ()
+else ()
+    file(READ "${base}.ans" expected)
+endif ()
+if (NOT status EQUAL 0)
+    message(FATAL_ERROR "${TRACE}: interpreter exited with ${status}")
+endif ()
+if (NOT actual STREQUAL expected)
+    message(FATAL_ERROR "${TRACE}: output differs\n--- expected\n${expected}--- actual\n${actual}")
+endif ()